@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+#include "arena.h"
+
+using namespace std;
+
+Arena::Arena(size_t block_size) :
+    _current(0),
+    _ptr(0),
+    _end(0),
+    _block_size(block_size),
+    _used(0) {
+}
+
+Arena::~Arena() {
+    release();
+}
+
+/*
+ * Move on to a block with room for `size` bytes aligned to `align`
+ *  _blocks[0 .. _current] are in use and the blocks after them are free. Use the
+ *  first free block that is big enough or a new one if there is none. Requests
+ *  bigger than _block_size get a block of their own
+ */
+void *
+Arena::allocate_slow(size_t size, size_t align) {
+    size_t needed = size + align - 1;
+    size_t next = _ptr ? _current + 1 : 0;
+
+    size_t i = next;
+    while (i < _blocks.size() && _blocks[i]._size < needed) {
+        i++;
+    }
+    if (i == _blocks.size()) {
+        size_t block_size = needed > _block_size ? needed : _block_size;
+        char *data = (char *)malloc(block_size);
+        if (!data) {
+            throw bad_alloc();
+        }
+        _blocks.push_back(Block(data, block_size));
+    }
+    swap(_blocks[i], _blocks[next]);
+
+    _current = next;
+    _ptr = _blocks[next]._data;
+    _end = _ptr + _blocks[next]._size;
+    return allocate(size, align);
+}
+
+void
+Arena::reset() {
+    _current = 0;
+    _ptr = _blocks.empty() ? 0 : _blocks[0]._data;
+    _end = _blocks.empty() ? 0 : _ptr + _blocks[0]._size;
+    _used = 0;
+}
+
+void
+Arena::release() {
+    for (vector<Block>::iterator it = _blocks.begin(); it != _blocks.end(); ++it) {
+        free(it->_data);
+    }
+    _blocks.clear();
+    reset();
+}
+
+size_t
+Arena::bytes_reserved() const {
+    size_t size = 0;
+    for (vector<Block>::const_iterator it = _blocks.begin(); it != _blocks.end(); ++it) {
+        size += it->_size;
+    }
+    return size;
+}
+
+LevelArena::LevelArena(int n_workers) {
+    for (int i = 0; i < n_workers; i++) {
+        _arenas.push_back(new Arena());
+    }
+}
+
+LevelArena::~LevelArena() {
+    for (vector<Arena *>::iterator it = _arenas.begin(); it != _arenas.end(); ++it) {
+        delete *it;
+    }
+}
+
+void
+LevelArena::reset() {
+    for (vector<Arena *>::iterator it = _arenas.begin(); it != _arenas.end(); ++it) {
+        (*it)->reset();
+    }
+}
+
+size_t
+LevelArena::bytes_used() const {
+    size_t size = 0;
+    for (vector<Arena *>::const_iterator it = _arenas.begin(); it != _arenas.end(); ++it) {
+        size += (*it)->bytes_used();
+    }
+    return size;
+}
+
+size_t
+LevelArena::bytes_reserved() const {
+    size_t size = 0;
+    for (vector<Arena *>::const_iterator it = _arenas.begin(); it != _arenas.end(); ++it) {
+        size += (*it)->bytes_reserved();
+    }
+    return size;
+}
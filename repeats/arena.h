@@ -0,0 +1,114 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+/*
+ * A bump allocator for data that is created together and freed together, such
+ *  as all the Postings of one level of get_all_repeats()
+ *
+ * Memory is handed out from large blocks so allocation is a pointer increment
+ *  and there is no per-allocation free. reset() frees everything at once and
+ *  keeps the blocks to be reused, so an Arena that is reset and refilled every
+ *  pass stops calling malloc once it has grown to the size of a pass.
+ *
+ * An Arena is not thread safe. Give each thread its own. See LevelArena
+ *
+ * Expected usage
+ * ---------------
+ *  Arena arena;
+ *  offset_t *offsets = arena.alloc_array<offset_t>(n);
+ *  ...
+ *  arena.reset();  // offsets is no longer valid
+ */
+class Arena {
+    struct Block {
+        char *_data;
+        size_t _size;
+        Block(char *data, size_t size) : _data(data), _size(size) {}
+    };
+
+    std::vector<Block> _blocks;     // All blocks owned by the arena. _blocks[_current] is being filled
+    size_t _current;                // Index of block being allocated from
+    char *_ptr;                     // Next free byte in _blocks[_current]
+    char *_end;                     // End of _blocks[_current]
+    size_t _block_size;             // Size of blocks allocated for small requests
+    size_t _used;                   // Bytes allocated since the last reset() including alignment padding
+
+    void *allocate_slow(size_t size, size_t align);
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+public:
+    explicit Arena(size_t block_size = (1 << 20));
+    ~Arena();
+
+    // Return `size` bytes aligned to `align`, which must be a power of 2
+    void *allocate(size_t size, size_t align) {
+        size_t pad = (size_t)(-(ptrdiff_t)_ptr) & (align - 1);
+        if (pad + size > (size_t)(_end - _ptr)) {
+            return allocate_slow(size, align);
+        }
+        char *p = _ptr + pad;
+        _ptr = p + size;
+        _used += pad + size;
+        return p;
+    }
+
+    // Return room for `n` T's
+    template <class T>
+    T *alloc_array(size_t n) {
+        return (T *)allocate(n * sizeof(T), alignof(T));
+    }
+
+    // Return a copy of the `n` T's at `src`, or 0 if n == 0
+    template <class T>
+    T *copy_array(const T *src, size_t n) {
+        if (n == 0) {
+            return 0;
+        }
+        T *dst = alloc_array<T>(n);
+        memcpy(dst, src, n * sizeof(T));
+        return dst;
+    }
+
+    // Free everything allocated from the arena but keep its memory for reuse
+    void reset();
+
+    // Free everything allocated from the arena and return its memory to the system
+    void release();
+
+    // Bytes handed out since the last reset()
+    size_t bytes_used() const { return _used; }
+
+    // Bytes of memory held by the arena
+    size_t bytes_reserved() const;
+};
+
+/*
+ * The storage for one level of get_all_repeats(): one Arena per worker thread so
+ *  the workers can allocate without locking
+ */
+class LevelArena {
+    std::vector<Arena *> _arenas;
+
+    LevelArena(const LevelArena&);
+    LevelArena& operator=(const LevelArena&);
+
+public:
+    explicit LevelArena(int n_workers);
+    ~LevelArena();
+
+    Arena& worker_arena(int worker) { return *_arenas[worker]; }
+
+    // reset() all the workers' arenas
+    void reset();
+
+    size_t bytes_used() const;
+    size_t bytes_reserved() const;
+};
+
+#endif // #ifndef ARENA_H
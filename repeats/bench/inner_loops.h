@@ -0,0 +1,124 @@
+#ifndef INNER_LOOPS_H
+#define INNER_LOOPS_H
+
+#include <algorithm>
+#include <vector>
+#include "mytypes.h"
+#include "utils.h"
+
+/*
+ * The INNER_LOOP 1-4 versions of get_sb_offsets() in find_best_strings.cpp for the
+ *  benchmarks. The engines only build the INNER_LOOP selected in mytypes.h so these
+ *  copies let one benchmark binary time all of them against the INNER_LOOP 5
+ *  kernels in intersect.cpp
+ *
+ * All append the offsets s in [s, s_end) for which s + m is in [b, b_end) to sb_offsets
+ */
+
+// INNER_LOOP 1: Linear merge
+static inline
+void
+inner_loop_1(const offset_t *is, const offset_t *s_end, offset_t m, const offset_t *ib, const offset_t *b_end,
+             std::vector<offset_t>& sb_offsets) {
+    while (ib < b_end && is < s_end) {
+        offset_t is_m = *is + m;
+        if (*ib == is_m) {
+            sb_offsets.push_back(*is);
+            ++is;
+        } else if (*ib < is_m) {
+            while (ib < b_end && *ib < is_m) {
+                ++ib;
+            }
+        } else {
+            offset_t ib_m = *ib - m;
+            while (is < s_end && *is < ib_m) {
+                ++is;
+            }
+        }
+    }
+}
+
+// INNER_LOOP 2: Binary search both lists with get_gteq()
+static inline
+void
+inner_loop_2(const offset_t *is, const offset_t *s_end, offset_t m, const offset_t *ib, const offset_t *b_end,
+             std::vector<offset_t>& sb_offsets) {
+    while (ib < b_end && is < s_end) {
+        if (*ib == *is + m) {
+            sb_offsets.push_back(*is);
+            ++is;
+        } else if (*ib < *is + m) {
+            ib = get_gteq(ib, b_end, *is + m);
+        } else {
+            is = get_gteq(is, s_end, *ib - m);
+        }
+    }
+}
+
+// INNER_LOOP 3: Step through both lists in blocks of 512 with get_gteq2()
+static inline
+void
+inner_loop_3(const offset_t *is, const offset_t *s_end, offset_t m, const offset_t *ib, const offset_t *b_end,
+             std::vector<offset_t>& sb_offsets) {
+    size_t step_size_b = 512;
+    size_t step_size_s = 512;
+
+    while (ib < b_end && is < s_end) {
+        if (*ib == *is + m) {
+            sb_offsets.push_back(*is);
+            ++is;
+        } else if (*ib < *is + m) {
+            ib = get_gteq2(ib, b_end, *is + m, step_size_b);
+        } else {
+            is = get_gteq2(is, s_end, *ib - m, step_size_s);
+        }
+    }
+}
+
+// INNER_LOOP 4: Linear merge if |b| / |s| < 8, otherwise step through b_offsets in
+//  blocks of next_power2(|b| / |s|) with get_gteq2()
+static inline
+void
+inner_loop_4(const offset_t *is, const offset_t *s_end, offset_t m, const offset_t *ib, const offset_t *b_end,
+             std::vector<offset_t>& sb_offsets) {
+    double ratio = (double)(b_end - ib) / (double)(s_end - is);
+
+    if (ratio < 8.0) {
+        while (ib != b_end && is != s_end) {
+            offset_t s_m = *is + m;
+            if (*ib == s_m) {
+                sb_offsets.push_back(*is);
+                ++ib;
+                ++is;
+            } else if (*ib < s_m) {
+                while (ib != b_end && *ib < s_m) {
+                    ++ib;
+                }
+            } else {
+                offset_t b_m = *ib - m;
+                while (is != s_end && *is < b_m) {
+                    ++is;
+                }
+            }
+        }
+    } else {
+        size_t step_size_b = next_power2(ratio);
+        while (ib != b_end && is != s_end) {
+            offset_t s_m = *is + m;
+            if (*ib == s_m) {
+                sb_offsets.push_back(*is);
+                ++ib;
+                ++is;
+            } else if (*ib < s_m) {
+                ib = get_gteq2(ib, b_end, s_m, step_size_b);
+            } else {
+                offset_t b_m = *ib - m;
+                while (is != s_end && *is < b_m) {
+                    ++is;
+                }
+            }
+        }
+    }
+}
+
+#endif // #ifndef INNER_LOOPS_H
@@ -0,0 +1,150 @@
+/*
+ * Microbenchmark of the get_sb_offsets() intersection kernels in intersect.cpp
+ *
+ * Sweeps the ratio of the lengths of the s and b offset lists, which is what
+ *  decides between merging and galloping, and reports nanoseconds per input offset
+ *  for each kernel and for the INNER_LOOP 4 code that they replace. See kernel_bench.cpp
+ *  for the other inner loop kernels and offset distributions.
+ *
+ * Built as the intersect_bench target of CMakeLists.txt, or from the repeats directory with e.g.
+ *  g++ -O2 -std=c++11 -I. bench/intersect_bench.cpp intersect.cpp cpu_features.cpp -o intersect_bench
+ *
+ * Usage: intersect_bench [long_list_size [match_fraction]]
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "intersect.h"
+#include "cpu_features.h"
+#include "inner_loops.h"
+
+using namespace std;
+
+// Ratios of the lengths of the two lists. Negative => s is the longer list
+static const int RATIOS[] = {-256, -64, -16, -4, 1, 4, 16, 64, 256};
+
+// Minimum time to run each kernel for each measurement
+#define MIN_SECONDS 0.2
+
+// Distance of b from s. The |s| + gap of the search
+#define M 7
+
+/*
+ * Return `n` strictly increasing random offsets with average spacing `spacing`
+ */
+static vector<offset_t>
+make_offsets(size_t n, double spacing, mt19937& rng) {
+    vector<offset_t> offsets(n);
+    uniform_int_distribution<int> step(1, max(1, (int)(2.0 * spacing) - 1));
+    offset_t x = 0;
+    for (size_t i = 0; i < n; i++) {
+        x += step(rng);
+        offsets[i] = x;
+    }
+    return offsets;
+}
+
+/*
+ * Return s offsets and b offsets of sizes `n_s` and `n_b` where about `match_fraction`
+ *  of the shorter list are part of s + b terms
+ */
+static void
+make_lists(size_t n_s, size_t n_b, double match_fraction, mt19937& rng,
+           vector<offset_t>& s_offsets, vector<offset_t>& b_offsets) {
+    const double span = 1.0e8;
+    s_offsets = make_offsets(n_s, span / n_s, rng);
+    b_offsets = make_offsets(n_b, span / n_b, rng);
+
+    // Overwrite a random subset of the longer list with matches of the shorter one
+    bernoulli_distribution is_match(match_fraction);
+    if (n_s <= n_b) {
+        for (size_t i = 0; i < n_s; i++) {
+            if (is_match(rng)) {
+                b_offsets.push_back(s_offsets[i] + M);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n_b; i++) {
+            if (is_match(rng) && b_offsets[i] >= M) {
+                s_offsets.push_back(b_offsets[i] - M);
+            }
+        }
+    }
+    sort(s_offsets.begin(), s_offsets.end());
+    s_offsets.erase(unique(s_offsets.begin(), s_offsets.end()), s_offsets.end());
+    sort(b_offsets.begin(), b_offsets.end());
+    b_offsets.erase(unique(b_offsets.begin(), b_offsets.end()), b_offsets.end());
+}
+
+/*
+ * Return nanoseconds per input offset for intersecting the lists with `method`,
+ *  or with inner_loop_4() if method < 0
+ */
+static double
+time_kernel(int method, const vector<offset_t>& s_offsets, const vector<offset_t>& b_offsets,
+            vector<offset_t>& sb_offsets) {
+    typedef chrono::steady_clock Clock;
+    size_t n_runs = 0;
+    Clock::time_point t0 = Clock::now();
+    double seconds = 0.0;
+    do {
+        sb_offsets.clear();
+        if (method < 0) {
+            inner_loop_4(s_offsets.data(), s_offsets.data() + s_offsets.size(), M,
+                         b_offsets.data(), b_offsets.data() + b_offsets.size(), sb_offsets);
+        } else {
+            intersect_offsets(s_offsets, M, b_offsets, sb_offsets, (IntersectMethod)method);
+        }
+        n_runs++;
+        seconds = chrono::duration<double>(Clock::now() - t0).count();
+    } while (seconds < MIN_SECONDS);
+    return seconds * 1.0e9 / ((double)n_runs * (double)(s_offsets.size() + b_offsets.size()));
+}
+
+int
+main(int argc, char *argv[]) {
+    size_t n_long = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    double match_fraction = argc > 2 ? atof(argv[2]) : 0.5;
+
+    cout << "isa=" << get_isa_name(get_cpu_isa()) << ", long list=" << n_long
+         << ", match fraction=" << match_fraction << endl;
+    cout << "ns per input offset" << endl;
+    cout << setw(8) << "|b|/|s|" << setw(10) << "matches" << setw(10) << "loop4";
+    for (int method = 0; method < NUM_INTERSECT_METHODS; method++) {
+        cout << setw(10) << get_intersect_method_name((IntersectMethod)method);
+    }
+    cout << endl;
+
+    mt19937 rng(111);
+    for (size_t r = 0; r < sizeof(RATIOS) / sizeof(RATIOS[0]); r++) {
+        int ratio = RATIOS[r];
+        size_t n_s = ratio > 0 ? n_long / ratio : n_long;
+        size_t n_b = ratio > 0 ? n_long : n_long / -ratio;
+
+        vector<offset_t> s_offsets, b_offsets;
+        make_lists(n_s, n_b, match_fraction, rng, s_offsets, b_offsets);
+
+        vector<offset_t> expected;
+        double loop4 = time_kernel(-1, s_offsets, b_offsets, expected);
+
+        cout << setw(8) << (ratio > 0 ? to_string(ratio) : "1/" + to_string(-ratio))
+             << setw(10) << expected.size()
+             << setw(10) << fixed << setprecision(3) << loop4;
+        for (int method = 0; method < NUM_INTERSECT_METHODS; method++) {
+            vector<offset_t> sb_offsets;
+            double ns = time_kernel(method, s_offsets, b_offsets, sb_offsets);
+            if (sb_offsets != expected) {
+                cerr << endl << get_intersect_method_name((IntersectMethod)method) << " gave wrong result" << endl;
+                return 1;
+            }
+            cout << setw(10) << ns;
+        }
+        cout << endl;
+    }
+    return 0;
+}
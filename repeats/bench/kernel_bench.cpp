@@ -0,0 +1,522 @@
+/*
+ * Microbenchmarks of the inner kernels of the repeat search, run on synthetic data so
+ *  that the timings are not drowned out by file I/O and the rest of the pipeline as they
+ *  are in multi_test() in main.cpp
+ *
+ * Kernels
+ *  sb/loop1 .. sb/loop4    get_sb_offsets() INNER_LOOP 1-4. See inner_loops.h
+ *  sb/merge, sb/gallop ..  get_sb_offsets() INNER_LOOP 5 i.e. intersect_offsets() with each
+ *                           IntersectMethod
+ *  gteq, gteq2             get_gteq() and get_gteq2() searching forward through the b offsets
+ *                           for each s offset + m
+ *  non_overlapping         get_non_overlapping_count()
+ *  sb_count/two_pass       intersect_offsets() then get_non_overlapping_count() of the result
+ *  sb_count/fused          intersect_offsets_count(), which counts during the intersection
+ *  count_bytes             The two passes over the document bytes that build the byte
+ *  scatter_offsets          offsets of each document. See byte_kernels.h
+ *  get_intersection        Intersection of the allowed byte sets of two documents
+ *
+ * Offset distributions
+ *  uniform     Random gaps
+ *  clustered   Bursts of closely spaced offsets, like a term in repeated passages
+ *  periodic    Fixed spacing, like a term in fixed width records
+ *  skewed_b64  Uniform with |b| = 64 |s|. Galloping territory
+ *  skewed_s64  Uniform with |s| = 64 |b|
+ *
+ * Like Google Benchmark, each benchmark is run in batches of increasing numbers of
+ *  iterations until a batch takes at least --min-time seconds. The time of that batch is
+ *  reported as ns per iteration, ns per input offset (or byte) and MB/s of input.
+ *
+ * Built as the repeats_bench target of CMakeLists.txt
+ *
+ * Usage: repeats_bench [--filter=<substring>] [--size=<n>] [--min-time=<seconds>] [--isa=<isa>]
+ *      --filter: Only run benchmarks whose names contain this e.g. --filter=sb/ or --filter=clustered
+ *      --size: Length of the longer offset list. Default 1000000
+ *      --min-time: Minimum time of the measured batch of each benchmark. Default 0.2
+ *      --isa: Don't use instructions beyond this instruction set e.g. --isa=sse42
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "mytypes.h"
+#include "utils.h"
+#include "byte_kernels.h"
+#include "cpu_features.h"
+#include "intersect.h"
+#include "inner_loops.h"
+
+using namespace std;
+
+// Distance of b from s. The |s| + gap of the search
+#define M 7
+
+// Length of terms for get_non_overlapping_count()
+#define TERM_LEN 8
+
+// Fraction of the offsets in the shorter list that are part of s + b terms
+#define MATCH_FRACTION 0.5
+
+// Number of offsets in each burst of the clustered distribution
+#define CLUSTER_SIZE 32
+
+// Iteration limit for kernels that are too fast for the clock
+#define MAX_ITERATIONS 1000000000
+
+/*
+ * A benchmark
+ */
+struct Benchmark {
+    string _name;
+    size_t _n_items;            // Number of offsets or bytes processed by each run
+    size_t _n_bytes;            // Bytes of input read by each run
+    function<size_t()> _run;    // Run the kernel once. Returns something computed from the
+                                //  result so the kernel is not optimized away
+
+    Benchmark(const string& name, size_t n_items, size_t n_bytes, function<size_t()> run) :
+        _name(name), _n_items(n_items), _n_bytes(n_bytes), _run(run) {}
+};
+
+static vector<Benchmark> _benchmarks;
+
+// Sum of the benchmark results. Keeps the compiler from removing the kernels
+static volatile size_t _sink;
+
+/*
+ * The ways of distributing offsets
+ */
+enum Distribution {
+    DIST_UNIFORM,
+    DIST_CLUSTERED,
+    DIST_PERIODIC
+};
+
+/*
+ * Return `n` strictly increasing offsets distributed as `dist` over about [0, span)
+ */
+static vector<offset_t>
+make_offsets(Distribution dist, size_t n, double span, mt19937& rng) {
+    vector<offset_t> offsets(n);
+    double spacing = span / (double)n;
+    offset_t x = 0;
+
+    if (dist == DIST_UNIFORM) {
+        uniform_int_distribution<int> step(1, max(1, (int)(2.0 * spacing) - 1));
+        for (size_t i = 0; i < n; i++) {
+            x += step(rng);
+            offsets[i] = x;
+        }
+    } else if (dist == DIST_CLUSTERED) {
+        // Steps of 1-3 within a cluster and a gap between clusters that keeps the span
+        uniform_int_distribution<int> step(1, 3);
+        int max_gap = max(1, (int)(2.0 * (spacing - 2.0) * CLUSTER_SIZE) - 1);
+        uniform_int_distribution<int> gap(1, max_gap);
+        for (size_t i = 0; i < n; i++) {
+            x += (i % CLUSTER_SIZE == 0) ? gap(rng) : step(rng);
+            offsets[i] = x;
+        }
+    } else {
+        offset_t period = max((offset_t)1, (offset_t)spacing);
+        x = uniform_int_distribution<offset_t>(0, period - 1)(rng);
+        for (size_t i = 0; i < n; i++) {
+            offsets[i] = x;
+            x += period;
+        }
+    }
+    return offsets;
+}
+
+/*
+ * Return s offsets and b offsets distributed as `dist` of sizes `n_s` and `n_b` where
+ *  about MATCH_FRACTION of the shorter list are part of s + b terms
+ */
+static void
+make_lists(Distribution dist, size_t n_s, size_t n_b, mt19937& rng,
+           vector<offset_t>& s_offsets, vector<offset_t>& b_offsets) {
+    double span = 100.0 * (double)max(n_s, n_b);
+    s_offsets = make_offsets(dist, n_s, span, rng);
+    b_offsets = make_offsets(dist, n_b, span, rng);
+
+    bernoulli_distribution is_match(MATCH_FRACTION);
+    if (n_s <= n_b) {
+        for (size_t i = 0; i < n_s; i++) {
+            if (is_match(rng)) {
+                b_offsets.push_back(s_offsets[i] + M);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n_b; i++) {
+            if (is_match(rng) && b_offsets[i] >= M) {
+                s_offsets.push_back(b_offsets[i] - M);
+            }
+        }
+    }
+    sort(s_offsets.begin(), s_offsets.end());
+    s_offsets.erase(unique(s_offsets.begin(), s_offsets.end()), s_offsets.end());
+    sort(b_offsets.begin(), b_offsets.end());
+    b_offsets.erase(unique(b_offsets.begin(), b_offsets.end()), b_offsets.end());
+}
+
+/*
+ * The s and b offsets of a benchmark case and the buffer the kernels write to
+ */
+struct OffsetLists {
+    vector<offset_t> _s;
+    vector<offset_t> _b;
+    vector<offset_t> _sb;
+
+    const offset_t *s_begin() const { return _s.data(); }
+    const offset_t *s_end() const { return _s.data() + _s.size(); }
+    const offset_t *b_begin() const { return _b.data(); }
+    const offset_t *b_end() const { return _b.data() + _b.size(); }
+    size_t size() const { return _s.size() + _b.size(); }
+};
+
+typedef void (*InnerLoop)(const offset_t *, const offset_t *, offset_t, const offset_t *, const offset_t *,
+                          vector<offset_t>&);
+
+/*
+ * Add the sb/, gteq and gteq2 benchmarks for lists distributed as `dist` with |b| / |s| = `ratio`
+ *  Negative ratio => |s| / |b| = -ratio
+ *  Returns false if the kernels don't agree
+ */
+static bool
+add_list_benchmarks(const string& case_name, Distribution dist, int ratio, size_t n_long, mt19937& rng) {
+    size_t n_s = ratio > 0 ? n_long / ratio : n_long;
+    size_t n_b = ratio > 0 ? n_long : n_long / -ratio;
+
+    shared_ptr<OffsetLists> lists = make_shared<OffsetLists>();
+    make_lists(dist, n_s, n_b, rng, lists->_s, lists->_b);
+    size_t n_items = lists->size();
+    size_t n_bytes = n_items * sizeof(offset_t);
+
+    vector<offset_t> expected;
+    inner_loop_1(lists->s_begin(), lists->s_end(), M, lists->b_begin(), lists->b_end(), expected);
+
+    static const InnerLoop INNER_LOOPS[] = {inner_loop_1, inner_loop_2, inner_loop_3, inner_loop_4};
+    for (int i = 0; i < (int)(sizeof(INNER_LOOPS) / sizeof(INNER_LOOPS[0])); i++) {
+        InnerLoop inner_loop = INNER_LOOPS[i];
+        lists->_sb.clear();
+        inner_loop(lists->s_begin(), lists->s_end(), M, lists->b_begin(), lists->b_end(), lists->_sb);
+        if (lists->_sb != expected) {
+            cerr << "INNER_LOOP " << i + 1 << " gave wrong result for " << case_name << endl;
+            return false;
+        }
+        _benchmarks.push_back(Benchmark("sb/loop" + to_string(i + 1) + "/" + case_name, n_items, n_bytes,
+            [lists, inner_loop]() {
+                lists->_sb.clear();
+                inner_loop(lists->s_begin(), lists->s_end(), M, lists->b_begin(), lists->b_end(), lists->_sb);
+                return lists->_sb.size();
+            }));
+    }
+
+    for (int method = 0; method < NUM_INTERSECT_METHODS; method++) {
+        IntersectMethod im = (IntersectMethod)method;
+        lists->_sb.clear();
+        intersect_offsets(lists->_s, M, lists->_b, lists->_sb, im);
+        if (lists->_sb != expected) {
+            cerr << get_intersect_method_name(im) << " gave wrong result for " << case_name << endl;
+            return false;
+        }
+        _benchmarks.push_back(Benchmark(string("sb/") + get_intersect_method_name(im) + "/" + case_name,
+            n_items, n_bytes,
+            [lists, im]() {
+                lists->_sb.clear();
+                intersect_offsets(lists->_s, M, lists->_b, lists->_sb, im);
+                return lists->_sb.size();
+            }));
+    }
+
+    // The s + b offsets and their non-overlapping count, as get_sb_postings() needs them
+    size_t expected_count = get_non_overlapping_count(expected.data(), expected.size(), TERM_LEN);
+    lists->_sb.clear();
+    if (intersect_offsets_count(lists->_s.data(), lists->_s.size(), M, lists->_b.data(), lists->_b.size(),
+                                TERM_LEN, 0, lists->_sb) != expected_count || lists->_sb != expected) {
+        cerr << "intersect_offsets_count gave wrong result for " << case_name << endl;
+        return false;
+    }
+    _benchmarks.push_back(Benchmark("sb_count/two_pass/" + case_name, n_items, n_bytes,
+        [lists]() {
+            lists->_sb.clear();
+            intersect_offsets(lists->_s, M, lists->_b, lists->_sb);
+            return get_non_overlapping_count(lists->_sb.data(), lists->_sb.size(), TERM_LEN);
+        }));
+    _benchmarks.push_back(Benchmark("sb_count/fused/" + case_name, n_items, n_bytes,
+        [lists]() {
+            lists->_sb.clear();
+            return intersect_offsets_count(lists->_s.data(), lists->_s.size(), M,
+                                           lists->_b.data(), lists->_b.size(), TERM_LEN, 0, lists->_sb);
+        }));
+
+    // Forward searches of b for each s + m, as INNER_LOOP 2 and 4 do
+    _benchmarks.push_back(Benchmark("gteq/" + case_name, n_items, n_bytes,
+        [lists]() {
+            size_t n_found = 0;
+            const offset_t *ib = lists->b_begin();
+            const offset_t *b_end = lists->b_end();
+            for (const offset_t *is = lists->s_begin(); is != lists->s_end() && ib != b_end; ++is) {
+                ib = get_gteq(ib, b_end, *is + M);
+                if (ib != b_end && *ib == *is + M) {
+                    n_found++;
+                }
+            }
+            return n_found;
+        }));
+
+    size_t step_size = next_power2(max(2.0, (double)n_b / (double)n_s));
+    _benchmarks.push_back(Benchmark("gteq2/" + case_name, n_items, n_bytes,
+        [lists, step_size]() {
+            size_t n_found = 0;
+            const offset_t *ib = lists->b_begin();
+            const offset_t *b_end = lists->b_end();
+            for (const offset_t *is = lists->s_begin(); is != lists->s_end() && ib != b_end; ++is) {
+                ib = get_gteq2(ib, b_end, *is + M, step_size);
+                if (ib != b_end && *ib == *is + M) {
+                    n_found++;
+                }
+            }
+            return n_found;
+        }));
+
+    return true;
+}
+
+/*
+ * Add the get_non_overlapping_count() benchmark for `n` offsets distributed as `dist`
+ */
+static void
+add_non_overlapping_benchmark(const string& case_name, Distribution dist, size_t n, mt19937& rng) {
+    // Dense enough for terms of length TERM_LEN to overlap
+    shared_ptr<vector<offset_t>> offsets = make_shared<vector<offset_t>>(
+        make_offsets(dist, n, (double)n * TERM_LEN, rng));
+    _benchmarks.push_back(Benchmark("non_overlapping/" + case_name, n, n * sizeof(offset_t),
+        [offsets]() {
+            return get_non_overlapping_count(offsets->data(), offsets->size(), TERM_LEN);
+        }));
+}
+
+/*
+ * The ways of distributing document bytes
+ */
+enum TextKind {
+    TEXT_UNIFORM,       // All 256 byte values equally likely
+    TEXT_SKEWED,        // A few common bytes, like natural language text
+    TEXT_PERIODIC       // A repeated 37 byte record
+};
+
+/*
+ * Return `n` bytes of kind `kind`
+ */
+static vector<byte>
+make_text(TextKind kind, size_t n, mt19937& rng) {
+    vector<byte> text(n);
+    if (kind == TEXT_UNIFORM) {
+        uniform_int_distribution<int> b(0, ALPHABET_SIZE - 1);
+        for (size_t i = 0; i < n; i++) {
+            text[i] = (byte)b(rng);
+        }
+    } else if (kind == TEXT_SKEWED) {
+        geometric_distribution<int> rank(0.15);
+        for (size_t i = 0; i < n; i++) {
+            text[i] = (byte)(' ' + min(rank(rng), 94));
+        }
+    } else {
+        vector<byte> record(37);
+        uniform_int_distribution<int> b('a', 'z');
+        for (size_t i = 0; i < record.size(); i++) {
+            record[i] = (byte)b(rng);
+        }
+        for (size_t i = 0; i < n; i++) {
+            text[i] = record[i % record.size()];
+        }
+    }
+    return text;
+}
+
+/*
+ * The bytes of a document, the byte counts and the buffer scatter_offsets() writes to
+ */
+struct Document {
+    vector<byte> _text;
+    size_t _counts[ALPHABET_SIZE];
+    bool _allowed[ALPHABET_SIZE];
+    vector<offset_t> _offsets;
+};
+
+/*
+ * Add the count_bytes() and scatter_offsets() benchmarks for `n` bytes of kind `kind`
+ */
+static void
+add_ingest_benchmarks(const string& case_name, TextKind kind, size_t n, mt19937& rng) {
+    shared_ptr<Document> doc = make_shared<Document>();
+    doc->_text = make_text(kind, n, rng);
+    count_bytes(doc->_text.data(), doc->_text.data() + n, doc->_counts);
+    for (int b = 0; b < ALPHABET_SIZE; b++) {
+        doc->_allowed[b] = doc->_counts[b] > 0;
+    }
+    doc->_offsets.resize(n);
+
+    _benchmarks.push_back(Benchmark("count_bytes/" + case_name, n, n,
+        [doc]() {
+            size_t counts[ALPHABET_SIZE];
+            count_bytes(doc->_text.data(), doc->_text.data() + doc->_text.size(), counts);
+            return counts[doc->_text[0]];
+        }));
+
+    _benchmarks.push_back(Benchmark("scatter_offsets/" + case_name, n, n,
+        [doc]() {
+            offset_t *offsets_ptr[ALPHABET_SIZE];
+            offset_t *ptr = doc->_offsets.data();
+            for (int b = 0; b < ALPHABET_SIZE; b++) {
+                offsets_ptr[b] = ptr;
+                ptr += doc->_counts[b];
+            }
+            scatter_offsets(doc->_text.data(), doc->_text.data() + doc->_text.size(), doc->_allowed, offsets_ptr);
+            return (size_t)doc->_offsets.back();
+        }));
+}
+
+/*
+ * Add the get_intersection() benchmark for two sets that each contain a byte with
+ *  probability `density`
+ */
+static void
+add_intersection_benchmark(const string& case_name, double density, mt19937& rng) {
+    shared_ptr<pair<set<byte>, set<byte>>> sets = make_shared<pair<set<byte>, set<byte>>>();
+    bernoulli_distribution in_set(density);
+    for (int b = 0; b < ALPHABET_SIZE; b++) {
+        if (in_set(rng)) {
+            sets->first.insert((byte)b);
+        }
+        if (in_set(rng)) {
+            sets->second.insert((byte)b);
+        }
+    }
+    size_t n_items = sets->first.size() + sets->second.size();
+    _benchmarks.push_back(Benchmark("get_intersection/" + case_name, n_items, n_items,
+        [sets]() {
+            return get_intersection(sets->first, sets->second).size();
+        }));
+}
+
+/*
+ * Run `benchmark` in batches of increasing numbers of iterations until a batch takes at
+ *  least `min_seconds` and print the time of that batch
+ */
+static void
+run_benchmark(const Benchmark& benchmark, double min_seconds) {
+    typedef chrono::steady_clock Clock;
+    size_t n_iters = 1;
+    double seconds = 0.0;
+
+    for (;;) {
+        size_t sum = 0;
+        Clock::time_point t0 = Clock::now();
+        for (size_t i = 0; i < n_iters; i++) {
+            sum += benchmark._run();
+        }
+        seconds = chrono::duration<double>(Clock::now() - t0).count();
+        _sink += sum;
+        if (seconds >= min_seconds || n_iters >= MAX_ITERATIONS) {
+            break;
+        }
+        // Aim a little past min_seconds but grow by at most 10x a batch
+        double multiplier = seconds > 0.0 ? min(10.0, 1.4 * min_seconds / seconds) : 10.0;
+        n_iters = min((size_t)MAX_ITERATIONS, max(n_iters + 1, (size_t)(n_iters * multiplier)));
+    }
+
+    double ns_per_iter = seconds * 1.0e9 / (double)n_iters;
+    cout << left << setw(36) << benchmark._name << right
+         << setw(12) << n_iters
+         << fixed << setprecision(1)
+         << setw(14) << ns_per_iter
+         << setprecision(3)
+         << setw(12) << ns_per_iter / (double)benchmark._n_items
+         << setprecision(1)
+         << setw(12) << (double)benchmark._n_bytes * (double)n_iters / (seconds * 1.0e6)
+         << endl;
+}
+
+static const string OPT_FILTER = "--filter=";
+static const string OPT_SIZE = "--size=";
+static const string OPT_MIN_TIME = "--min-time=";
+static const string OPT_ISA = "--isa=";
+
+static
+bool
+starts_with(const string& s, const string& prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+int
+main(int argc, char *argv[]) {
+    string filter;
+    size_t n_long = 1000000;
+    double min_seconds = 0.2;
+
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (starts_with(arg, OPT_FILTER)) {
+            filter = arg.substr(OPT_FILTER.size());
+        } else if (starts_with(arg, OPT_SIZE)) {
+            n_long = (size_t)atol(arg.substr(OPT_SIZE.size()).c_str());
+        } else if (starts_with(arg, OPT_MIN_TIME)) {
+            min_seconds = atof(arg.substr(OPT_MIN_TIME.size()).c_str());
+        } else if (starts_with(arg, OPT_ISA)) {
+            CpuIsa isa;
+            if (!get_isa_from_name(arg.substr(OPT_ISA.size()), isa)) {
+                cerr << "Unknown instruction set '" << arg << "'" << endl;
+                return 1;
+            }
+            set_max_isa(isa);
+        } else {
+            cerr << "Usage: " << argv[0]
+                 << " [--filter=<substring>] [--size=<n>] [--min-time=<seconds>] [--isa=<isa>]" << endl;
+            return 1;
+        }
+    }
+    if (n_long < 256) {
+        cerr << "--size must be at least 256" << endl;
+        return 1;
+    }
+
+    mt19937 rng(111);
+    if (!add_list_benchmarks("uniform", DIST_UNIFORM, 1, n_long, rng)
+            || !add_list_benchmarks("clustered", DIST_CLUSTERED, 1, n_long, rng)
+            || !add_list_benchmarks("periodic", DIST_PERIODIC, 1, n_long, rng)
+            || !add_list_benchmarks("skewed_b64", DIST_UNIFORM, 64, n_long, rng)
+            || !add_list_benchmarks("skewed_s64", DIST_UNIFORM, -64, n_long, rng)) {
+        return 1;
+    }
+    add_non_overlapping_benchmark("uniform", DIST_UNIFORM, n_long, rng);
+    add_non_overlapping_benchmark("clustered", DIST_CLUSTERED, n_long, rng);
+    add_non_overlapping_benchmark("periodic", DIST_PERIODIC, n_long, rng);
+    add_ingest_benchmarks("uniform", TEXT_UNIFORM, n_long, rng);
+    add_ingest_benchmarks("skewed", TEXT_SKEWED, n_long, rng);
+    add_ingest_benchmarks("periodic", TEXT_PERIODIC, n_long, rng);
+    add_intersection_benchmark("half", 0.5, rng);
+    add_intersection_benchmark("dense", 0.95, rng);
+
+    cout << "isa=" << get_isa_name(get_cpu_isa()) << ", size=" << n_long
+         << ", min time=" << min_seconds << "s" << endl;
+    cout << left << setw(36) << "benchmark" << right
+         << setw(12) << "iterations"
+         << setw(14) << "ns/iter"
+         << setw(12) << "ns/item"
+         << setw(12) << "MB/s"
+         << endl;
+    for (vector<Benchmark>::const_iterator it = _benchmarks.begin(); it != _benchmarks.end(); ++it) {
+        if (filter.empty() || it->_name.find(filter) != string::npos) {
+            run_benchmark(*it, min_seconds);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * Byte histogram and offset scatter kernels used to build the byte level
+ *  inverted index
+ *
+ * The histogram is memory bound once the store-to-load forwarding stalls of a
+ *  single table are avoided, so it has one portable implementation that spreads
+ *  the counts over several sub-histograms.
+ *
+ * The scatter is dominated by the test of each byte against the allowed bytes,
+ *  which mispredicts badly when allowed and disallowed bytes are mixed. The SIMD
+ *  variants test a 64 byte block at a time and give a bit mask of the allowed
+ *  bytes in the block. Blocks with no allowed bytes are skipped, blocks with all
+ *  allowed bytes are scattered without any tests, and the rest are scattered
+ *  from the set bits of the mask.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include "byte_kernels.h"
+#include "cpu_features.h"
+
+#if HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+// Number of sub-histograms in count_bytes()
+#define NUM_SUB_HISTOGRAMS 4
+
+// count_bytes() counts at most this many bytes into its 32 bit sub-histograms
+// before adding them to the caller's counts
+#define HISTOGRAM_BLOCK_SIZE ((size_t)1 << 30)
+
+// Number of bytes tested at a time by the SIMD scatter kernels
+#define SCATTER_BLOCK_SIZE 64
+
+/*
+ * Count the bytes in [data, end) into NUM_SUB_HISTOGRAMS tables so that runs of
+ *  the same byte don't wait on the increment of the previous byte
+ */
+static void
+count_block(const byte *data, const byte *end, size_t counts[ALPHABET_SIZE]) {
+    uint32_t sub_counts[NUM_SUB_HISTOGRAMS][ALPHABET_SIZE];
+    memset(sub_counts, 0, sizeof(sub_counts));
+
+    const byte *p = data;
+    for (; p + 8 <= end; p += 8) {
+        uint64_t x;
+        memcpy(&x, p, sizeof(x));
+        sub_counts[0][x & 0xff]++;
+        sub_counts[1][(x >> 8) & 0xff]++;
+        sub_counts[2][(x >> 16) & 0xff]++;
+        sub_counts[3][(x >> 24) & 0xff]++;
+        sub_counts[0][(x >> 32) & 0xff]++;
+        sub_counts[1][(x >> 40) & 0xff]++;
+        sub_counts[2][(x >> 48) & 0xff]++;
+        sub_counts[3][x >> 56]++;
+    }
+    for (; p < end; p++) {
+        sub_counts[0][*p]++;
+    }
+
+    for (int b = 0; b < ALPHABET_SIZE; b++) {
+        for (int i = 0; i < NUM_SUB_HISTOGRAMS; i++) {
+            counts[b] += sub_counts[i][b];
+        }
+    }
+}
+
+void
+count_bytes(const byte *data, const byte *end, size_t counts[ALPHABET_SIZE]) {
+    memset(counts, 0, ALPHABET_SIZE * sizeof(counts[0]));
+    for (const byte *p = data; p < end; ) {
+        const byte *block_end = (size_t)(end - p) > HISTOGRAM_BLOCK_SIZE ? p + HISTOGRAM_BLOCK_SIZE : end;
+        count_block(p, block_end, counts);
+        p = block_end;
+    }
+}
+
+/*
+ * Scatter [begin, end) without any branches on the byte values. Disallowed bytes
+ *  write their offsets to a sink and don't advance their pointers
+ */
+template <class Offset>
+static void
+scatter_scalar(const byte *data, const byte *begin, const byte *end, const bool allowed[ALPHABET_SIZE],
+               Offset *offsets_ptr[ALPHABET_SIZE], Offset base) {
+    Offset sink[1];
+    Offset *ptr[ALPHABET_SIZE];
+    size_t step[ALPHABET_SIZE];
+    for (int b = 0; b < ALPHABET_SIZE; b++) {
+        ptr[b] = allowed[b] ? offsets_ptr[b] : sink;
+        step[b] = allowed[b] ? 1 : 0;
+    }
+
+    Offset offset = base + (Offset)(begin - data);
+    for (const byte *p = begin; p < end; p++, offset++) {
+        byte b = *p;
+        Offset *q = ptr[b];
+        *q = offset;
+        ptr[b] = q + step[b];
+    }
+
+    for (int b = 0; b < ALPHABET_SIZE; b++) {
+        if (allowed[b]) {
+            offsets_ptr[b] = ptr[b];
+        }
+    }
+}
+
+#if HAVE_X86_SIMD
+
+inline
+int
+count_trailing_zeros(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+#elif defined(_MSC_VER)
+    unsigned long i;
+    if (_BitScanForward(&i, (unsigned long)x)) {
+        return (int)i;
+    }
+    _BitScanForward(&i, (unsigned long)(x >> 32));
+    return 32 + (int)i;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+/*
+ * Scatter the offsets of the SCATTER_BLOCK_SIZE bytes starting at `p` for which
+ *  the corresponding bits of `mask` are set
+ */
+template <class Offset>
+inline
+void
+scatter_block(const byte *p, Offset offset, uint64_t mask, Offset *offsets_ptr[ALPHABET_SIZE]) {
+    if (mask == ~(uint64_t)0) {
+        for (int j = 0; j < SCATTER_BLOCK_SIZE; j++) {
+            *(offsets_ptr[p[j]]++) = offset + j;
+        }
+    } else {
+        while (mask) {
+            int j = count_trailing_zeros(mask);
+            mask &= mask - 1;
+            *(offsets_ptr[p[j]]++) = offset + j;
+        }
+    }
+}
+
+/*
+ * The allowed bytes as tables for a byte shuffle (pshufb) lookup
+ *
+ * Byte b = 16 * hi + lo is allowed iff
+ *      (_rows_lo[lo] & _bits_lo[hi]) | (_rows_hi[lo] & _bits_hi[hi]) != 0
+ *  _rows_lo[lo] has bit hi set for allowed bytes with hi < 8
+ *  _rows_hi[lo] has bit hi - 8 set for allowed bytes with hi >= 8
+ */
+struct AllowedTables {
+    byte _rows_lo[16];
+    byte _rows_hi[16];
+    byte _bits_lo[16];
+    byte _bits_hi[16];
+
+    AllowedTables(const bool allowed[ALPHABET_SIZE]) {
+        memset(this, 0, sizeof(*this));
+        for (int b = 0; b < ALPHABET_SIZE; b++) {
+            int hi = b >> 4, lo = b & 0xf;
+            if (allowed[b]) {
+                if (hi < 8) {
+                    _rows_lo[lo] |= (byte)(1 << hi);
+                } else {
+                    _rows_hi[lo] |= (byte)(1 << (hi - 8));
+                }
+            }
+        }
+        for (int hi = 0; hi < 16; hi++) {
+            if (hi < 8) {
+                _bits_lo[hi] = (byte)(1 << hi);
+            } else {
+                _bits_hi[hi] = (byte)(1 << (hi - 8));
+            }
+        }
+    }
+};
+
+// Return the 16 bytes at `table` repeated in all four 128 bit lanes
+TARGET_AVX512
+static inline
+__m512i
+broadcast_512(const byte *table) {
+    byte lanes[64];
+    for (int i = 0; i < 64; i += 16) {
+        memcpy(lanes + i, table, 16);
+    }
+    return _mm512_loadu_si512((const void *)lanes);
+}
+
+template <class Offset>
+TARGET_SSSE3
+static void
+scatter_ssse3(const byte *data, const byte *end, const bool allowed[ALPHABET_SIZE],
+              Offset *offsets_ptr[ALPHABET_SIZE], Offset base) {
+    AllowedTables tables(allowed);
+    const __m128i rows_lo = _mm_loadu_si128((const __m128i *)tables._rows_lo);
+    const __m128i rows_hi = _mm_loadu_si128((const __m128i *)tables._rows_hi);
+    const __m128i bits_lo = _mm_loadu_si128((const __m128i *)tables._bits_lo);
+    const __m128i bits_hi = _mm_loadu_si128((const __m128i *)tables._bits_hi);
+    const __m128i nibble = _mm_set1_epi8(0xf);
+    const __m128i zero = _mm_setzero_si128();
+
+    const byte *p = data;
+    for (; p + SCATTER_BLOCK_SIZE <= end; p += SCATTER_BLOCK_SIZE) {
+        uint64_t mask = 0;
+        for (int i = 0; i < SCATTER_BLOCK_SIZE; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            __m128i lo = _mm_and_si128(v, nibble);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+            __m128i x = _mm_or_si128(
+                _mm_and_si128(_mm_shuffle_epi8(rows_lo, lo), _mm_shuffle_epi8(bits_lo, hi)),
+                _mm_and_si128(_mm_shuffle_epi8(rows_hi, lo), _mm_shuffle_epi8(bits_hi, hi)));
+            uint64_t not_allowed = (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero));
+            mask |= (~not_allowed & 0xffff) << i;
+        }
+        if (mask) {
+            scatter_block(p, base + (Offset)(p - data), mask, offsets_ptr);
+        }
+    }
+    scatter_scalar(data, p, end, allowed, offsets_ptr, base);
+}
+
+template <class Offset>
+TARGET_AVX2
+static void
+scatter_avx2(const byte *data, const byte *end, const bool allowed[ALPHABET_SIZE],
+             Offset *offsets_ptr[ALPHABET_SIZE], Offset base) {
+    AllowedTables tables(allowed);
+    const __m256i rows_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tables._rows_lo));
+    const __m256i rows_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tables._rows_hi));
+    const __m256i bits_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tables._bits_lo));
+    const __m256i bits_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)tables._bits_hi));
+    const __m256i nibble = _mm256_set1_epi8(0xf);
+    const __m256i zero = _mm256_setzero_si256();
+
+    const byte *p = data;
+    for (; p + SCATTER_BLOCK_SIZE <= end; p += SCATTER_BLOCK_SIZE) {
+        uint64_t mask = 0;
+        for (int i = 0; i < SCATTER_BLOCK_SIZE; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+            __m256i lo = _mm256_and_si256(v, nibble);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+            __m256i x = _mm256_or_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(rows_lo, lo), _mm256_shuffle_epi8(bits_lo, hi)),
+                _mm256_and_si256(_mm256_shuffle_epi8(rows_hi, lo), _mm256_shuffle_epi8(bits_hi, hi)));
+            uint64_t not_allowed = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero));
+            mask |= (~not_allowed & 0xffffffff) << i;
+        }
+        if (mask) {
+            scatter_block(p, base + (Offset)(p - data), mask, offsets_ptr);
+        }
+    }
+    scatter_scalar(data, p, end, allowed, offsets_ptr, base);
+}
+
+/*
+ * AVX-512 tests a whole block at once and gets the mask straight from a mask register
+ *
+ * Compressing the (byte, offset) pairs of allowed bytes with vpcompressd and then
+ *  scattering them was measured to be slower than looping over the mask bits,
+ *  because the bytes have to be widened to 32 bits first (compressing bytes needs
+ *  AVX-512 VBMI2) and the stores dominate either way.
+ */
+template <class Offset>
+TARGET_AVX512
+static void
+scatter_avx512(const byte *data, const byte *end, const bool allowed[ALPHABET_SIZE],
+               Offset *offsets_ptr[ALPHABET_SIZE], Offset base) {
+    AllowedTables tables(allowed);
+    const __m512i rows_lo = broadcast_512(tables._rows_lo);
+    const __m512i rows_hi = broadcast_512(tables._rows_hi);
+    const __m512i bits_lo = broadcast_512(tables._bits_lo);
+    const __m512i bits_hi = broadcast_512(tables._bits_hi);
+    const __m512i nibble = _mm512_set1_epi8(0xf);
+
+    const byte *p = data;
+    for (; p + SCATTER_BLOCK_SIZE <= end; p += SCATTER_BLOCK_SIZE) {
+        __m512i v = _mm512_loadu_si512((const void *)p);
+        __m512i lo = _mm512_and_si512(v, nibble);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble);
+        __m512i x = _mm512_or_si512(
+            _mm512_and_si512(_mm512_shuffle_epi8(rows_lo, lo), _mm512_shuffle_epi8(bits_lo, hi)),
+            _mm512_and_si512(_mm512_shuffle_epi8(rows_hi, lo), _mm512_shuffle_epi8(bits_hi, hi)));
+        uint64_t mask = _mm512_test_epi8_mask(x, x);
+        if (mask) {
+            scatter_block(p, base + (Offset)(p - data), mask, offsets_ptr);
+        }
+    }
+    scatter_scalar(data, p, end, allowed, offsets_ptr, base);
+}
+
+#endif // #if HAVE_X86_SIMD
+
+template <class Offset>
+static void
+scatter_offsets_t(const byte *data, const byte *end, const bool allowed[ALPHABET_SIZE],
+                  Offset *offsets_ptr[ALPHABET_SIZE], Offset base) {
+    switch (get_cpu_isa()) {
+#if HAVE_X86_SIMD
+    case ISA_AVX512:
+        scatter_avx512(data, end, allowed, offsets_ptr, base);
+        break;
+    case ISA_AVX2:
+        scatter_avx2(data, end, allowed, offsets_ptr, base);
+        break;
+    case ISA_SSSE3:
+        scatter_ssse3(data, end, allowed, offsets_ptr, base);
+        break;
+#endif
+    default:
+        scatter_scalar(data, data, end, allowed, offsets_ptr, base);
+    }
+}
+
+void
+scatter_offsets(const byte *data, const byte *end, const bool allowed[ALPHABET_SIZE],
+                offset_t *offsets_ptr[ALPHABET_SIZE], offset_t base) {
+    scatter_offsets_t(data, end, allowed, offsets_ptr, base);
+}
+
+void
+scatter_offsets(const byte *data, const byte *end, const bool allowed[ALPHABET_SIZE],
+                offset64_t *offsets_ptr[ALPHABET_SIZE], offset64_t base) {
+    scatter_offsets_t(data, end, allowed, offsets_ptr, base);
+}
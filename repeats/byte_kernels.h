@@ -0,0 +1,40 @@
+#ifndef BYTE_KERNELS_H
+#define BYTE_KERNELS_H
+
+#include <stddef.h>
+#include "mytypes.h"
+
+/*
+ * Kernels for the two passes over the bytes of each document that build the
+ *  byte level inverted index
+ *
+ * Both kernels pick the fastest variant for the CPU at runtime. See cpu_features.h
+ */
+
+/*
+ * Count the occurrences of each byte in [data, end)
+ *  Params:
+ *      data, end: bytes to count
+ *      counts: counts[b] is set to the number of occurrences of byte b
+ */
+void count_bytes(const byte *data, const byte *end, size_t counts[ALPHABET_SIZE]);
+
+/*
+ * Write base + the offset (from `data`) of every byte b in [data, end) for which
+ *  allowed[b] is true to offsets_ptr[b] and advance offsets_ptr[b]
+ *  Offsets for each byte are written in increasing order
+ *  Params:
+ *      data, end: bytes to scan
+ *      allowed: allowed[b] is true if offsets of byte b are to be recorded
+ *      offsets_ptr: offsets_ptr[b] points to room for all the offsets of byte b for
+ *                   allowed bytes b. Not used for other bytes
+ *      base: offset of `data` in the document, for documents that are scattered in chunks
+ */
+void scatter_offsets(const byte *data, const byte *end, const bool allowed[ALPHABET_SIZE],
+                     offset_t *offsets_ptr[ALPHABET_SIZE], offset_t base = 0);
+
+// scatter_offsets() for documents with offset64_t offsets
+void scatter_offsets(const byte *data, const byte *end, const bool allowed[ALPHABET_SIZE],
+                     offset64_t *offsets_ptr[ALPHABET_SIZE], offset64_t base = 0);
+
+#endif // #ifndef BYTE_KERNELS_H
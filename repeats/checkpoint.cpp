@@ -0,0 +1,400 @@
+/*
+ * Checkpoints of the merge and gapped engines. See checkpoint.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include "checkpoint.h"
+#include "mapped_file.h"
+#include "packed_offsets.h"
+#include "timer.h"
+#include "inverted_index_int.h"
+
+using namespace std;
+
+bool
+checkpoint_due(const InvertedIndex *inverted_index, double& last_time) {
+    const RepeatsOptions& options = inverted_index->_options;
+    if (options._checkpoint_path.empty()) {
+        return false;
+    }
+    double now = get_elapsed_time();
+    if (now - last_time < options._checkpoint_interval) {
+        return false;
+    }
+    last_time = now;
+    return true;
+}
+
+// Write `n` T's at `data` to `f`
+template <class T>
+static
+void
+write_array(FILE *f, const T *data, size_t n) {
+    if (n > 0) {
+        fwrite(data, sizeof(T), n, f);
+    }
+}
+
+static
+void
+write_u64(FILE *f, uint64_t v) {
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+// Read `n` T's from `f` to `data`. Returns false on a short read
+template <class T>
+static
+bool
+read_array(FILE *f, T *data, size_t n) {
+    return n == 0 || fread(data, sizeof(T), n, f) == n;
+}
+
+static
+bool
+read_u64(FILE *f, uint64_t& v) {
+    return fread(&v, sizeof(v), 1, f) == 1;
+}
+
+/*
+ * Write the _doc_ends, in words, and the words of the `n_docs` documents at `words`
+ */
+template <class Word>
+static
+void
+write_postings_words(FILE *f, const size_t *doc_ends, size_t n_docs, const Word *words) {
+    size_t n_words = n_docs > 0 ? doc_ends[n_docs - 1] : 0;
+    write_u64(f, n_docs);
+    write_u64(f, n_words);
+    for (size_t i = 0; i < n_docs; i++) {
+        write_u64(f, doc_ends[i]);
+    }
+    write_array(f, words, n_words);
+}
+
+/*
+ * Write `postings` to `f` with the offsets of each document packed
+ */
+static
+void
+write_postings(FILE *f, const Postings& postings) {
+    if (postings._packed) {
+        write_postings_words(f, postings._doc_ends, postings._n_docs, postings._offsets);
+        return;
+    }
+
+    vector<size_t> doc_ends(postings._n_docs);
+    size_t total = 0;
+    for (unsigned int i = 0; i < postings._n_docs; i++) {
+        OffsetSpan offsets = postings.doc_offsets(i);
+        total += packed_offsets_size(offsets.data(), offsets.size());
+        doc_ends[i] = total;
+    }
+    vector<offset_t> packed(total);
+    for (unsigned int i = 0; i < postings._n_docs; i++) {
+        OffsetSpan offsets = postings.doc_offsets(i);
+        pack_offsets(offsets.data(), offsets.size(), packed.data() + (i > 0 ? doc_ends[i - 1] : 0));
+    }
+    write_postings_words(f, doc_ends.data(), doc_ends.size(), packed.data());
+}
+
+// 64 bit offsets are not packed
+static
+void
+write_postings(FILE *f, const Postings64& postings) {
+    write_postings_words(f, postings._doc_ends, postings._n_docs, postings._offsets);
+}
+
+/*
+ * Read the _doc_ends and the words written by write_postings_words() into `doc_ends`
+ *  and `words`
+ */
+template <class Word>
+static
+bool
+read_postings_words(FILE *f, size_t expected_n_docs, vector<size_t>& doc_ends, vector<Word>& words) {
+    uint64_t n_docs, n_words;
+    if (!read_u64(f, n_docs) || !read_u64(f, n_words) || n_docs != expected_n_docs) {
+        return false;
+    }
+    doc_ends.resize(n_docs);
+    for (size_t i = 0; i < n_docs; i++) {
+        uint64_t end;
+        if (!read_u64(f, end) || end > n_words || (i > 0 && end < doc_ends[i - 1])) {
+            return false;
+        }
+        doc_ends[i] = (size_t)end;
+    }
+    if (n_docs > 0 && doc_ends[n_docs - 1] != n_words) {
+        return false;
+    }
+    words.resize(n_words);
+    return read_array(f, words.data(), words.size());
+}
+
+/*
+ * Read a Postings written by write_postings() into `postings`, with its arrays in
+ *  `arena`. The offsets are left packed if `pack` is true
+ */
+static
+bool
+read_postings(FILE *f, size_t n_docs, Arena& arena, bool pack, PostingsBuilder& builder, Postings& postings) {
+    vector<size_t> doc_ends;
+    vector<offset_t> words;
+    if (!read_postings_words(f, n_docs, doc_ends, words)) {
+        return false;
+    }
+    if (pack) {
+        postings = Postings(arena.copy_array(words.data(), words.size()),
+                            arena.copy_array(doc_ends.data(), doc_ends.size()),
+                            (unsigned int)n_docs, true);
+        return true;
+    }
+
+    builder.clear();
+    for (size_t i = 0; i < n_docs; i++) {
+        size_t begin = i > 0 ? doc_ends[i - 1] : 0;
+        if (doc_ends[i] == begin) {
+            return false;
+        }
+        unpack_offsets(words.data() + begin, builder.begin_doc((int)i));
+        builder.end_doc();
+    }
+    postings = builder.store(arena);
+    return true;
+}
+
+static
+bool
+read_postings(FILE *f, size_t n_docs, Arena& arena, bool, PostingsBuilder64&, Postings64& postings) {
+    vector<size_t> doc_ends;
+    vector<offset64_t> words;
+    if (!read_postings_words(f, n_docs, doc_ends, words)) {
+        return false;
+    }
+    postings = Postings64(arena.copy_array(words.data(), words.size()),
+                          arena.copy_array(doc_ends.data(), doc_ends.size()),
+                          (unsigned int)n_docs);
+    return true;
+}
+
+template <class Offset>
+static
+bool
+write_checkpoint_t(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                   size_t m, const vector<TermStore *>& term_store_list,
+                   const vector<const vector<PostingsT<Offset>> *>& postings_levels) {
+    const map<int, RequiredRepeats>& docs_map = inverted_index->_docs_map;
+    const string& path = inverted_index->_options._checkpoint_path;
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    header._magic = CHECKPOINT_MAGIC;
+    header._version = CHECKPOINT_VERSION;
+    header._engine = engine;
+    header._offset_size = sizeof(Offset);
+    header._n_bad_allowed = inverted_index->_n_bad_allowed;
+    header._max_term_len = max_term_len;
+    header._m = m;
+    header._n_docs = docs_map.size();
+    header._n_levels = term_store_list.size() - 1;
+
+    string temp_path = path + ".tmp";
+    FILE *f = fopen(temp_path.c_str(), "wb");
+    if (!f) {
+        cerr << "could not create " << temp_path << endl;
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, f);
+    for (map<int, RequiredRepeats>::const_iterator it = docs_map.begin(); it != docs_map.end(); ++it) {
+        CheckpointDoc doc;
+        doc._num = it->second._num;
+        doc._size = it->second._size;
+        doc._mtime = MappedFile::get_mtime(it->second._doc_name);
+        doc._name_len = it->second._doc_name.size();
+        fwrite(&doc, sizeof(doc), 1, f);
+        write_array(f, it->second._doc_name.data(), it->second._doc_name.size());
+    }
+
+    for (size_t len = 1; len < term_store_list.size(); len++) {
+        const TermStore& terms = *term_store_list[len];
+        write_u64(f, terms.size());
+        write_array(f, terms.nodes().data(), terms.size());
+        write_array(f, terms.suffixes().data(), terms.size());
+
+        const vector<PostingsT<Offset>> *postings_list = len < postings_levels.size() ? postings_levels[len] : 0;
+        if (!postings_list || postings_list->size() != terms.size()) {
+            write_u64(f, 0);
+            continue;
+        }
+        write_u64(f, postings_list->size());
+        for (typename vector<PostingsT<Offset>>::const_iterator it = postings_list->begin(); it != postings_list->end(); ++it) {
+            write_postings(f, *it);
+        }
+    }
+
+    bool ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    if (ok && rename(temp_path.c_str(), path.c_str()) != 0) {
+        // Windows won't rename over an existing file
+        remove(path.c_str());
+        ok = rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+    if (!ok) {
+        cerr << "could not write " << path << endl;
+        remove(temp_path.c_str());
+    }
+    return ok;
+}
+
+bool
+write_checkpoint(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                 size_t m, const vector<TermStore *>& term_store_list,
+                 const vector<const vector<Postings> *>& postings_levels) {
+    return write_checkpoint_t(inverted_index, engine, max_term_len, m, term_store_list, postings_levels);
+}
+
+bool
+write_checkpoint(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                 size_t m, const vector<TermStore *>& term_store_list,
+                 const vector<const vector<Postings64> *>& postings_levels) {
+    return write_checkpoint_t(inverted_index, engine, max_term_len, m, term_store_list, postings_levels);
+}
+
+/*
+ * Return why the checkpoint whose header is `header` can't be resumed by `engine` on
+ *  `inverted_index`, or 0 if it can be. Reads the docs table after the header from `f`
+ */
+template <class Offset>
+static
+const char *
+check_checkpoint(FILE *f, const CheckpointHeader& header, const InvertedIndex *inverted_index,
+                 RepeatsEngine engine, size_t max_term_len) {
+    if (header._magic != CHECKPOINT_MAGIC) {
+        return "not a checkpoint";
+    }
+    if (header._version != CHECKPOINT_VERSION) {
+        return "from a different version";
+    }
+    if (header._engine != (uint32_t)engine || header._offset_size != sizeof(Offset)
+        || header._n_bad_allowed != (uint32_t)inverted_index->_n_bad_allowed
+        || header._max_term_len != max_term_len) {
+        return "for a different search";
+    }
+    if (header._m < 1 || header._m > header._n_levels || header._n_levels > max_term_len + 1) {
+        return "corrupt";
+    }
+
+    const map<int, RequiredRepeats>& docs_map = inverted_index->_docs_map;
+    if (header._n_docs != docs_map.size()) {
+        return "for different documents";
+    }
+    string name;
+    for (map<int, RequiredRepeats>::const_iterator it = docs_map.begin(); it != docs_map.end(); ++it) {
+        const RequiredRepeats& rr = it->second;
+        CheckpointDoc doc;
+        if (!read_array(f, &doc, 1)) {
+            return "truncated";
+        }
+        if (doc._num != rr._num || doc._size != rr._size || doc._name_len != rr._doc_name.size()) {
+            return "for different documents";
+        }
+        name.resize(doc._name_len);
+        if (!read_array(f, &name[0], name.size())) {
+            return "truncated";
+        }
+        if (name != rr._doc_name) {
+            return "for different documents";
+        }
+        if (doc._mtime != MappedFile::get_mtime(rr._doc_name)) {
+            return "older than the documents";
+        }
+    }
+    return 0;
+}
+
+template <class Offset>
+static
+bool
+read_checkpoint_t(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                  vector<TermStore *>& term_store_list, vector<vector<PostingsT<Offset>>>& postings_lists,
+                  Arena& arena, offset_t& m) {
+    const string& path = inverted_index->_options._checkpoint_path;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        cerr << "No checkpoint at " << path << ". Starting from the beginning" << endl;
+        return false;
+    }
+
+    CheckpointHeader header;
+    const char *problem = "truncated";
+    if (read_array(f, &header, 1)) {
+        problem = check_checkpoint<Offset>(f, header, inverted_index, engine, max_term_len);
+    }
+
+    // Read everything before changing anything so that a bad file leaves the search as
+    //  it was
+    size_t n_docs = inverted_index->_docs_map.size();
+    bool pack = inverted_index->_options._pack_postings;
+    PostingsBuilderT<Offset> builder;
+    vector<vector<TermNode>> nodes_list(problem ? 0 : header._n_levels + 1);
+    vector<vector<TermId>> suffixes_list(nodes_list.size());
+    vector<vector<PostingsT<Offset>>> saved_postings_lists(nodes_list.size());
+    for (size_t len = 1; len < nodes_list.size() && !problem; len++) {
+        uint64_t n_terms, n_postings;
+        problem = "truncated";
+        if (!read_u64(f, n_terms) || n_terms > (uint64_t)NO_TERM) {
+            break;
+        }
+        nodes_list[len].resize(n_terms);
+        suffixes_list[len].resize(n_terms);
+        if (!read_array(f, nodes_list[len].data(), n_terms) || !read_array(f, suffixes_list[len].data(), n_terms)
+            || !read_u64(f, n_postings) || (n_postings != 0 && n_postings != n_terms)) {
+            break;
+        }
+        saved_postings_lists[len].resize(n_postings);
+        size_t i = 0;
+        while (i < n_postings && read_postings(f, n_docs, arena, pack, builder, saved_postings_lists[len][i])) {
+            i++;
+        }
+        if (i < n_postings) {
+            break;
+        }
+        problem = 0;
+    }
+    fclose(f);
+
+    if (problem) {
+        cerr << "Checkpoint " << path << " is " << problem << ". Starting from the beginning" << endl;
+        return false;
+    }
+
+    for (size_t len = 1; len < nodes_list.size(); len++) {
+        if (len >= term_store_list.size()) {
+            term_store_list.push_back(new TermStore(len, &term_store_list));
+        }
+        term_store_list[len]->restore(nodes_list[len], suffixes_list[len]);
+        if (len >= postings_lists.size()) {
+            postings_lists.resize(len + 1);
+        }
+        postings_lists[len].swap(saved_postings_lists[len]);
+    }
+    m = (offset_t)header._m;
+    return true;
+}
+
+bool
+read_checkpoint(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                vector<TermStore *>& term_store_list, vector<vector<Postings>>& postings_lists,
+                Arena& arena, offset_t& m) {
+    return read_checkpoint_t(inverted_index, engine, max_term_len, term_store_list, postings_lists, arena, m);
+}
+
+bool
+read_checkpoint(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                vector<TermStore *>& term_store_list, vector<vector<Postings64>>& postings_lists,
+                Arena& arena, offset_t& m) {
+    return read_checkpoint_t(inverted_index, engine, max_term_len, term_store_list, postings_lists, arena, m);
+}
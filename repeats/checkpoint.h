@@ -0,0 +1,136 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "postings.h"
+#include "term_store.h"
+#include "inverted_index.h"
+
+/*
+ * Checkpoints of the merge and gapped engines so that a search that is stopped can be
+ *  continued from the last level it completed. See RepeatsOptions::_checkpoint_path
+ *
+ * The state of a search at the start of level m is its TermStores and the Postings of
+ *  the terms that are still to be extended. After a level completes, and at most once
+ *  per RepeatsOptions::_checkpoint_interval seconds, the engine streams that state to a
+ *  checkpoint file. With RepeatsOptions::_resume set, the engine reads the file back and
+ *  starts at level m instead of 1. The results are the same as those of a search that
+ *  was never stopped. The document order of doc_order.h is estimated again.
+ *
+ * A checkpoint file is a sequence of records, read and written in order
+ *      CheckpointHeader
+ *      for each of the _n_docs documents   the _docs_map the search was run on
+ *          CheckpointDoc
+ *          char[_name_len]                 the document's name
+ *      for each term length 1 .. _n_levels
+ *          uint64_t n_terms
+ *          TermNode[n_terms]               TermStore::nodes()
+ *          TermId[n_terms]                 TermStore::suffixes()
+ *          uint64_t n_postings             0 if the terms' Postings are not saved, else n_terms
+ *          for each of the n_postings Postings
+ *              uint64_t n_docs
+ *              uint64_t n_words
+ *              uint64_t[n_docs]            _doc_ends, in words
+ *              Offset[n_words]             offset_t offsets packed by pack_offsets() or
+ *                                          offset64_t offsets, unpacked
+ *
+ * 32 bit offsets are always packed in the file, which makes it 3 to 4 times smaller
+ *  than the Postings of the early levels. They are unpacked when they are read unless
+ *  RepeatsOptions::_pack_postings is set.
+ *
+ * A checkpoint is only resumed by the same engine, with the same _n_bad_allowed and
+ *  max_term_len, on the same documents with the same repeats, sizes and modification
+ *  times, as for index files. See index_file.h. The file is written to a
+ *  temporary file beside it and renamed so a search stopped while writing a checkpoint
+ *  leaves the previous one.
+ *
+ * Expected usage
+ * ---------------
+ *  offset_t m_start = 1;
+ *  if (options._resume) {
+ *      read_checkpoint(inverted_index, engine, max_term_len, term_store_list, postings_lists, arena, m_start);
+ *  }
+ *  double last_checkpoint = get_elapsed_time();
+ *  for (m = m_start; m <= max_term_len; m++) {
+ *      // Make the length m + 1 terms
+ *      if (checkpoint_due(inverted_index, last_checkpoint)) {
+ *          write_checkpoint(inverted_index, engine, max_term_len, m + 1, term_store_list, postings_levels);
+ *      }
+ *  }
+ */
+
+// "RPTCHKPT" as a little endian uint64_t
+#define CHECKPOINT_MAGIC 0x54504b4843545052ULL
+
+// Increment this whenever the layout changes
+#define CHECKPOINT_VERSION 2
+
+struct CheckpointHeader {
+    uint64_t _magic;                // CHECKPOINT_MAGIC
+    uint32_t _version;              // CHECKPOINT_VERSION
+    uint32_t _engine;               // RepeatsEngine
+    uint32_t _offset_size;          // sizeof(Offset) of the Postings: 4 or 8
+    uint32_t _n_bad_allowed;
+    uint64_t _max_term_len;
+    uint64_t _m;                    // Level the search continues at
+    uint64_t _n_docs;
+    uint64_t _n_levels;             // Number of TermStores saved, lengths 1 .. _n_levels
+};
+
+struct CheckpointDoc {
+    uint64_t _num;                  // RequiredRepeats::_num
+    uint64_t _size;                 // RequiredRepeats::_size
+    int64_t _mtime;                 // Modification time when the checkpoint was written. See MappedFile::get_mtime()
+    uint64_t _name_len;             // Length of RequiredRepeats::_doc_name, which follows
+};
+
+struct InvertedIndex;
+
+/*
+ * Return true if it is time to write a checkpoint of the search on `inverted_index`.
+ *  `last_time` is the get_elapsed_time() of the last checkpoint, or of the start of the
+ *  search, and is updated if this returns true
+ */
+bool checkpoint_due(const InvertedIndex *inverted_index, double& last_time);
+
+/*
+ * Write a checkpoint of a search to inverted_index->_options._checkpoint_path
+ *  Params:
+ *      inverted_index: The index being searched
+ *      engine: The engine doing the search
+ *      max_term_len: The engine's max_term_len
+ *      m: Level the search is to continue at
+ *      term_store_list: term_store_list[len] is the TermStore of length len terms
+ *      postings_levels: postings_levels[len] is the Postings of the length len terms, or
+ *          0 if they are not needed from level m on
+ *  Returns: false if the checkpoint can't be written
+ */
+bool write_checkpoint(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                      size_t m, const std::vector<TermStore *>& term_store_list,
+                      const std::vector<const std::vector<Postings> *>& postings_levels);
+bool write_checkpoint(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                      size_t m, const std::vector<TermStore *>& term_store_list,
+                      const std::vector<const std::vector<Postings64> *>& postings_levels);
+
+/*
+ * Read the checkpoint at inverted_index->_options._checkpoint_path written by
+ *  write_checkpoint()
+ *  Params:
+ *      inverted_index, engine, max_term_len: As for write_checkpoint()
+ *      term_store_list: Set to the saved TermStores. Stores are added as needed
+ *      postings_lists: postings_lists[len] is set to the saved Postings of length len terms
+ *      arena: Holds the offsets of the Postings
+ *      m: Set to the level the search continues at
+ *  Returns: false if there is no checkpoint or it is for a different search. Nothing is
+ *           changed then, apart from what is allocated from `arena`
+ */
+bool read_checkpoint(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                     std::vector<TermStore *>& term_store_list, std::vector<std::vector<Postings>>& postings_lists,
+                     Arena& arena, offset_t& m);
+bool read_checkpoint(const InvertedIndex *inverted_index, RepeatsEngine engine, size_t max_term_len,
+                     std::vector<TermStore *>& term_store_list, std::vector<std::vector<Postings64>>& postings_lists,
+                     Arena& arena, offset_t& m);
+
+#endif // #ifndef CHECKPOINT_H
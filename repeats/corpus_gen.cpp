@@ -0,0 +1,695 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include "mytypes.h"
+#include "thread_pool.h"
+#include "corpus_gen.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+using namespace std;
+
+/*
+ * Native port of make_repeats.py and make_repeats_simple.py. See corpus_gen.h
+ *
+ * Each document is a background made by the method, e.g. random letters, that is
+ *  generated in order, and a list of overlays, e.g. the planted REPEATED_STRINGs,
+ *  that overwrite parts of the background. The overlays are made before the
+ *  background is generated so the document can be written in blocks in one pass.
+ */
+
+// REPEATED_STRING is the string the repeated string finders are supposed to find
+static const string REPEATED_STRING = "THE LONG LONG LONG REPEATED STRING THAT KEEPS ON GOING AND GOING AND GOING";
+
+// make_payload() plants NUM_LONGER_STRINGS_1 random strings NUM_LONGER_STRINGS_2 times
+#define NUM_LONGER_STRINGS_1 2
+#define NUM_LONGER_STRINGS_2 3
+
+// The confounding prefixes are CONFOUNDER_LEN copies of each of these
+static const char CONFOUNDERS[] = "abcd";
+#define NUM_CONFOUNDERS 4
+#define CONFOUNDER_LEN 11
+
+// Gap between the unique strings of CORPUS_UNIQUE_JOINED
+#define JOIN_SIZE 5
+
+// Documents are written in blocks of this many bytes
+#define WRITE_BLOCK_SIZE (4 << 20)
+
+// The background is generated in batches of at least this many bytes
+#define BATCH_SIZE 4096
+
+static const struct {
+    CorpusMethod _method;
+    const char *_name;
+} METHOD_NAMES[] = {
+    {CORPUS_SAME, "same"},
+    {CORPUS_RANDOM, "random"},
+    {CORPUS_MAX_REPEATS, "max_repeats"},
+    {CORPUS_ORDERED, "ordered"},
+    {CORPUS_UNORDERED, "unordered"},
+    {CORPUS_UNIQUE, "unique"},
+    {CORPUS_UNIQUE_JOINED, "unique_joined"},
+    {CORPUS_LETTERS, "letters"},
+    {CORPUS_QUADS, "quads"},
+    {CORPUS_TRIPLES, "triples"},
+    {CORPUS_UPPER, "upper"},
+    {CORPUS_NUMBERED, "numbered"},
+    {CORPUS_PAGES, "pages"}
+};
+#define NUM_METHODS ((int)(sizeof(METHOD_NAMES) / sizeof(METHOD_NAMES[0])))
+
+const char *
+get_corpus_method_name(CorpusMethod method) {
+    for (int i = 0; i < NUM_METHODS; i++) {
+        if (METHOD_NAMES[i]._method == method) {
+            return METHOD_NAMES[i]._name;
+        }
+    }
+    return "unknown";
+}
+
+bool
+get_corpus_method_from_name(const string& name, CorpusMethod& method) {
+    for (int i = 0; i < NUM_METHODS; i++) {
+        if (name == METHOD_NAMES[i]._name || name == to_string((int)METHOD_NAMES[i]._method)) {
+            method = METHOD_NAMES[i]._method;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * xorshift64* random number generator. Used instead of <random> so that a seed
+ *  gives the same corpus with every compiler
+ */
+class CorpusRandom {
+    unsigned long long _state;
+
+public:
+    explicit CorpusRandom(unsigned long long seed) {
+        // splitmix64 so that nearby seeds give unrelated streams
+        unsigned long long z = seed + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        _state = (z ^ (z >> 31)) | 1;
+    }
+
+    unsigned long long next() {
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        return _state * 0x2545F4914F6CDD1DULL;
+    }
+
+    // Return a random integer in [lo, hi]. Python's random.randint()
+    int randint(int lo, int hi) {
+        unsigned long long range = (unsigned long long)((long long)hi - (long long)lo + 1);
+        return lo + (int)(((next() >> 32) * range) >> 32);
+    }
+
+    // Write `n` random integers in [lo, hi] to `out`. hi - lo < 64
+    //  Each 32 bit half of a draw gives 3 values. Letters are most of the corpora so this is
+    //  worth doing
+    void fill_randints(byte *out, size_t n, int lo, int hi) {
+        unsigned long long range = (unsigned long long)(hi - lo + 1);
+        size_t i = 0;
+        while (i < n) {
+            unsigned long long x = next();
+            for (int half = 0; half < 2; half++) {
+                unsigned long long v = half ? (x >> 32) : (x & 0xFFFFFFFFULL);
+                for (int j = 0; j < 3 && i < n; j++) {
+                    v *= range;
+                    out[i++] = (byte)(lo + (int)(v >> 32));
+                    v &= 0xFFFFFFFFULL;
+                }
+            }
+        }
+    }
+
+    // Return a random offset in [0, n). Documents can be larger than 4 GB
+    size_t below(size_t n) {
+        return (size_t)((double)(next() >> 11) * (1.0 / 9007199254740992.0) * (double)n);
+    }
+};
+
+// Seed of the random stream of the document with `n_repeats` repeats. The corpus wide
+//  stream is n_repeats = 0
+static
+unsigned long long
+get_doc_seed(unsigned long long seed, int n_repeats) {
+    return seed * 1000003ULL + (unsigned long long)n_repeats;
+}
+
+static
+string
+make_random_string(CorpusRandom& rng, size_t size) {
+    string s(size, ' ');
+    for (size_t i = 0; i < size; i++) {
+        s[i] = (char)rng.randint('a', 'z');
+    }
+    return s;
+}
+
+// Size of the unique strings of CORPUS_UNIQUE and CORPUS_UNIQUE_JOINED
+static
+size_t
+get_unique_size(CorpusMethod method) {
+    return REPEATED_STRING.size() / 4 - (method == CORPUS_UNIQUE_JOINED ? JOIN_SIZE : 0);
+}
+
+/*
+ * Random data shared by all the documents of a corpus
+ */
+struct CorpusData {
+    vector<string> _base_strings;           // Strings planted NUM_LONGER_STRINGS_2 times with
+                                            //  each REPEATED_STRING
+    vector<vector<byte> > _random_lists;    // The unique strings of CORPUS_UNIQUE and
+                                            //  CORPUS_UNIQUE_JOINED
+};
+
+static
+CorpusData
+make_corpus_data(const CorpusOptions& options) {
+    CorpusRandom rng(get_doc_seed(options._seed, 0));
+    CorpusData data;
+    for (int i = 0; i < NUM_LONGER_STRINGS_1; i++) {
+        data._base_strings.push_back(make_random_string(rng, REPEATED_STRING.size() + 5));
+    }
+    if (options._method == CORPUS_UNIQUE || options._method == CORPUS_UNIQUE_JOINED) {
+        size_t unique_size = get_unique_size(options._method);
+        data._random_lists.resize(options._n_unique);
+        for (int i = 0; i < options._n_unique; i++) {
+            vector<byte>& lst = data._random_lists[i];
+            lst.resize(unique_size);
+            for (size_t j = 0; j < unique_size; j++) {
+                lst[j] = (byte)rng.randint(0, 255);
+            }
+        }
+    }
+    return data;
+}
+
+/*
+ * A document of a corpus
+ */
+struct DocSpec {
+    int _n_repeats;
+    string _path;
+    int _prefix_index;      // Confounding prefix of the first payload of the document
+    int _page_count;        // Number of the first page marker of the document
+
+    DocSpec(int n_repeats, const string& path, int prefix_index, int page_count) :
+        _n_repeats(n_repeats), _path(path), _prefix_index(prefix_index), _page_count(page_count) {}
+};
+
+/*
+ * Return the number of bytes in the document with `n_repeats` repeats. Methods that
+ *  generate records of several bytes only write whole records
+ */
+static
+size_t
+get_doc_length(const CorpusOptions& options, int n_repeats) {
+    size_t size = options._doc_size;
+    switch (options._method) {
+    case CORPUS_MAX_REPEATS:
+        return (size / n_repeats / 4) * n_repeats * 4;
+    case CORPUS_ORDERED:
+    case CORPUS_UNORDERED:
+    case CORPUS_QUADS:
+        return (size / 4) * 4;
+    case CORPUS_UNIQUE:
+    case CORPUS_UNIQUE_JOINED:
+        return (size / (REPEATED_STRING.size() / 4)) * (REPEATED_STRING.size() / 4);
+    case CORPUS_TRIPLES:
+        return (size / 3) * 3;
+    case CORPUS_NUMBERED:
+        return ((size + 7) / 8) * 9;
+    default:
+        return size;
+    }
+}
+
+/*
+ * Text that overwrites the background of a document at offset _pos
+ */
+struct Overlay {
+    size_t _pos;
+    string _text;
+    size_t _order;      // Overlays are applied in increasing _order so later ones win
+
+    Overlay(size_t pos, const string& text, size_t order) : _pos(pos), _text(text), _order(order) {}
+};
+
+// Add an overlay of `text` at `pos` clipped to a document of `length` bytes
+static
+void
+add_overlay(vector<Overlay>& overlays, size_t pos, const string& text, size_t length) {
+    if (pos < length && !text.empty()) {
+        overlays.push_back(Overlay(pos, text.substr(0, length - pos), overlays.size()));
+    }
+}
+
+// The payload that make_payload() in make_repeats.py inserts once per repeat
+static
+string
+make_payload(const CorpusData& data, int prefix_index, CorpusRandom& rng) {
+    string payload(CONFOUNDER_LEN, CONFOUNDERS[prefix_index % NUM_CONFOUNDERS]);
+    payload += REPEATED_STRING;
+
+    // Some strings that will be repeated too many times
+    for (int i = 0; i < NUM_LONGER_STRINGS_1 * NUM_LONGER_STRINGS_2; i++) {
+        string unique = to_string(rng.randint(0, 1000000));
+        payload += string(unique.size() < 6 ? 6 - unique.size() : 0, '0') + unique;
+        payload += data._base_strings[i % NUM_LONGER_STRINGS_1];
+    }
+
+    // Separate the payload from the background
+    payload += make_random_string(rng, 5);
+    return payload;
+}
+
+/*
+ * Return the overlays of document `spec` of `length` bytes
+ */
+static
+vector<Overlay>
+make_overlays(const CorpusOptions& options, const CorpusData& data, const DocSpec& spec, size_t length,
+              CorpusRandom& rng) {
+    vector<Overlay> overlays;
+    int n_repeats = spec._n_repeats;
+
+    if (options._method == CORPUS_PAGES) {
+        // n_repeats pages, each with a numbered REPEATED_STRING in the middle and ending in \n
+        size_t size = options._doc_size;
+        size_t start = 0;
+        int count = spec._page_count;
+        for (int n = n_repeats; n > 0; n--) {
+            size_t page_size = size / n;
+            string pattern = "^" + to_string(count) + REPEATED_STRING + to_string(count + 1) + "$";
+            count += 2;
+            add_overlay(overlays, start + (page_size - pattern.size()) / 2, pattern, length);
+            add_overlay(overlays, start + page_size - 1, "\n", length);
+            size -= page_size;
+            start += page_size;
+        }
+        return overlays;
+    }
+
+    if (options._method == CORPUS_NUMBERED) {
+        int n_repeats2 = n_repeats + 2;
+        size_t repeat_size2 = options._doc_size / n_repeats2;
+        for (int i = 0; i < n_repeats2; i++) {
+            add_overlay(overlays, (size_t)((i + 0.5) * repeat_size2), "abcdefghijklmnopqrstuvwxyz", length);
+        }
+    }
+
+    if (options._confound && length > CONFOUNDER_LEN + 1) {
+        for (int i = 0; i < n_repeats * 10; i++) {
+            for (int j = 0; j < NUM_CONFOUNDERS; j++) {
+                size_t pos = rng.below(length - CONFOUNDER_LEN);
+                add_overlay(overlays, pos, string(CONFOUNDER_LEN, CONFOUNDERS[j]), length);
+            }
+        }
+    }
+
+    add_overlay(overlays, 0, options._heading, length);
+
+    if (options._plant) {
+        size_t repeat_size = options._doc_size / n_repeats;
+        for (int i = 0; i < n_repeats; i++) {
+            string payload = make_payload(data, spec._prefix_index + i, rng);
+            size_t offset = repeat_size > payload.size() ? (repeat_size - payload.size()) / 2 : 0;
+            add_overlay(overlays, i * repeat_size + offset, payload, length);
+        }
+    }
+    return overlays;
+}
+
+/*
+ * Generates the background of a document in order
+ */
+class Background {
+    CorpusMethod _method;
+    int _n_repeats;
+    int _n_unique;
+    const CorpusData& _data;
+    CorpusRandom& _rng;
+    size_t _n_records;          // Number of records generated so far
+    vector<byte> _batch;        // Bytes generated but not yet returned by fill()
+    size_t _batch_pos;          // Offset of first byte of _batch not yet returned
+
+    void append_randints(size_t n, int lo, int hi) {
+        size_t size = _batch.size();
+        _batch.resize(size + n);
+        if (hi - lo < 64) {
+            _rng.fill_randints(_batch.data() + size, n, lo, hi);
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                _batch[size + i] = (byte)_rng.randint(lo, hi);
+            }
+        }
+    }
+
+    // % 0xff, not & 0xff, as in make_repeats.py
+    void append_int(unsigned int r) {
+        _batch.push_back((byte)((r / 0x1000000) % 0xff));
+        _batch.push_back((byte)((r / 0x10000) % 0xff));
+        _batch.push_back((byte)((r / 0x100) % 0xff));
+        _batch.push_back((byte)(r % 0xff));
+    }
+
+    void make_batch();
+
+public:
+    Background(CorpusMethod method, int n_repeats, int n_unique, const CorpusData& data, CorpusRandom& rng) :
+        _method(method), _n_repeats(n_repeats), _n_unique(n_unique), _data(data), _rng(rng),
+        _n_records(0), _batch_pos(0) {
+        _batch.reserve(2 * BATCH_SIZE);
+    }
+
+    // Write the next `n` bytes of the background to `buf`
+    void fill(byte *buf, size_t n);
+};
+
+void
+Background::make_batch() {
+    _batch.clear();
+    _batch_pos = 0;
+
+    switch (_method) {
+    case CORPUS_SAME:
+        _batch.assign(BATCH_SIZE, (byte)' ');
+        break;
+
+    case CORPUS_RANDOM:
+        for (size_t i = 0; i < BATCH_SIZE; i += 8) {
+            unsigned long long x = _rng.next();
+            for (int j = 0; j < 8; j++) {
+                _batch.push_back((byte)(x >> (8 * j)));
+            }
+        }
+        break;
+
+    case CORPUS_MAX_REPEATS:
+        // Many repeats of 2 and 3 byte strings too
+        for (; _batch.size() < BATCH_SIZE; _n_records++) {
+            append_int((unsigned int)(_n_records / _n_repeats));
+        }
+        break;
+
+    case CORPUS_ORDERED:
+        for (; _batch.size() < BATCH_SIZE; _n_records++) {
+            append_int((unsigned int)(_n_records % _n_unique));
+        }
+        break;
+
+    case CORPUS_UNORDERED:
+        while (_batch.size() < BATCH_SIZE) {
+            append_int((unsigned int)_rng.randint(1, _n_unique));
+        }
+        break;
+
+    case CORPUS_UNIQUE:
+    case CORPUS_UNIQUE_JOINED:
+        while (_batch.size() < BATCH_SIZE) {
+            const vector<byte>& lst = _data._random_lists[_rng.randint(0, _n_unique - 1)];
+            _batch.insert(_batch.end(), lst.begin(), lst.end());
+            if (_method == CORPUS_UNIQUE_JOINED) {
+                append_randints(JOIN_SIZE, '0', '9');
+            }
+        }
+        break;
+
+    case CORPUS_LETTERS:
+    case CORPUS_PAGES:
+        append_randints(BATCH_SIZE, 'a', 'z');
+        break;
+
+    case CORPUS_QUADS:
+    case CORPUS_TRIPLES:
+        while (_batch.size() < BATCH_SIZE) {
+            append_randints(1, 'a', 'z');
+            append_randints(1, 'A', 'Z');
+            append_randints(1, '0', '9');
+            if (_method == CORPUS_QUADS) {
+                append_randints(1, 0, 255);
+            }
+        }
+        break;
+
+    case CORPUS_UPPER:
+        append_randints(BATCH_SIZE, 'A', 'Z');
+        break;
+
+    case CORPUS_NUMBERED:
+        for (; _batch.size() < BATCH_SIZE; _n_records++) {
+            size_t i = _n_records;
+            byte digits[8];
+            for (int j = 7; j >= 0; j--) {
+                digits[j] = (byte)('0' + i % 10);
+                i /= 10;
+            }
+            _batch.insert(_batch.end(), digits, digits + 8);
+            _batch.push_back((byte)'_');
+        }
+        break;
+    }
+}
+
+void
+Background::fill(byte *buf, size_t n) {
+    while (n > 0) {
+        if (_batch_pos == _batch.size()) {
+            make_batch();
+        }
+        size_t n_copy = min(n, _batch.size() - _batch_pos);
+        copy(_batch.begin() + _batch_pos, _batch.begin() + _batch_pos + n_copy, buf);
+        _batch_pos += n_copy;
+        buf += n_copy;
+        n -= n_copy;
+    }
+}
+
+static
+bool
+comp_overlay_pos(const Overlay& a, const Overlay& b) {
+    return a._pos < b._pos;
+}
+
+static
+bool
+comp_overlay_order(const Overlay *a, const Overlay *b) {
+    return a->_order < b->_order;
+}
+
+/*
+ * Write the overlays that intersect [pos, pos + n) to block
+ *  overlays: All overlays of the document, sorted by _pos
+ *  max_len: Length of the longest overlay
+ */
+static
+void
+apply_overlays(const vector<Overlay>& overlays, size_t max_len, size_t pos, byte *block, size_t n) {
+    Overlay key(pos > max_len ? pos - max_len : 0, "", 0);
+    vector<Overlay>::const_iterator it = lower_bound(overlays.begin(), overlays.end(), key, comp_overlay_pos);
+
+    vector<const Overlay *> hits;
+    for (; it != overlays.end() && it->_pos < pos + n; ++it) {
+        if (it->_pos + it->_text.size() > pos) {
+            hits.push_back(&*it);
+        }
+    }
+    sort(hits.begin(), hits.end(), comp_overlay_order);
+
+    for (vector<const Overlay *>::const_iterator ih = hits.begin(); ih != hits.end(); ++ih) {
+        const Overlay *overlay = *ih;
+        size_t begin = max(overlay->_pos, pos);
+        size_t end = min(overlay->_pos + overlay->_text.size(), pos + n);
+        copy(overlay->_text.begin() + (begin - overlay->_pos), overlay->_text.begin() + (end - overlay->_pos),
+             block + (begin - pos));
+    }
+}
+
+/*
+ * Generate document `spec` and write it to spec._path
+ *  Returns: number of bytes written or -1 on error
+ */
+static
+long long
+write_document(const CorpusOptions& options, const CorpusData& data, const DocSpec& spec) {
+    CorpusRandom rng(get_doc_seed(options._seed, spec._n_repeats));
+    size_t length = get_doc_length(options, spec._n_repeats);
+
+    vector<Overlay> overlays = make_overlays(options, data, spec, length, rng);
+    stable_sort(overlays.begin(), overlays.end(), comp_overlay_pos);
+    size_t max_len = 0;
+    for (vector<Overlay>::const_iterator it = overlays.begin(); it != overlays.end(); ++it) {
+        max_len = max(max_len, it->_text.size());
+    }
+
+    FILE *f = fopen(spec._path.c_str(), "wb");
+    if (!f) {
+        return -1;
+    }
+
+    Background background(options._method, spec._n_repeats, options._n_unique, data, rng);
+    vector<byte> block(min((size_t)WRITE_BLOCK_SIZE, max(length, (size_t)1)));
+    bool ok = true;
+    for (size_t pos = 0; pos < length && ok; ) {
+        size_t n = min(block.size(), length - pos);
+        background.fill(block.data(), n);
+        apply_overlays(overlays, max_len, pos, block.data(), n);
+        ok = fwrite(block.data(), 1, n, f) == n;
+        pos += n;
+    }
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    return ok ? (long long)length : -1;
+}
+
+/*
+ * Create `directory` and its parents if they don't exist
+ */
+static
+bool
+make_directory(const string& directory) {
+    for (size_t i = 1; i <= directory.size(); i++) {
+        if (i < directory.size() && directory[i] != '/' && directory[i] != '\\') {
+            continue;
+        }
+        string dir = directory.substr(0, i);
+#ifdef _WIN32
+        int ret = _mkdir(dir.c_str());
+#else
+        int ret = mkdir(dir.c_str(), 0777);
+#endif
+        if (ret != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static
+string
+get_absolute_path(const string& path) {
+#ifdef _WIN32
+    char buf[_MAX_PATH];
+    if (_fullpath(buf, path.c_str(), _MAX_PATH)) {
+        return string(buf);
+    }
+#else
+    char *abs_path = realpath(path.c_str(), 0);
+    if (abs_path) {
+        string result(abs_path);
+        free(abs_path);
+        return result;
+    }
+#endif
+    return path;
+}
+
+bool
+make_corpus(const CorpusOptions& options, const string& directory, string& path_list_path) {
+    int max_repeats = options._min_repeats + options._n_docs - 1;
+    if (options._min_repeats < 1 || options._n_docs < 1 || options._n_unique < 1) {
+        cerr << "make_corpus: min_repeats, n_docs and n_unique must be positive" << endl;
+        return false;
+    }
+    // Room for "^<count>REPEATED_STRING<count + 1>$\n" on the smallest page
+    if (options._method == CORPUS_PAGES && options._doc_size / max_repeats < REPEATED_STRING.size() + 24) {
+        cerr << "make_corpus: documents of " << options._doc_size << " bytes are too small for "
+             << max_repeats << " pages" << endl;
+        return false;
+    }
+    if (!make_directory(directory)) {
+        cerr << "make_corpus: could not create directory '" << directory << "'" << endl;
+        return false;
+    }
+    string abs_directory = get_absolute_path(directory);
+
+#if VERBOSITY >= 1
+    ios::fmtflags flags = cout.flags();
+    streamsize precision = cout.precision();
+    cout << "# method = " << get_corpus_method_name(options._method) << endl;
+    cout << "# size = " << fixed << setprecision(3) << options._doc_size / (1024.0 * 1024.0) << " Mbyte" << endl;
+    cout.flags(flags);
+    cout.precision(precision);
+    cout << "# min_repeats = " << options._min_repeats << endl;
+    cout << "# n_documents = " << options._n_docs << endl;
+    cout << "# num_unique = " << options._n_unique << endl;
+    cout << "# seed = " << options._seed << endl;
+    cout << "# directory = \"" << abs_directory << "\"" << endl;
+    cout << "# REPEATED_STRING = \"" << REPEATED_STRING << "\", len=" << REPEATED_STRING.size() << endl;
+    cout << "# " << string(80, '-') << endl;
+#endif
+
+    // make_repeats.py and make_repeats_simple.py number the payloads and pages across
+    //  the whole corpus, so work out where each document starts
+    vector<DocSpec> specs;
+    int prefix_index = 0;
+    int page_count = 0;
+    for (int n_repeats = options._min_repeats; n_repeats <= max_repeats; n_repeats++) {
+        string path = abs_directory + "/pages=" + to_string(n_repeats) + ".txt";
+        specs.push_back(DocSpec(n_repeats, path, prefix_index, page_count));
+        prefix_index += n_repeats;
+        page_count += 2 * n_repeats;
+    }
+
+    CorpusData data = make_corpus_data(options);
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    vector<long long> n_written(specs.size());
+    ThreadPool pool(min(get_num_threads(options._n_threads), (int)specs.size()));
+    pool.parallel_for(specs.size(), [&](size_t i, int) {
+        n_written[i] = write_document(options, data, specs[i]);
+    }, 1);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    bool ok = true;
+    long long total = 0;
+    for (size_t i = 0; i < specs.size(); i++) {
+        if (n_written[i] < 0) {
+            cerr << "make_corpus: could not write '" << specs[i]._path << "'" << endl;
+            ok = false;
+            continue;
+        }
+        total += n_written[i];
+#if VERBOSITY >= 1
+        cout << specs[i]._path << "  # " << setw(2) << specs[i]._n_repeats << " repeats" << endl;
+#endif
+    }
+    if (!ok) {
+        return false;
+    }
+
+    path_list_path = abs_directory + "/files.list";
+    ofstream f(path_list_path.c_str());
+    for (vector<DocSpec>::const_iterator it = specs.begin(); it != specs.end(); ++it) {
+        f << it->_path << endl;
+    }
+    if (!f) {
+        cerr << "make_corpus: could not write '" << path_list_path << "'" << endl;
+        return false;
+    }
+
+#if VERBOSITY >= 1
+    cout << "Files list: \"" << path_list_path << "\"" << endl;
+    cout << "Wrote " << total << " bytes in " << seconds << " sec = "
+         << (seconds > 0.0 ? total / (1024.0 * 1024.0) / seconds : 0.0) << " MB/sec" << endl;
+#endif
+    return true;
+}
@@ -0,0 +1,96 @@
+#ifndef CORPUS_GEN_H
+#define CORPUS_GEN_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Synthetic test corpus generator. A native port of make_repeats.py and
+ *  make_repeats_simple.py for making benchmark corpora of many GB quickly
+ *  and reproducibly
+ *
+ * A corpus is `n_docs` documents with min_repeats, min_repeats + 1, ...
+ *  repeats. The document with n repeats is written to directory/pages=n.txt
+ *  which is the naming get_required_repeats() expects, and the paths of all the
+ *  documents are written to directory/files.list.
+ *
+ * The same options and seed give byte-identical corpora on all platforms and
+ *  for any number of threads: each document is made from its own random
+ *  stream and the random numbers don't come from <random>, whose
+ *  distributions differ between standard libraries.
+ *
+ * Documents are generated and written in blocks, so corpora much larger than
+ *  memory can be made.
+ */
+
+/*
+ * The ways of making documents. The numbers are the make_repeats.py methods
+ */
+enum CorpusMethod {
+    CORPUS_SAME = 0,            // All bytes the same. Worst case for some string finding algos
+    CORPUS_RANDOM = 1,          // Random bytes of all values. Worst case for others
+    CORPUS_MAX_REPEATS = 2,     // Maximize number of strings repeated n times
+    CORPUS_ORDERED = 3,         // n_unique 4 byte strings in order
+    CORPUS_UNORDERED = 4,       // n_unique 4 byte strings in random order
+    CORPUS_UNIQUE = 5,          // n_unique random 18 byte strings in random order
+    CORPUS_UNIQUE_JOINED = 6,   // Like 5 but 13 byte strings joined by 5 random digits, so
+                                //  adjoining strings don't make new repeated strings
+    CORPUS_LETTERS = 11,        // Random lower-case letters
+    CORPUS_QUADS = 12,          // All variants of [a-z][A-Z]\d.
+    CORPUS_TRIPLES = 13,        // All variants of [a-z][A-Z]\d
+    CORPUS_UPPER = 14,          // Random upper-case letters
+    CORPUS_NUMBERED = 15,       // 8 digit numbers separated by _ with a-z planted n + 2 times
+    CORPUS_PAGES = 100          // make_repeats_simple.py: n pages of random letters each with a
+                                //  REPEATED_STRING marked by a page number
+};
+
+/*
+ * Options for make_corpus(). The defaults are those of make_repeats.py and
+ *  make_repeats_simple.py
+ */
+struct CorpusOptions {
+    CorpusMethod _method;
+    size_t _doc_size;           // Size of each document in bytes (some methods round it down)
+    int _min_repeats;           // Number of repeats in the first document
+    int _n_docs;                // Number of documents
+    int _n_unique;              // Number of unique strings for methods 3-6
+    unsigned long long _seed;   // Seed of the random streams
+    bool _plant;                // Plant REPEATED_STRING with a confounding prefix once per repeat
+                                //  (make_payload() in make_repeats.py). Always done for CORPUS_PAGES
+    bool _confound;             // Scatter the confounding prefixes 10 times per repeat
+    int _n_threads;             // Number of documents to generate in parallel. <= 0 => one per CPU
+    std::string _heading;       // Text written at the start of each document except for CORPUS_PAGES
+
+    CorpusOptions() :
+        _method(CORPUS_PAGES),
+        _doc_size(1024 * 1024),
+        _min_repeats(11),
+        _n_docs(5),
+        _n_unique(100000),
+        _seed(111),
+        _plant(false),
+        _confound(false),
+        _n_threads(0)
+    {}
+};
+
+/*
+ * Write the documents of the corpus described by `options` to `directory`,
+ *  which is created if it doesn't exist, and write the list of their paths to
+ *  directory/files.list
+ *  Params:
+ *      options: What to make
+ *      directory: Where to write it
+ *      path_list_path: Set to path of the files.list
+ *  Returns: true on success. Errors are written to cerr
+ */
+bool make_corpus(const CorpusOptions& options, const std::string& directory, std::string& path_list_path);
+
+// Return name of `method` e.g. "pages"
+const char *get_corpus_method_name(CorpusMethod method);
+
+// Set `method` to the method named `name`, which may be a name or a make_repeats.py method number.
+//  Returns false if there is no such method
+bool get_corpus_method_from_name(const std::string& name, CorpusMethod& method);
+
+#endif // #ifndef CORPUS_GEN_H
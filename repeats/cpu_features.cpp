@@ -0,0 +1,120 @@
+/*
+ * Runtime detection of SIMD instruction sets
+ */
+
+#include "cpu_features.h"
+
+#if HAVE_X86_SIMD && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static const char *ISA_NAMES[NUM_ISAS] = {
+    "scalar",
+    "ssse3",
+    "avx2",
+    "avx512"
+};
+
+#if HAVE_X86_SIMD && defined(_MSC_VER)
+
+/*
+ * MSVC has no __builtin_cpu_supports() so read the CPUID bits directly. The AVX
+ *  levels also need the OS to save the wide registers on context switches,
+ *  which XGETBV reports
+ */
+static CpuIsa
+detect_cpu_isa() {
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool ssse3 = (info[2] & (1 << 9)) != 0;
+    bool popcnt = (info[2] & (1 << 23)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!ssse3) {
+        return ISA_SCALAR;
+    }
+    if (!osxsave || !avx || max_leaf < 7) {
+        return ISA_SSSE3;
+    }
+
+    unsigned long long xcr0 = _xgetbv(0);
+    bool os_avx = (xcr0 & 0x6) == 0x6;         // XMM and YMM state
+    bool os_avx512 = (xcr0 & 0xe6) == 0xe6;    // and opmask, ZMM state
+    if (!os_avx) {
+        return ISA_SSSE3;
+    }
+
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    bool bmi = (info[1] & (1 << 3)) != 0;
+    bool avx512f = (info[1] & (1 << 16)) != 0;
+    bool avx512bw = (info[1] & (1 << 30)) != 0;
+    if (!avx2 || !bmi || !popcnt) {
+        return ISA_SSSE3;
+    }
+    if (!os_avx512 || !avx512f || !avx512bw) {
+        return ISA_AVX2;
+    }
+    return ISA_AVX512;
+}
+
+#elif HAVE_X86_SIMD && defined(__GNUC__)
+
+static CpuIsa
+detect_cpu_isa() {
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("ssse3")) {
+        return ISA_SCALAR;
+    }
+    if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("bmi") ||
+        !__builtin_cpu_supports("popcnt")) {
+        return ISA_SSSE3;
+    }
+    if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512bw")) {
+        return ISA_AVX2;
+    }
+    return ISA_AVX512;
+}
+
+#else
+
+static CpuIsa
+detect_cpu_isa() {
+    return ISA_SCALAR;
+}
+
+#endif
+
+static CpuIsa _max_isa = NUM_ISAS;
+
+CpuIsa
+get_cpu_isa() {
+    static const CpuIsa cpu_isa = detect_cpu_isa();
+    return cpu_isa < _max_isa ? cpu_isa : _max_isa;
+}
+
+void
+set_max_isa(CpuIsa isa) {
+    _max_isa = isa;
+}
+
+const char *
+get_isa_name(CpuIsa isa) {
+    return (0 <= isa && isa < NUM_ISAS) ? ISA_NAMES[isa] : "unknown";
+}
+
+bool
+get_isa_from_name(const string& name, CpuIsa& isa) {
+    for (int i = 0; i < NUM_ISAS; i++) {
+        if (name == ISA_NAMES[i]) {
+            isa = (CpuIsa)i;
+            return true;
+        }
+    }
+    return false;
+}
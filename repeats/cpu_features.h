@@ -0,0 +1,58 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include <string>
+
+/*
+ * Runtime detection of the SIMD instruction sets that the hot kernels can use
+ *
+ * Each kernel is compiled once per instruction set it supports, with the
+ *  TARGET_xxx attributes below, and the best variant for the CPU the program is
+ *  running on is picked at runtime. This lets one binary run at full speed on
+ *  older and newer hosts.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HAVE_X86_SIMD 1
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+// GCC and clang only allow intrinsics for instruction sets that are enabled for
+// the function using them. MSVC allows all intrinsics everywhere
+#if HAVE_X86_SIMD && defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2,bmi,popcnt")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx2,bmi,popcnt")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+/*
+ * Instruction set levels in increasing order of capability
+ *  ISA_SSSE3 is the first level with a byte shuffle (pshufb) which the byte
+ *  kernels need, so plain SSE2 machines use the scalar kernels
+ */
+enum CpuIsa {
+    ISA_SCALAR = 0,
+    ISA_SSSE3,
+    ISA_AVX2,
+    ISA_AVX512,     // AVX-512 F + BW
+    NUM_ISAS
+};
+
+// Return the best instruction set supported by this CPU, capped by set_max_isa()
+CpuIsa get_cpu_isa();
+
+// Don't use instruction sets above `isa`. For benchmarking and testing the kernels
+void set_max_isa(CpuIsa isa);
+
+// Return name of `isa` e.g. "avx2"
+const char *get_isa_name(CpuIsa isa);
+
+// Return the CpuIsa called `name`. Returns false if there is no such instruction set
+bool get_isa_from_name(const std::string& name, CpuIsa& isa);
+
+#endif // #ifndef CPU_FEATURES_H
@@ -0,0 +1,114 @@
+/*
+ * Adaptive document order of the merge and gapped engines. See doc_order.h
+ */
+
+#include <sstream>
+#include <iomanip>
+#include "doc_order.h"
+#include "intersect.h"
+#include "inverted_index_int.h"
+
+using namespace std;
+
+// Number of s + b byte pairs merged by estimate_doc_order()
+#define SAMPLE_PAIRS 16
+
+// Number of offsets of s merged in each document by estimate_doc_order()
+#define SAMPLE_OFFSETS 4096
+
+// Weight of the counts of earlier levels relative to the latest level. See DocOrder::reorder()
+#define HISTORY_WEIGHT 0.5
+
+DocOrder::DocOrder(const map<int, RequiredRepeats>& docs_map) {
+    for (map<int, RequiredRepeats>::const_iterator it = docs_map.begin(); it != docs_map.end(); ++it) {
+        _order.push_back(_docs.size());
+        _docs.push_back(it);
+    }
+    _n_checked.resize(_docs.size());
+    _n_failed.resize(_docs.size());
+}
+
+void
+DocOrder::add_stats(DocStats& stats) {
+    for (size_t i = 0; i < stats._n_checked.size(); i++) {
+        _n_checked[i] += (double)stats._n_checked[i];
+        _n_failed[i] += (double)stats._n_failed[i];
+    }
+    stats.clear();
+}
+
+void
+DocOrder::reorder() {
+    // Rates are smoothed so that documents that have rarely been checked are not
+    //  ordered on a few checks. Ties keep the _docs_map order
+    vector<double> rates(_docs.size());
+    for (size_t i = 0; i < _docs.size(); i++) {
+        rates[i] = (_n_failed[i] + 1.0) / (_n_checked[i] + 2.0);
+    }
+    stable_sort(_order.begin(), _order.end(), [&rates](size_t i, size_t j) {
+        return rates[i] > rates[j];
+    });
+
+    for (size_t i = 0; i < _docs.size(); i++) {
+        _n_checked[i] *= HISTORY_WEIGHT;
+        _n_failed[i] *= HISTORY_WEIGHT;
+    }
+}
+
+string
+DocOrder::describe() const {
+    ostringstream s;
+    for (size_t k = 0; k < _order.size(); k++) {
+        size_t i = _order[k];
+        s << (k > 0 ? " " : "") << _docs[i]->first << ":" << fixed << setprecision(2)
+          << (_n_failed[i] + 1.0) / (_n_checked[i] + 2.0);
+    }
+    return s.str();
+}
+
+template <class Offset>
+static
+void
+estimate_doc_order_t(const InvertedIndex *inverted_index, DocOrder& doc_order) {
+    const map<byte, PostingsT<Offset>>& byte_postings_map = get_byte_postings_map<Offset>(inverted_index);
+    const vector<byte> bytes = get_keys_vector(byte_postings_map);
+    if (bytes.empty()) {
+        return;
+    }
+
+    DocStats stats;
+    stats.resize(doc_order.size());
+    vector<Offset> sb_offsets;
+
+    // The pairs are spread over the valid bytes by stepping through them at two rates
+    for (size_t k = 0; k < SAMPLE_PAIRS; k++) {
+        const PostingsT<Offset>& s_postings = byte_postings_map.at(bytes[k % bytes.size()]);
+        const PostingsT<Offset>& b_postings = byte_postings_map.at(bytes[(k * 7 + 3) % bytes.size()]);
+
+        for (size_t i = 0; i < doc_order.size(); i++) {
+            int doc_index = doc_order.docs()[i]->first;
+            unsigned int num = doc_order.docs()[i]->second._num;
+            OffsetSpanT<Offset> s_offsets = s_postings.doc_offsets(doc_index);
+            OffsetSpanT<Offset> b_offsets = b_postings.doc_offsets(doc_index);
+            size_t n_s = min(s_offsets.size(), (size_t)SAMPLE_OFFSETS);
+
+            sb_offsets.clear();
+            size_t count = intersect_offsets_count(s_offsets.data(), n_s, (Offset)1,
+                                                   b_offsets.data(), b_offsets.size(), 2, 0, sb_offsets);
+            double estimate = n_s > 0 ? (double)count * (double)s_offsets.size() / (double)n_s : 0.0;
+            stats.record(i, estimate < (double)num);
+        }
+    }
+
+    doc_order.add_stats(stats);
+    doc_order.reorder();
+}
+
+void
+estimate_doc_order(const InvertedIndex *inverted_index, DocOrder& doc_order) {
+    if (inverted_index->_wide_offsets) {
+        estimate_doc_order_t<offset64_t>(inverted_index, doc_order);
+    } else {
+        estimate_doc_order_t<offset_t>(inverted_index, doc_order);
+    }
+}
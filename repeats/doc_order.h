@@ -0,0 +1,118 @@
+#ifndef DOC_ORDER_H
+#define DOC_ORDER_H
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+/*
+ * The order in which the merge and gapped engines check the documents of each s + b
+ *
+ * A candidate s + b is rejected as soon as more than _n_bad_allowed documents fail, so
+ *  checking the documents that fail most often first saves merging the others. The
+ *  order of _docs_map is by RequiredRepeats::repeat_size() which says little about how
+ *  often a document fails, so the engines keep count of the checks and failures of each
+ *  document and reorder them between levels, most likely to fail first. The order for
+ *  the first level is estimated from a sample of merges. See estimate_doc_order()
+ *
+ * The order doesn't change the results. A candidate fails in the same documents in any
+ *  order and the offsets of the ones that match are stored in _docs_map order.
+ *
+ * Expected usage
+ * ---------------
+ *  DocOrder doc_order(inverted_index->_docs_map);
+ *  estimate_doc_order(inverted_index, doc_order);
+ *  for each level
+ *      for each s + b, in worker w
+ *          for (size_t k = 0; k < doc_order.size(); k++)
+ *              size_t i = doc_order.order()[k]     // check document doc_order.docs()[i]
+ *              worker_scratch[w]._stats.record(i, failed)
+ *      for each worker w
+ *          doc_order.add_stats(worker_scratch[w]._stats)
+ *      doc_order.reorder()
+ */
+
+/*
+ * The number of checks and failures of each document, indexed by position in _docs_map.
+ *  Each worker keeps its own
+ */
+struct DocStats {
+    std::vector<size_t> _n_checked;
+    std::vector<size_t> _n_failed;
+
+    void resize(size_t n_docs) {
+        _n_checked.resize(n_docs);
+        _n_failed.resize(n_docs);
+    }
+
+    void record(size_t i, bool failed) {
+        _n_checked[i]++;
+        _n_failed[i] += failed;
+    }
+
+    void clear() {
+        std::fill(_n_checked.begin(), _n_checked.end(), 0);
+        std::fill(_n_failed.begin(), _n_failed.end(), 0);
+    }
+};
+
+class DocOrder {
+    // `_docs[i]` is the i'th document of _docs_map
+    std::vector<std::map<int, RequiredRepeats>::const_iterator> _docs;
+
+    // Positions in `_docs` in the order to check them
+    std::vector<size_t> _order;
+
+    // Checks and failures of each document over all levels so far, with older levels
+    //  weighted less. See reorder()
+    std::vector<double> _n_checked;
+    std::vector<double> _n_failed;
+
+public:
+    DocOrder(const std::map<int, RequiredRepeats>& docs_map);
+
+    size_t size() const { return _docs.size(); }
+
+    const std::vector<std::map<int, RequiredRepeats>::const_iterator>& docs() const { return _docs; }
+
+    const std::vector<size_t>& order() const { return _order; }
+
+    // Add the counts in `stats` to this level's and clear them
+    void add_stats(DocStats& stats);
+
+    // Sort the documents by their failure rate and start a new level
+    void reorder();
+
+    // Return a description of the order e.g. "2:0.91 0:0.50 1:0.12", doc index:failure rate
+    std::string describe() const;
+};
+
+/*
+ * Per worker scratch space of the document loop of get_sb_postings(). The vectors are
+ *  indexed by position in _docs_map
+ */
+template <class Offset>
+struct DocScratch {
+    std::vector<std::vector<Offset>> _offsets;  // Offsets of s + b in each document
+    std::vector<bool> _failed;                  // Documents that must fail. See get_failed_docs()
+    DocStats _stats;
+
+    void resize(size_t n_docs) {
+        _offsets.resize(n_docs);
+        _failed.resize(n_docs);
+        _stats.resize(n_docs);
+    }
+};
+
+struct InvertedIndex;
+
+/*
+ * Set the initial order of `doc_order` from a sample of merges of the byte Postings of
+ *  `inverted_index`. Each sample merges the first SAMPLE_OFFSETS offsets of byte s with
+ *  byte b in each document and scales the count of s + b to all the offsets of s
+ */
+void estimate_doc_order(const InvertedIndex *inverted_index, DocOrder& doc_order);
+
+#endif // #ifndef DOC_ORDER_H
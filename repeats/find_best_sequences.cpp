@@ -18,280 +18,15 @@ using namespace std;
 #include "mytypes.h"
 #include "utils.h"
 #include "timer.h"
+#include "doc_order.h"
+#include "sb_postings.h"
+#include "term_store.h"
+#include "checkpoint.h"
+#include "profiler.h"
 #include "inverted_index.h"
 
 using namespace std;
 
-/*
- * Return ordered vector of offsets of terms s + b in document where
- *      `s_offsets` is ordered vector of offsets of Term s in document
- *      `b_offsets` is ordered vector of offsets of strings b in document
- *      `m` is length of s
- *
- * THIS IS THE INNER LOOP
- *
- *  Params:
- *      s_offsets: All offsets of term s in a document
- *      m: offset of m - offset of b to check. i.e. m = |s| + gap for s<gap>b
- *      b_offsets: All offsets of Term b in a document
- *  Returns:
- *      Offsets of all s<gap>b Terms in the document
- *
- * Basic idea is to keep 2 pointers and move the one behind and record matches of
- *  *is + m == *ib
- * Only tested for  INNER_LOOP==4
- */
-inline
-const vector<offset_t>
-get_sb_offsets(const vector<offset_t>& s_offsets, offset_t m, const vector<offset_t>& b_offsets) {
-    vector<offset_t> sb_offsets;
-    vector<offset_t>::const_iterator is = s_offsets.begin();
-    vector<offset_t>::const_iterator ib = b_offsets.begin();
-
-#if INNER_LOOP == 1
-    vector<offset_t>::const_iterator b_end = bytes.end();
-    vector<offset_t>::const_iterator s_end = strings.end();
-
-    while (ib < b_end && is < s_end) {
-        offset_t is_m = *is + m;
-        if (*ib == is_m) {
-            sb_offsets.push_back(*is);
-            ++is;
-        } else if (*ib < is_m) {
-            while (ib < b_end && *ib < is_m) {
-                ++ib;
-            }
-        } else {
-            offset_t ib_m =  *ib - m;
-            while (is < s_end && *is < ib_m) {
-                ++is;
-            }
-        }
-    }
-
-#elif INNER_LOOP == 2
-
-    while (ib < bytes.end() && is < strings.end()) {
-        if (*ib == *is + m) {
-            sb_offsets.push_back(*is);
-            ++is;
-        } else if (*ib < *is + m) {
-            ib = get_gteq(ib, bytes.end(), *is + m);
-        } else {
-            is = get_gteq(is, strings.end(), *ib - m);
-        }
-    }
-
-#elif INNER_LOOP == 3
-
-    // Performance about same for 256, 512 when num chars is low
-    // !@#$ Need to optimize this
-    // The next power 2 calculation slows 2 MB test 35 sec => 42 sec!
-    //size_t step_size_b = next_power2((double)(bytes.back() - bytes.front())/(double)bytes.size());
-    //size_t step_size_s = next_power2((double)(strings.back() - strings.front())/(double)strings.size());
-
-    size_t step_size_b = 512;
-    size_t step_size_s = 512;
-
-    while (ib < bytes.end() && is < strings.end()) {
-
-        if (*ib == *is + m) {
-            sb_offsets.push_back(*is);
-            ++is;
-        } else if (*ib < *is + m) {
-            ib = get_gteq2(ib, bytes.end(), *is + m, step_size_b);
-        } else {
-            is = get_gteq2(is, strings.end(), *ib - m, step_size_s);
-        }
-    }
-
-#elif INNER_LOOP == 4
-    vector<offset_t>::const_iterator s_end = s_offsets.end();
-    vector<offset_t>::const_iterator b_end = b_offsets.end();
-
-    double ratio = (double)b_offsets.size() / (double)s_offsets.size();
-
-    if (ratio < 8.0) {
-        /*
-         * Walk through s_offsets and b_offsets keeping them aligned as follows
-         *  b offset == end of s offset => save s offset as it is an s + b offset
-         *  b offset < end of s offset  => advance b offset
-         *  b offset > end of s offset  => advance s offset
-         */
-        while (ib != b_end && is != s_end) {
-            offset_t s_m = *is + m;  // offset of end of s
-            if (*ib == s_m) {
-                sb_offsets.push_back(*is);
-                ++ib;
-                ++is;
-            } else if (*ib < s_m) {
-                while (ib != b_end && *ib < s_m) {
-                    ++ib;
-                }
-            } else {
-                offset_t b_m = *ib - m;
-                while (is != s_end && *is < b_m) {
-                    ++is;
-                }
-            }
-        }
-    } else {
-        /*
-         * Walk through s_offsets and b_offsets keeping them aligned as follows
-         *  b offset == end of s offset => save s offset as it is an s + b offset
-         *  b offset < end of s offset  => advance b offset binary searching regions of step_size_b
-         *  b offset > end of s offset  => advance s offset
-         */
-        size_t step_size_b = next_power2(ratio);
-        while (ib != b_end && is != s_end) {
-            offset_t s_m = *is + m;
-            if (*ib == s_m) {
-                sb_offsets.push_back(*is);
-                ++ib;
-                ++is;
-            } else if (*ib < s_m) {
-                 ib = get_gteq2(ib, b_end, s_m, step_size_b);
-            } else {
-                offset_t b_m =  *ib - m;
-                while (is != s_end && *is < b_m) {
-                    ++is;
-                }
-            }
-        }
-    }
-#endif
-
-    return sb_offsets;
-}
-
-#if 0
-inline vector<offset_t>
-get_non_overlapping_strings(const vector<offset_t>& offsets, size_t m) {
-    if (offsets.size() < 2) {
-        return offsets;
-    }
-    vector<offset_t> non_overlapping;
-    vector<offset_t>::const_iterator it0 = offsets.begin();
-    vector<offset_t>::const_iterator it1 = it0 + 1;
-    vector<offset_t>::const_iterator end = offsets.end();
-
-    non_overlapping.push_back(*it0);
-    while (it1 < end) {
-        if (*it1 >= *it0 + m) {
-            non_overlapping.push_back(*it1);
-            it0++;
-            it1++;
-        } else {
-            while (it1 < end && *it1 < *it0 + m) {
-                it1++;
-            }
-        }
-    }
-    return non_overlapping;
-}
-#endif
-
-// Return number of offsets that are for non-overlapping terms
-// This is a bit slow. Should calculate and store this value when creating strings list
-size_t
-get_non_overlapping_count(const vector<offset_t>& offsets, size_t m) {
-    if (offsets.size() < 2) {
-        return offsets.size();
-    }
-
-    vector<offset_t>::const_iterator it0 = offsets.begin();
-    vector<offset_t>::const_iterator it1 = it0 + 1;
-    vector<offset_t>::const_iterator end = offsets.end();
-    size_t count = 1;
-
-    while (it1 < end) {
-        if (*it1 >= *it0 + m) {
-            count++;
-            it0++;
-            it1++;
-        } else {
-            while (it1 < end && *it1 < *it0 + m) {
-                it1++;
-            }
-        }
-    }
-    return count;
-}
-
-/*
- * s<gap>b := Term s followed by gap wildcards followe by byte b
- *  e.g. AB.C term=AB:gap=1,byte=C  or A.B..C:term=A.B:gap=2,byte=C
- *
- * Return Postings for term s<gap>b if s<gap>b is repeated a sufficient number of times in each document
- *  otherwise an empty Postings
- *  Caller must guarantee that s and b are valid (repeated a sufficient number of times in each document)
- *
- *  Params:
- *      inverted_index: The InvertedIndex
- *      term_postings_map_list: term_postings_map_list[m] = All Posting of length m
- *      s: A valid length m term
- *      gap: Number of chars between end of s and b
- *      b: A vaild length 1 term
- *  Returns:
- *      Offsets of all s<gap>b Terms in the document
- */
-inline
-Postings
-get_sb_postings(const InvertedIndex *inverted_index,
-                const vector<map<Term, Postings>>& term_postings_map_list,
-                const Term& s, offset_t gap, byte b) {
-
-    offset_t m = (offset_t)s.size();
-    const Postings& s_postings = term_postings_map_list[m].at(s);
-    const Postings& b_postings = inverted_index->_byte_postings_map.at(b);
-    Postings sb_postings;
-
-    const map<int, RequiredRepeats>& docs_map = inverted_index->_docs_map;
-    int n_bad = 0;
-    for (map<int, RequiredRepeats>::const_iterator it = docs_map.begin(); it != docs_map.end(); ++it) {
-        int doc_index = it->first;
-        const vector<offset_t>& s_offsets = s_postings._offsets_map.at(doc_index);
-        const vector<offset_t>& b_offsets = b_postings._offsets_map.at(doc_index);
-
-        vector<offset_t> sb_offsets = get_sb_offsets(s_offsets, m + gap, b_offsets);
-
-        /*
-         * Only count non-overlapping offsets when checking validity.
-         *
-         * We can do this because any non-overlapping length m + 1 substring must
-         *  start with a non-overlapping length m substring.
-         *
-         * We CANNOT remove non-overlapping substrings of length m because
-         *  valid substrings of length m + 1 may start with length m
-         *  substrings may be overlapped byt other valid length m
-         *  substrings
-         *  e.g. looking for longest substring that appears twice in "aabcabcaa"
-         *           Non-overlapping     Overlapping
-         *      m=1: a:5, b:2, c:2       a:5, b:2, c:2
-         *      m=2: aa:2, bc:2, ca:2    aa:2, ab:2, bc:2, ca:2
-         *      m=3: none                abc:2
-         */
-        //sb_offsets = get_non_overlapping_strings(sb_offsets, m+1);
-
-        if (sb_offsets.size() < it->second._num
-                || get_non_overlapping_count(sb_offsets, m + 1) < it->second._num) {
-            n_bad++;
-            if (n_bad > inverted_index->_n_bad_allowed) {
-                // Empty map signals no match
-                return Postings();
-            }
-        }
-
-        sb_postings.add_offsets(doc_index, sb_offsets);
-    }
-
-
-#if VERBOSITY >= 3
-    cout << " matched '" << s + b + "' for " << sb_postings.size() << " docs" << endl;
-#endif
-    return sb_postings;
-}
-
 #if 0
 static
 map<string, map<int, offset_t>>
@@ -362,6 +97,11 @@ get_longest_exact_matches(map<int, RequiredRepeats>& docs_map,
 
 // !@#$%
 
+// Set to 1 to drop terms that are part of printer patterns. See is_allowed_for_printer()
+#define PRINTER_FILTER 0
+
+#if PRINTER_FILTER
+
 const byte CDCA[] = {0xcd, 0xca, 0x10, 0x00, 0x00, 0x18, 0x00, 0x01, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 const byte PATTERN2[] = {0x00, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 const byte PATTERN3[] = {0x81, 0x22, 0x81, 0x22};
@@ -400,7 +140,6 @@ is_part_of_cdca(const Term& str) {
 static
 bool
 is_allowed_for_printer(const Term& str) {
-    return true;
 #if 1
     if (is_part_of_cdca(str)) {
         return false;
@@ -422,22 +161,27 @@ is_allowed_for_printer(const Term& str) {
 
     return false;
 }
+#endif // #if PRINTER_FILTER
 
-inline
+/*
+ * Return the terms in `terms` that are repeated exactly the required number of times in
+ *  every document. postings_list[id] is the Postings of term id of `terms`
+ */
+template <class Offset>
+static inline
 const vector<Term>
 get_exact_matches(const map<int, RequiredRepeats>& docs_map,
-                  const map<Term, Postings>& term_postings_map) {
+                  const TermStore& terms, const vector<PostingsT<Offset>>& postings_list) {
     vector<Term> exact_matches;
 
-     for (map<Term, Postings>::const_iterator it = term_postings_map.begin(); it != term_postings_map.end(); ++it) {
-        const Term& s = it->first;
-        const map<int, vector<offset_t>>& offsets_map = it->second._offsets_map;
+    const vector<TermId> ids = terms.sorted_ids();
+    for (vector<TermId>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+        const PostingsT<Offset>& postings = postings_list[*it];
         bool is_match = true;
-        for (map<int, vector<offset_t>>::const_iterator jt = offsets_map.begin(); jt != offsets_map.end(); ++jt) {
-            int d = jt->first;
+        for (int d = 0; d < (int)postings.num_docs(); d++) {
             const RequiredRepeats& rr = docs_map.at(d);
             // !@#$ Strictly, non-overlapping count, not size()
-            offset_t count = (offset_t)jt->second.size();
+            offset_t count = (offset_t)postings.doc_size(d);
             if (rr._num != count) {
                 is_match = false;
                 break;
@@ -445,12 +189,21 @@ get_exact_matches(const map<int, RequiredRepeats>& docs_map,
         }
 
         if (is_match) {
-            exact_matches.push_back(s);
+            exact_matches.push_back(terms.get_term(*it));
         }
     }
     return exact_matches;
 }
 
+/*
+ * Term `_id` of the TermStore of length `_len` terms
+ */
+struct TermRef {
+    offset_t _len;
+    TermId _id;
+    TermRef(offset_t len, TermId id) : _len(len), _id(id) {}
+};
+
 /*
     longest terms: |term| == m + 1
             fraction wild cards <= 1 - epsilon
@@ -463,34 +216,66 @@ get_exact_matches(const map<int, RequiredRepeats>& docs_map,
 
         extendable_terms = terms that satisfy Limit
     Params:
-        terms_list: terms_list[i] = valid terms of length i
+        term_store_list: term_store_list[i] = valid terms of length i
         epsilon: min fraction of non-wildcards in each term
         m: m + 1 is length of terms to construct
     Returns:
         list of terms that can be extended to m + 1
 */
 static
-const vector<Term>
-get_extendable_terms(const vector<vector<Term>> terms_list, double epsilon, offset_t m) {
+const vector<TermRef>
+get_extendable_terms(const vector<TermStore *>& term_store_list, double epsilon, offset_t m) {
 
-    vector<Term> extendable_terms;
+    vector<TermRef> extendable_terms;
     double lim = (1 - epsilon) *( m + 1);
     offset_t min_m = Ceil(epsilon * (m));
     for (offset_t i = min_m; i <= m; i++) {
-        const vector<Term>& terms = terms_list[i];
+        const TermStore& terms = *term_store_list[i];
+        assert(terms.len() == i);
 
-        for (vector<Term>::const_iterator it = terms.begin(); it != terms.end(); ++it) {
-            const Term& term = *it;
-            assert(term.size() == i);
-
-            if (num_wild(term) + m - i <= lim) {
-                extendable_terms.push_back(term);
+        for (TermId id = 0; id < terms.size(); id++) {
+            if (terms.num_wild(id) + m - i <= lim) {
+                extendable_terms.push_back(TermRef(i, id));
             }
         }
     }
     return extendable_terms;
 }
 
+/*
+ * Return total number of terms in `term_store_list`
+ */
+static
+size_t
+get_num_terms(const vector<TermStore *>& term_store_list) {
+    size_t n = 0;
+    for (vector<TermStore *>::const_iterator it = term_store_list.begin(); it != term_store_list.end(); ++it) {
+        if (*it) {
+            n += (*it)->size();
+        }
+    }
+    return n;
+}
+
+/*
+ * A term s<gap>b found by a worker in get_all_repeats()
+ */
+template <class Offset>
+struct GapExtension {
+    size_t _s_index;    // Index of s in extendable_terms
+    offset_t _gap;
+    byte _b;
+    PostingsT<Offset> _postings;
+    GapExtension(size_t s_index, offset_t gap, byte b, const PostingsT<Offset>& postings) :
+        _s_index(s_index), _gap(gap), _b(b), _postings(postings) {}
+    bool operator<(const GapExtension& other) const {
+        if (_s_index != other._s_index) {
+            return _s_index < other._s_index;
+        }
+        return _gap != other._gap ? _gap < other._gap : _b < other._b;
+    }
+};
+
 /*
  * Return the list of terms that are repeated a sufficient numbers of times in all documents
  *
@@ -511,26 +296,36 @@ get_extendable_terms(const vector<vector<Term>> terms_list, double epsilon, offs
  *      will start decreasing when m is large enough
  *
  */
+template <class Offset>
+static
 RepeatsResults
-get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
+get_all_repeats_gapped_t(InvertedIndex *inverted_index, size_t max_term_len) {
 
     // Postings Map of terms of length 1
-    const map<byte, Postings>& byte_postings_map = inverted_index->_byte_postings_map;
-
-    vector<map<Term, Postings>> term_postings_map_list(max_term_len + 1);
-    vector<vector<Term>> valid_terms_list(max_term_len + 1);
+    const map<byte, PostingsT<Offset>>& byte_postings_map = get_byte_postings_map<Offset>(inverted_index);
+
+    // term_store_list[i] holds the valid terms of length i and postings_lists[i][id] is the
+    //  Postings of term id of term_store_list[i]. The last pass can make terms of length
+    //  max_term_len + 1
+    vector<TermStore *> term_store_list(1, (TermStore *)0);
+    for (offset_t i = 1; i <= max_term_len + 1; i++) {
+        term_store_list.push_back(new TermStore(i, &term_store_list));
+    }
+    vector<vector<PostingsT<Offset>>> postings_lists(max_term_len + 2);
 
-    // Postings map of terms of length m + 1 is constructed from terms of length m
-    map<Term, Postings> term_postings_map_ = copy_map_byte_term(byte_postings_map);
-    term_postings_map_list[1] = term_postings_map_; 
+    // Terms of length m + 1 are constructed from terms of length <= m
+    for (typename map<byte, PostingsT<Offset>>::const_iterator it = byte_postings_map.begin(); it != byte_postings_map.end(); ++it) {
+        term_store_list[1]->add_byte(it->first);
+        postings_lists[1].push_back(it->second);
+    }
 
     const vector<byte> valid_bytes = get_keys_vector(byte_postings_map);
-    valid_terms_list[1] = get_keys_vector(term_postings_map_list[1]);
 
 #if VERBOSITY >= 1
     cout << "get_all_repeats: valid_bytes=" << byte_postings_map.size()
          << ",repeated_strings=" << byte_postings_map.size()
          << ",max_term_len=" << max_term_len
+         << ",threads=" << inverted_index->_thread_pool->num_workers()
          << endl;
 #endif
 
@@ -547,11 +342,61 @@ get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
     // Myers' epsilon. Ratio of non-wildcards to term length   !@#$ Function argument.
     double epsilon = 0.9;
 
+    ThreadPool *thread_pool = inverted_index->_thread_pool;
+    int n_workers = thread_pool->num_workers();
+
+    // Each worker builds the Postings of the terms it extends in its own PostingsBuilder
+    //  and stores the ones that match in its own Arena
+    vector<PostingsBuilderT<Offset>> worker_builders(n_workers);
+
+    // The documents of each candidate are checked in doc_order, which is reordered after
+    //  each level by how often each document failed in it. See doc_order.h
+    DocOrder doc_order(inverted_index->_docs_map);
+    {
+        ScopedPhase phase("order");
+        estimate_doc_order(inverted_index, doc_order);
+    }
+    vector<DocScratch<Offset>> worker_scratch(n_workers);
+    for (typename vector<DocScratch<Offset>>::iterator it = worker_scratch.begin(); it != worker_scratch.end(); ++it) {
+        it->resize(doc_order.size());
+    }
+
+    // pass_arenas[k] holds the Postings made in pass k and pass_max_len[k] is the length
+    //  of the longest term made in pass k. Terms shorter than Ceil(epsilon * m) are not
+    //  extended in pass m or later, so a pass's arena is retired once all the terms it
+    //  made are that short. Retired arenas are kept in spare_arenas for reuse
+    //  (The length 1 Postings are in the InvertedIndex)
+    vector<LevelArena *> pass_arenas(max_term_len + 1, (LevelArena *)0);
+    vector<offset_t> pass_max_len(max_term_len + 1, 0);
+    vector<LevelArena *> spare_arenas;
+
+    // Continue a search that was stopped from its last checkpoint. See checkpoint.h
+    //  The resumed Postings are treated as if they were made in the pass before the
+    //  first one, so their arena is retired like the others
+    offset_t m_start = 1;
+    if (inverted_index->_options._resume) {
+        ScopedPhase phase("resume");
+        LevelArena *resume_arena = new LevelArena(n_workers);
+        if (read_checkpoint(inverted_index, ENGINE_GAPPED, max_term_len, term_store_list, postings_lists,
+                            resume_arena->worker_arena(0), m_start)) {
+            pass_arenas[m_start - 1] = resume_arena;
+            for (offset_t i = 1; i < (offset_t)postings_lists.size(); i++) {
+                if (!postings_lists[i].empty()) {
+                    pass_max_len[m_start - 1] = i;
+                }
+            }
+            cout << "Resumed from checkpoint at len=" << m_start << endl;
+        } else {
+            delete resume_arena;
+        }
+    }
+    double last_checkpoint = get_elapsed_time();
+
     // Each pass through this for loop builds offsets of terms of length m + 1 from
     // offsets of terms of length <= m
     // What is m for a sequence? Lenght ??>? !@#$
     offset_t m;
-    for (m = 1; m <= max_term_len; m++) {
+    for (m = m_start; m <= max_term_len; m++) {
 
         // D = min allow number of non-wildcards in m + 1 round
         // W = max allowed wildcards
@@ -561,7 +406,8 @@ get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
 #if TRACK_EXACT_MATCHES
         {   // Keep track of exact matches
             // We may need to backtrack to the longest exact match term
-            const vector<Term>& em = get_exact_matches(inverted_index->_docs_map, term_postings_map);
+            const vector<Term>& em = get_exact_matches(inverted_index->_docs_map, *term_store_list[m],
+                                                       postings_lists[m]);
             if (em.size() >= 3) {
                 show_exact_matches = true;
             }
@@ -575,24 +421,16 @@ get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
         // Report progress to stdout
         cout << "--------------------------------------------------------------------------" << endl;
         cout << "get_all_repeats: len=" << m << ", num valid terms=" 
-             << get_vector_list_size(valid_terms_list)
+             << get_num_terms(term_store_list)
              << ", time= " << get_elapsed_time() << endl;
-#endif
-#if VERBOSITY >= 2
-         for (int i = 0; i < min(3, (int)valid_terms.size()); i++) {
-            const Term& s = valid_terms[i];
-            //print_vector(term_to_string(s), term_postings_map[s].counts_per_doc());
-        }
-        print_vector("valid_terms", valid_terms, 10);
 #endif
         /*
          * Construct all possible length m + 1 terms from existing length m terms in valid_s_b
          * and filter out length m + 1 term that don't end with an existing length m term
          */
         /*
-         * valid_s_g_b[s][g][b] is later converted to s<g>b: (s is length m, b is length 1)
-         * valid_s_g_b[s][g][b] contains only s, b such that (s + b)[:-1] and (s + b)[1:]
-         * are elements of valid_terms
+         * Each extendable term s is extended to s<g>b for 0 <= g <= W - (wildcards in s)
+         * and all valid bytes b
          *
          *  g = 0 => <b>
          *  g = 1 => <.b> (trailing wildcards will be handled in next iteration: <b.>)
@@ -602,125 +440,194 @@ get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
                                  handled in g = 1 <.b>)
          */
         // Terms that can be extended to length m + 1 while obeying epsilon criterion
-        const vector<Term> extendable_terms = get_extendable_terms(valid_terms_list, epsilon, m);
+        vector<TermRef> extendable_terms;
+        {
+            ScopedPhase phase("candidates", m);
+            extendable_terms = get_extendable_terms(term_store_list, epsilon, m);
+        }
+
+        // Retire the Postings of terms that are too short to be extended. The terms are
+        //  kept because longer terms refer to them
+        offset_t min_m = Ceil(epsilon * m);
+        for (offset_t i = 1; i < min_m; i++) {
+            vector<PostingsT<Offset>>().swap(postings_lists[i]);
+        }
+        for (offset_t k = 1; k < m; k++) {
+            if (pass_arenas[k] && pass_max_len[k] < min_m) {
+                pass_arenas[k]->reset();
+                spare_arenas.push_back(pass_arenas[k]);
+                pass_arenas[k] = 0;
+            }
+        }
+        LevelArena *m1_arena;
+        if (spare_arenas.empty()) {
+            m1_arena = new LevelArena(n_workers);
+        } else {
+            m1_arena = spare_arenas.back();
+            spare_arenas.pop_back();
+        }
+        pass_arenas[m] = m1_arena;
  
-        cout << get_vector_list_size(valid_terms_list) << " valid => " 
+        cout << get_num_terms(term_store_list) << " valid => " 
              << extendable_terms.size() << " extendable" << endl;
 
-        map<Term, map<int, vector<byte>>> valid_s_g_b;
+        size_t num_valid_s_g_b = 0;
+        for (vector<TermRef>::const_iterator is = extendable_terms.begin(); is != extendable_terms.end(); ++is) {
+            int max_g = W - term_store_list[is->_len]->num_wild(is->_id);
+            num_valid_s_g_b += (max_g + 1) * valid_bytes.size();
+        }
 
-        for (vector<Term>::const_iterator is = extendable_terms.begin(); is != extendable_terms.end(); ++is) {
-            const Term& s = *is;
-            int max_g = W - num_wild(s);
-            map<int, vector<byte>> extension_gaps_bytes;
+        // Find the s<g>b for all extendable s, gaps g and bytes b
+        // This cannot increase total number of offsets as each s<g>b starts with s
+        //
+        // The s<g>b are independent so the s are shared out among the worker threads.
+        // Each worker records the s<g>b it finds and they are added to the TermStores
+        // afterwards in extendable_terms order so that the TermIds don't depend on which
+        // worker handled which s
+        vector<vector<GapExtension<Offset>>> worker_extensions(n_workers);
+
+        {
+            ScopedPhase phase("merge", m);
+
+            // If there are too few terms to keep the workers busy then extend the terms one at
+            // a time and share out the documents of each term among the workers instead
+            bool doc_parallel = inverted_index->_options._doc_parallel
+                             && extendable_terms.size() < (size_t)n_workers;
+            ThreadPool *doc_pool = doc_parallel ? thread_pool : 0;
+
+            auto extend_s = [&](size_t i, int worker) {
+                const TermRef& s = extendable_terms[i];
+                const PostingsT<Offset>& s_postings = postings_lists[s._len][s._id];
+                int max_g = W - term_store_list[s._len]->num_wild(s._id);
+                vector<GapExtension<Offset>>& extensions = worker_extensions[worker];
+
+                for (int gap = 0; gap <= max_g; gap++) {
+                    for (vector<byte>::const_iterator ib = valid_bytes.begin(); ib != valid_bytes.end(); ++ib) {
+                        byte b = *ib;
+                        PostingsT<Offset> postings = get_sb_postings(inverted_index, s_postings, s._len, gap, b,
+                                                            worker_builders[worker], m1_arena->worker_arena(worker),
+                                                            doc_order, worker_scratch[worker], doc_pool);
+                        if (postings.empty()) {
+                            continue;
+                        }
+                        extensions.push_back(GapExtension<Offset>(i, gap, b, postings));
+                    }
+                }
+            };
 
-            for (int g = 0; g <= max_g; g++) {
-                vector<byte> extension_bytes;
-                for (vector<byte>::const_iterator ib = valid_bytes.begin(); ib != valid_bytes.end(); ++ib) {
-                    extension_bytes.push_back(*ib);
+            if (doc_parallel) {
+                for (size_t i = 0; i < extendable_terms.size(); i++) {
+                    extend_s(i, 0);
                 }
-                extension_gaps_bytes[g] = extension_bytes;
+            } else {
+                thread_pool->parallel_for(extendable_terms.size(), extend_s);
             }
-            if (extension_gaps_bytes.size() > 0) {
-                valid_s_g_b[s] = extension_gaps_bytes;
+
+            for (int w = 0; w < (int)worker_scratch.size(); w++) {
+                doc_order.add_stats(worker_scratch[w]._stats);
             }
+            doc_order.reorder();
+#if VERBOSITY >= 2
+            cout << "doc order: " << doc_order.describe() << endl;
+#endif
         }
 
-        // Postings of length <= m + 1 terms genereated in this pass
-        map<Term, Postings> term_m1_postings_map;
-
-        // Build term_m1_postings_map[s<g>b] for all gaps g and bytes b in valid_s_g_b 
-        // This cannot increase total number of offsets as each s<g>b starts with s
-        for (map<Term, map<int, vector<byte>>>::const_iterator iv = valid_s_g_b.begin(); iv != valid_s_g_b.end(); ++iv) {
-            const Term& s = iv->first;
-            const map<int, vector<byte>>& g_b = iv->second;
-
-            for (map<int, vector<byte>>::const_iterator ig = g_b.begin(); ig != g_b.end(); ++ig) {
-                int gap = ig->first;
-                const vector<byte>& bytes = ig->second;
-
-                for (vector<byte>::const_iterator ib = bytes.begin(); ib != bytes.end(); ++ib) {
-                    byte b = *ib;
-                    const Postings postings = get_sb_postings(inverted_index, term_postings_map_list, s, gap, b);
-                    if (postings.empty()) {
-                        continue;
-                    }
-                    const Term s_g_b = extend_term_gap_byte(s, gap, b);
-
-                    // Hand tuning!!
-                    if (!is_allowed_for_printer(s_g_b)) {
-                       continue;
-                    }
+        size_t num_filtered = 0;
+        {
+            ScopedPhase phase("filter", m);
 
-                    term_m1_postings_map[s_g_b] = postings;
+            vector<GapExtension<Offset>> extensions;
+            for (typename vector<vector<GapExtension<Offset>>>::const_iterator it = worker_extensions.begin(); it != worker_extensions.end(); ++it) {
+                extensions.insert(extensions.end(), it->begin(), it->end());
+            }
+            sort(extensions.begin(), extensions.end());
+
+            // Add the s<g>b to the TermStores of their lengths. A term made again in a later
+            //  pass gets the Postings from that pass
+            for (typename vector<GapExtension<Offset>>::const_iterator it = extensions.begin(); it != extensions.end(); ++it) {
+                const TermRef& s = extendable_terms[it->_s_index];
+                offset_t mm = s._len + it->_gap + 1;
+#if PRINTER_FILTER
+                // Hand tuning!!
+                if (!is_allowed_for_printer(extend_term_gap_byte(term_store_list[s._len]->get_term(s._id),
+                                                                 it->_gap, it->_b))) {
+                   continue;
                 }
+#endif
+                bool added;
+                TermId id = term_store_list[mm]->add_extension(s._id, it->_gap, it->_b, added);
+                if (added) {
+                    postings_lists[mm].push_back(it->_postings);
+                } else {
+                    postings_lists[mm][id] = it->_postings;
+                }
+                pass_max_len[m] = max(pass_max_len[m], mm);
+                num_filtered++;
             }
         }
 
 #if VERBOSITY >= 1
-        //print_vector("   valid_s_b", get_keys_vector(valid_s_b));
         cout << extendable_terms.size() << " terms * "
              << valid_bytes.size() << " bytes = "
              << extendable_terms.size() * valid_bytes.size() << " ("
-             << get_map_map_vector_size(valid_s_g_b) << " valid) = "
-             << term_m1_postings_map.size() << " filtered"
+             << num_valid_s_g_b << " valid) = "
+             << num_filtered << " filtered"
              << endl;
+        cout << "postings arena: " << m1_arena->bytes_used() << " bytes used, "
+             << m1_arena->bytes_reserved() << " bytes reserved" << endl;
 
-        cout << get_vector_list_size(valid_terms_list) << " total "
+        cout << get_num_terms(term_store_list) << " total "
              << endl;
 
 #endif
 
         // If there are no matches then we were done in the last pass
-        if (term_m1_postings_map.size() == 0) {
+        if (num_filtered == 0) {
             converged = true;
             break;
         }
 
-#if 0
-        term_postings_map_list[m + 1] = term_m1_postings_map;
-        valid_terms_list[m + 1] = get_keys_vector(term_m1_postings_map);
-#else
-        term_postings_map_list[m + 1] = map<Term, Postings>();
-        valid_terms_list[m + 1] = vector<Term>();
-        for (map<Term, Postings>::const_iterator it = term_m1_postings_map.begin(); it != term_m1_postings_map.end(); ++it) {
-            const Term& term = it->first;
-            const Postings& postings = it->second;
-            offset_t mm = offset_t(term.size());
-            term_postings_map_list[mm][term] = postings; 
-            valid_terms_list[mm].push_back(term);
-#if 1
-            {
-                const vector<Term> valid_terms = valid_terms_list[mm];
-                for (vector<Term>::const_iterator is = valid_terms.begin(); is != valid_terms.end(); ++is) {
-                    const Term& termm = *is;
-                    assert(termm.size() == mm);
-                }
+        // Only the Postings of the terms that can be extended in later passes are saved
+        if (checkpoint_due(inverted_index, last_checkpoint)) {
+            ScopedPhase phase("checkpoint", m);
+            offset_t min_m1 = Ceil(epsilon * (m + 1));
+            vector<const vector<PostingsT<Offset>> *> postings_levels(postings_lists.size(), 0);
+            for (offset_t i = min_m1; i < (offset_t)postings_lists.size(); i++) {
+                postings_levels[i] = &postings_lists[i];
             }
-#endif
+            write_checkpoint(inverted_index, ENGINE_GAPPED, max_term_len, m + 1, term_store_list, postings_levels);
         }
-#endif
+    }
 
-#if 1
-        {
-            const vector<Term> valid_terms = valid_terms_list[m + 1];
-            for (vector<Term>::const_iterator it = valid_terms.begin(); it != valid_terms.end(); ++it) {
-                const Term& term = *it;
-                assert(term.size() == m + 1);
-            }
+    vector<Term> valid_terms;
+    {
+        ScopedPhase phase("output");
+        const TermStore& terms = *term_store_list[min(m, (offset_t)max_term_len + 1)];
+        const vector<TermId> ids = terms.sorted_ids();
+        for (vector<TermId>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+            valid_terms.push_back(terms.get_term(*it));
         }
+    }
 
-        for (offset_t i = 0; i <= m + 1; ++i) {
-             const vector<Term> valid_terms = valid_terms_list[i];
-             for (vector<Term>::const_iterator it = valid_terms.begin(); it != valid_terms.end(); ++it) {
-                const Term& term = *it;
-                assert(term.size() == i);
-             }
-        }
-#endif
+    for (vector<TermStore *>::iterator it = term_store_list.begin(); it != term_store_list.end(); ++it) {
+        delete *it;
+    }
+    for (vector<LevelArena *>::iterator it = pass_arenas.begin(); it != pass_arenas.end(); ++it) {
+        delete *it;
     }
+    for (vector<LevelArena *>::iterator it = spare_arenas.begin(); it != spare_arenas.end(); ++it) {
+        delete *it;
+    }
+
+    return RepeatsResults(converged, valid_terms, exact_matches);
+}
 
-    return RepeatsResults(converged, valid_terms_list[m], exact_matches);
+RepeatsResults
+get_all_repeats_gapped(InvertedIndex *inverted_index, size_t max_term_len) {
+    if (inverted_index->_wide_offsets) {
+        return get_all_repeats_gapped_t<offset64_t>(inverted_index, max_term_len);
+    }
+    return get_all_repeats_gapped_t<offset_t>(inverted_index, max_term_len);
 }
 
 #endif // #if TERM_IS_SEQUENCE
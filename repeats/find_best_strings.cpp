@@ -1,8 +1,6 @@
 #include "inverted_index.h"
 #include "inverted_index_int.h"
 
-#if !TERM_IS_SEQUENCE
-
 using namespace std;
 
 /*
@@ -13,277 +11,20 @@ using namespace std;
  */
 
 #include <assert.h>
+#include <string.h>
 #include <iostream>
 #include "mytypes.h"
 #include "utils.h"
 #include "timer.h"
+#include "doc_order.h"
+#include "sb_postings.h"
+#include "term_store.h"
+#include "checkpoint.h"
+#include "profiler.h"
 #include "inverted_index.h"
 
 using namespace std;
 
-/*
- * Return ordered vector of offsets of terms s + b in document where
- *      `s_offsets` is ordered vector of offsets of Term s in document
- *      `b_offsets` is ordered vector of offsets of strings b in document
- *      `m` is length of s
- *
- * THIS IS THE INNER LOOP
- *
- *  Params:
- *      s_offsets: All offsets of Term s in a document
- *      m: length of Term s
- *      b_offsets: All offsets of Term b in a document
- *  Returns:
- *      Offsets of all s + b Terms in the document
- *
- * Basic idea is to keep 2 pointers and move the one behind and record matches of
- *  *is + m == *ib
- */
-inline
-const vector<offset_t>
-get_sb_offsets(const vector<offset_t>& s_offsets, offset_t m, const vector<offset_t>& b_offsets) {
-    vector<offset_t> sb_offsets;
-    vector<offset_t>::const_iterator is = s_offsets.begin();
-    vector<offset_t>::const_iterator ib = b_offsets.begin();
-
-#if INNER_LOOP == 1
-    vector<offset_t>::const_iterator b_end = bytes.end();
-    vector<offset_t>::const_iterator s_end = strings.end();
-
-    while (ib < b_end && is < s_end) {
-        offset_t is_m = *is + m;
-        if (*ib == is_m) {
-            sb_offsets.push_back(*is);
-            ++is;
-        } else if (*ib < is_m) {
-            while (ib < b_end && *ib < is_m) {
-                ++ib;
-            }
-        } else {
-            offset_t ib_m =  *ib - m;
-            while (is < s_end && *is < ib_m) {
-                ++is;
-            }
-        }
-    }
-
-#elif INNER_LOOP == 2
-
-    while (ib < bytes.end() && is < strings.end()) {
-        if (*ib == *is + m) {
-            sb_offsets.push_back(*is);
-            ++is;
-        } else if (*ib < *is + m) {
-            ib = get_gteq(ib, bytes.end(), *is + m);
-        } else {
-            is = get_gteq(is, strings.end(), *ib - m);
-        }
-    }
-
-#elif INNER_LOOP == 3
-
-    // Performance about same for 256, 512 when num chars is low
-    // !@#$ Need to optimize this
-    // The next power 2 calculation slows 2 MB test 35 sec => 42 sec!
-    //size_t step_size_b = next_power2((double)(bytes.back() - bytes.front())/(double)bytes.size());
-    //size_t step_size_s = next_power2((double)(strings.back() - strings.front())/(double)strings.size());
-
-    size_t step_size_b = 512;
-    size_t step_size_s = 512;
-
-    while (ib < bytes.end() && is < strings.end()) {
-
-        if (*ib == *is + m) {
-            sb_offsets.push_back(*is);
-            ++is;
-        } else if (*ib < *is + m) {
-            ib = get_gteq2(ib, bytes.end(), *is + m, step_size_b);
-        } else {
-            is = get_gteq2(is, strings.end(), *ib - m, step_size_s);
-        }
-    }
-
-#elif INNER_LOOP == 4
-    vector<offset_t>::const_iterator s_end = s_offsets.end();
-    vector<offset_t>::const_iterator b_end = b_offsets.end();
-
-    double ratio = (double)b_offsets.size() / (double)s_offsets.size();
-
-    if (ratio < 8.0) {
-        /*
-         * Walk through s_offsets and b_offsets keeping them aligned as follows
-         *  b offset == end of s offset => save s offset as it is an s + b offset
-         *  b offset < end of s offset  => advance b offset
-         *  b offset > end of s offset  => advance s offset
-         */
-        while (ib != b_end && is != s_end) {
-            offset_t s_m = *is + m;  // offset of end of s
-            if (*ib == s_m) {
-                sb_offsets.push_back(*is);
-                ++ib;
-                ++is;
-            } else if (*ib < s_m) {
-                while (ib != b_end && *ib < s_m) {
-                    ++ib;
-                }
-            } else {
-                offset_t b_m = *ib - m;
-                while (is != s_end && *is < b_m) {
-                    ++is;
-                }
-            }
-        }
-    } else {
-        /*
-         * Walk through s_offsets and b_offsets keeping them aligned as follows
-         *  b offset == end of s offset => save s offset as it is an s + b offset
-         *  b offset < end of s offset  => advance b offset binary searching regions of step_size_b
-         *  b offset > end of s offset  => advance s offset
-         */
-        size_t step_size_b = next_power2(ratio);
-        while (ib != b_end && is != s_end) {
-            offset_t s_m = *is + m;
-            if (*ib == s_m) {
-                sb_offsets.push_back(*is);
-                ++ib;
-                ++is;
-            } else if (*ib < s_m) {
-                 ib = get_gteq2(ib, b_end, s_m, step_size_b);
-            } else {
-                offset_t b_m =  *ib - m;
-                while (is != s_end && *is < b_m) {
-                    ++is;
-                }
-            }
-        }
-    }
-#endif
-
-    return sb_offsets;
-}
-
-#if 0
-inline vector<offset_t>
-get_non_overlapping_strings(const vector<offset_t>& offsets, size_t m) {
-    if (offsets.size() < 2) {
-        return offsets;
-    }
-    vector<offset_t> non_overlapping;
-    vector<offset_t>::const_iterator it0 = offsets.begin();
-    vector<offset_t>::const_iterator it1 = it0 + 1;
-    vector<offset_t>::const_iterator end = offsets.end();
-
-    non_overlapping.push_back(*it0);
-    while (it1 < end) {
-        if (*it1 >= *it0 + m) {
-            non_overlapping.push_back(*it1);
-            it0++;
-            it1++;
-        } else {
-            while (it1 < end && *it1 < *it0 + m) {
-                it1++;
-            }
-        }
-    }
-    return non_overlapping;
-}
-#endif
-
-// This is a bit slow. Should calculate and store this value when creating strings list
-size_t
-get_non_overlapping_count(const vector<offset_t>& offsets, size_t m) {
-    if (offsets.size() < 2) {
-        return offsets.size();
-    }
-
-    vector<offset_t>::const_iterator it0 = offsets.begin();
-    vector<offset_t>::const_iterator it1 = it0 + 1;
-    vector<offset_t>::const_iterator end = offsets.end();
-    size_t count = 1;
-
-    while (it1 < end) {
-        if (*it1 >= *it0 + m) {
-            count++;
-            it0++;
-            it1++;
-        } else {
-            while (it1 < end && *it1 < *it0 + m) {
-                it1++;
-            }
-        }
-    }
-    return count;
-}
-
-/*
- * Return Postings for term s + b if s + b is repeated a sufficient number of times in each document
- *  otherwise an empty Postings
- *  Caller must guarantee that s and b are valid (repeated a sufficient number of times in each document)
- *
- *  Params:
- *      inverted_index: The InvertedIndex
- *      term_postings_map: All Posting of current term length !@#$ Could get this from InvertedIndex
- *      s: A valid length m term
- *      b: A vaild length 1 term
- *  Returns:
- *      Offsets of all s + b Terms in the document
- */
-inline
-Postings
-get_sb_postings(const InvertedIndex *inverted_index,
-                const map<Term, Postings>& term_postings_map,
-                const Term& s, byte b) {
-
-    offset_t m = (offset_t)s.size();
-    const Postings& s_postings = term_postings_map.at(s);
-    const Postings& b_postings = inverted_index->_byte_postings_map.at(b);
-    Postings sb_postings;
-
-    const map<int, RequiredRepeats>& docs_map = inverted_index->_docs_map;
-    int n_bad = 0;
-    for (map<int, RequiredRepeats>::const_iterator it = docs_map.begin(); it != docs_map.end(); ++it) {
-        int doc_index = it->first;
-        const vector<offset_t>& s_offsets = s_postings._offsets_map.at(doc_index);
-        const vector<offset_t>& b_offsets = b_postings._offsets_map.at(doc_index);
-
-        vector<offset_t> sb_offsets = get_sb_offsets(s_offsets, m, b_offsets);
-
-        /*
-         * Only count non-overlapping offsets when checking validity.
-         *
-         * We can do this because any non-overlapping length m + 1 substring must
-         *  start with a non-overlapping length m substring.
-         *
-         * We CANNOT remove non-overlapping substrings of length m because
-         *  valid substrings of length m + 1 may start with length m
-         *  substrings may be overlapped byt other valid length m
-         *  substrings
-         *  e.g. looking for longest substring that appears twice in "aabcabcaa"
-         *           Non-overlapping     Overlapping
-         *      m=1: a:5, b:2, c:2       a:5, b:2, c:2
-         *      m=2: aa:2, bc:2, ca:2    aa:2, ab:2, bc:2, ca:2
-         *      m=3: none                abc:2
-         */
-        //sb_offsets = get_non_overlapping_strings(sb_offsets, m+1);
-
-        if (sb_offsets.size() < it->second._num
-                || get_non_overlapping_count(sb_offsets, m + 1) < it->second._num) {
-            n_bad++;
-            if (n_bad > inverted_index->_n_bad_allowed) {
-                // Empty map signals no match
-                return Postings();
-            }
-        }
-
-        sb_postings.add_offsets(doc_index, sb_offsets);
-    }
-
-#if VERBOSITY >= 3
-    cout << " matched '" << s + b + "' for " << sb_postings.size() << " docs" << endl;
-#endif
-    return sb_postings;
-}
-
 #if 0
 
 inline bool
@@ -350,6 +91,11 @@ get_longest_exact_matches(map<int, RequiredRepeats>& docs_map,
 
 // !@#$%
 
+// Set to 1 to drop terms that are part of printer patterns. See is_allowed_for_printer()
+#define PRINTER_FILTER 0
+
+#if PRINTER_FILTER
+
 const byte CDCA[] = {0xcd, 0xca, 0x10, 0x00, 0x00, 0x18, 0x00, 0x01, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 const byte PATTERN2[] = {0x00, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 const byte PATTERN3[] = {0x81, 0x22, 0x81, 0x22};
@@ -388,7 +134,6 @@ is_part_of_cdca(const Term& str) {
 static
 bool
 is_allowed_for_printer(const Term& str) {
-    return true;
 #if 1
     if (is_part_of_cdca(str)) {
         return false;
@@ -410,22 +155,27 @@ is_allowed_for_printer(const Term& str) {
 
     return false;
 }
+#endif // #if PRINTER_FILTER
 
-inline
+/*
+ * Return the terms in `terms` that are repeated exactly the required number of times in
+ *  every document. postings_list[id] is the Postings of term id of `terms`
+ */
+template <class Offset>
+static inline
 const vector<Term>
 get_exact_matches(const map<int, RequiredRepeats>& docs_map,
-                  const map<Term, Postings>& term_postings_map) {
+                  const TermStore& terms, const vector<PostingsT<Offset>>& postings_list) {
     vector<Term> exact_matches;
 
-     for (map<Term, Postings>::const_iterator it = term_postings_map.begin(); it != term_postings_map.end(); ++it) {
-        const Term& s = it->first;
-        const map<int, vector<offset_t>>& offsets_map = it->second._offsets_map;
+    const vector<TermId> ids = terms.sorted_ids();
+    for (vector<TermId>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+        const PostingsT<Offset>& postings = postings_list[*it];
         bool is_match = true;
-        for (map<int, vector<offset_t>>::const_iterator jt = offsets_map.begin(); jt != offsets_map.end(); ++jt) {
-            int d = jt->first;
+        for (int d = 0; d < (int)postings.num_docs(); d++) {
             const RequiredRepeats& rr = docs_map.at(d);
             // !@#$ Strictly, non-overlapping count, not size()
-            offset_t count = (offset_t)jt->second.size();
+            offset_t count = (offset_t)postings.doc_size(d);
             if (rr._num != count) {
                 is_match = false;
                 break;
@@ -433,12 +183,51 @@ get_exact_matches(const map<int, RequiredRepeats>& docs_map,
         }
 
         if (is_match) {
-            exact_matches.push_back(s);
+            exact_matches.push_back(terms.get_term(*it));
         }
     }
     return exact_matches;
 }
 
+/*
+ * A length m + 1 term s + b found by a worker in get_all_repeats()
+ */
+template <class Offset>
+struct Extension {
+    size_t _s_index;    // Index of s in valid_s_b
+    byte _b;
+    PostingsT<Offset> _postings;
+    Extension(size_t s_index, byte b, const PostingsT<Offset>& postings) :
+        _s_index(s_index), _b(b), _postings(postings) {}
+    bool operator<(const Extension& other) const {
+        return _s_index != other._s_index ? _s_index < other._s_index : _b < other._b;
+    }
+};
+
+/*
+ * Add the terms the workers found in `worker_extensions` to `m1_terms` and their Postings
+ *  to `m1_postings_list` in order of s then b
+ */
+template <class Offset>
+static
+void
+add_extensions(const vector<pair<TermId, vector<byte>>>& valid_s_b,
+               const vector<vector<Extension<Offset>>>& worker_extensions,
+               TermStore& m1_terms, vector<PostingsT<Offset>>& m1_postings_list) {
+    vector<Extension<Offset>> extensions;
+    for (typename vector<vector<Extension<Offset>>>::const_iterator it = worker_extensions.begin(); it != worker_extensions.end(); ++it) {
+        extensions.insert(extensions.end(), it->begin(), it->end());
+    }
+    sort(extensions.begin(), extensions.end());
+
+    for (typename vector<Extension<Offset>>::const_iterator it = extensions.begin(); it != extensions.end(); ++it) {
+        TermId s = valid_s_b[it->_s_index].first;
+        bool added;
+        m1_terms.add_extension(s, 0, it->_b, added);
+        m1_postings_list.push_back(it->_postings);
+    }
+}
+
 /*
  * Return the list of terms that are repeated a sufficient numbers of times in all documents
  *
@@ -459,23 +248,60 @@ get_exact_matches(const map<int, RequiredRepeats>& docs_map,
  *      will start decreasing when m is large enough
  *
  */
+template <class Offset>
+static
 RepeatsResults
-get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
+get_all_repeats_merge_t(InvertedIndex *inverted_index, size_t max_term_len) {
 
     // Postings Map of terms of length 1
-    const map<byte, Postings>& byte_postings_map = inverted_index->_byte_postings_map;
-
-    // Postings Map of terms of length m + 1 is constructed from from terms of length m
-    map<Term, Postings> term_postings_map = copy_map_byte_term(byte_postings_map);
+    const map<byte, PostingsT<Offset>>& byte_postings_map = get_byte_postings_map<Offset>(inverted_index);
+
+    // term_store_list[i] holds the valid terms of length i. The length m terms are kept
+    //  after pass m because the length m + 1 terms refer to them
+    vector<TermStore *> term_store_list(1, (TermStore *)0);
+    term_store_list.push_back(new TermStore(1, &term_store_list));
+
+    // The Postings of the valid length m terms. postings_list[id] is the Postings of term
+    //  id of term_store_list[m]. Length m + 1 terms are constructed from from length m terms
+    vector<PostingsT<Offset>> postings_list;
+    for (typename map<byte, PostingsT<Offset>>::const_iterator it = byte_postings_map.begin(); it != byte_postings_map.end(); ++it) {
+        term_store_list[1]->add_byte(it->first);
+        postings_list.push_back(it->second);
+    }
 
 #if VERBOSITY >= 1
     cout << "get_all_repeats: valid_bytes=" << byte_postings_map.size()
-         << ",repeated_strings=" << term_postings_map.size()
+         << ",repeated_strings=" << term_store_list[1]->size()
          << ",max_term_len=" << max_term_len
+         << ",threads=" << inverted_index->_thread_pool->num_workers()
          << endl;
 #endif
     const vector<byte> valid_bytes = get_keys_vector(byte_postings_map);
-    vector<Term> valid_terms = get_keys_vector(term_postings_map);
+
+    ThreadPool *thread_pool = inverted_index->_thread_pool;
+
+    // Each worker builds the Postings of the terms it extends in its own PostingsBuilder
+    //  and stores the ones that match in its own Arena
+    vector<PostingsBuilderT<Offset>> worker_builders(thread_pool->num_workers());
+
+    // The documents of each candidate are checked in doc_order, which is reordered after
+    //  each level by how often each document failed in it. See doc_order.h
+    DocOrder doc_order(inverted_index->_docs_map);
+    {
+        ScopedPhase phase("order");
+        estimate_doc_order(inverted_index, doc_order);
+    }
+    vector<DocScratch<Offset>> worker_scratch(thread_pool->num_workers());
+    for (typename vector<DocScratch<Offset>>::iterator it = worker_scratch.begin(); it != worker_scratch.end(); ++it) {
+        it->resize(doc_order.size());
+    }
+
+    // The Postings of length m terms are in level_arenas[m % 2] and the Postings of
+    //  length m + 1 terms are built in level_arenas[(m + 1) % 2], which held the length
+    //  m - 1 Postings. (The length 1 Postings are in the InvertedIndex)
+    LevelArena arena0(thread_pool->num_workers());
+    LevelArena arena1(thread_pool->num_workers());
+    LevelArena *level_arenas[2] = {&arena0, &arena1};
 
     // Track the last case of exact matches
     vector<Term> exact_matches;
@@ -485,14 +311,31 @@ get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
 
     bool show_exact_matches = false;
 
+    // Continue a search that was stopped from its last checkpoint. The resumed Postings
+    //  are in resume_arena. See checkpoint.h
+    offset_t m_start = 1;
+    Arena resume_arena;
+    if (inverted_index->_options._resume) {
+        ScopedPhase phase("resume");
+        vector<vector<PostingsT<Offset>>> resumed_postings_lists;
+        if (read_checkpoint(inverted_index, ENGINE_MERGE, max_term_len, term_store_list, resumed_postings_lists,
+                            resume_arena, m_start)) {
+            postings_list.swap(resumed_postings_lists[m_start]);
+            cout << "Resumed from checkpoint at len=" << m_start << endl;
+        }
+    }
+    double last_checkpoint = get_elapsed_time();
+
     // Each pass through this for loop builds offsets of substrings of length m + 1 from
     // offsets of substrings of length m
-    for (offset_t m = 1; m <= max_term_len; m++) {
+    for (offset_t m = m_start; m <= max_term_len; m++) {
+
+        const TermStore& terms = *term_store_list[m];
 
 #if TRACK_EXACT_MATCHES
         {   // Keep track of exact matches
             // We may need to backtrack to the longest exact match term
-            const vector<Term>& em = get_exact_matches(inverted_index->_docs_map, term_postings_map);
+            const vector<Term>& em = get_exact_matches(inverted_index->_docs_map, terms, postings_list);
             if (em.size() >= 3) {
                 show_exact_matches = true;
             }
@@ -505,15 +348,18 @@ get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
 #if VERBOSITY >= 1
         // Report progress to stdout
         cout << "--------------------------------------------------------------------------" << endl;
-        cout << "get_all_repeats: len=" << m << ", num valid terms=" << valid_terms.size()
+        cout << "get_all_repeats: len=" << m << ", num valid terms=" << terms.size()
              << ", time= " << get_elapsed_time() << endl;
 #endif
 #if VERBOSITY >= 2
-         for (int i = 0; i < min(3, (int)valid_terms.size()); i++) {
-            const Term& s = valid_terms[i];
-            //print_vector(term_to_string(s), term_postings_map[s].counts_per_doc());
+        {
+            const vector<TermId> ids = terms.sorted_ids();
+            vector<Term> valid_terms;
+            for (size_t i = 0; i < min((size_t)10, ids.size()); i++) {
+                valid_terms.push_back(terms.get_term(ids[i]));
+            }
+            print_vector("valid_terms", valid_terms, 10);
         }
-        print_vector("valid_terms", valid_terms, 10);
 #endif
         /*
          * Construct all possible length m + 1 terms from existing length m terms in valid_s_b
@@ -521,73 +367,170 @@ get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
          */
 
         /*
-         * valid_s_b[s][b] is later converted to s + b: s is length m, b is length 1
-         * valid_s_b[s][b] contains only s, b such that (s + b)[:-1] and (s + b)[1:]
-         * are elements of valid_terms
+         * valid_s_b[i] = (s, bytes) is later converted to s + b for b in bytes: s is length m,
+         * b is length 1. valid_s_b contains only s, b such that (s + b)[:-1] and (s + b)[1:]
+         * are valid terms
+         * (s + b)[1:] = s[1:] + b so the valid b for s are the bytes that extend s[1:] to a
+         * valid length m term. These are looked up by the suffix link of s
          */
-        map<Term, vector<byte>> valid_s_b;
-        for (vector<Term>::const_iterator is = valid_terms.begin(); is != valid_terms.end(); ++is) {
-            const Term& s = *is;
-            vector<byte> extension_bytes;
+        vector<pair<TermId, vector<byte>>> valid_s_b;
+        size_t num_valid_s_b = 0;
+        {
+            ScopedPhase phase("candidates", m);
+            // suffix_extension_bytes[u] = bytes b such that u + b is valid for length m - 1 terms u
+            vector<ByteSet> suffix_extension_bytes;
+            if (m > 1) {
+                terms.get_extension_bytes(suffix_extension_bytes);
+            }
+            ByteSet all_bytes;
             for (vector<byte>::const_iterator ib = valid_bytes.begin(); ib != valid_bytes.end(); ++ib) {
-                byte b = *ib;
-                if (binary_search(valid_terms.begin(), valid_terms.end(), slice(extend_term_byte(s, b), 1))) {
-                    extension_bytes.push_back(b);
-                }
+                all_bytes.set(*ib);
             }
-            if (extension_bytes.size() > 0) {
-                valid_s_b[s] = extension_bytes;
+
+            for (TermId s = 0; s < terms.size(); s++) {
+                TermId s_suffix;
+                if (!terms.find_suffix(s, s_suffix)) {
+                    continue;
+                }
+                // The suffix of a length 1 term is empty so all bytes are valid
+                const ByteSet& suffix_bytes = m > 1 ? suffix_extension_bytes[s_suffix] : all_bytes;
+                vector<byte> extension_bytes;
+                for (vector<byte>::const_iterator ib = valid_bytes.begin(); ib != valid_bytes.end(); ++ib) {
+                    byte b = *ib;
+                    if (suffix_bytes.test(b)) {
+                        extension_bytes.push_back(b);
+                    }
+                }
+                if (extension_bytes.size() > 0) {
+                    num_valid_s_b += extension_bytes.size();
+                    valid_s_b.push_back(make_pair(s, extension_bytes));
+                }
             }
         }
 
-        // Postings of length m + 1 terms
-        map<Term, Postings> term_m1_postings_map;
-
-        // Replace term_postings_map[s] with term_m1_postings_map[s + b] for all b in bytes that
-        // have survived the valid_s_b filtering above
+        // Replace Postings of s with Postings of s + b for all b in bytes that have survived
+        // the valid_s_b filtering above
         // This cannot increase total number of offsets as each s + b starts with s
-        for (map<Term, vector<byte>>::const_iterator iv = valid_s_b.begin(); iv != valid_s_b.end(); ++iv) {
-
-            const Term& s = iv->first;
-            const vector<byte>& bytes = iv->second;
-            for (vector<byte>::const_iterator ib = bytes.begin(); ib != bytes.end(); ++ib) {
-                byte b = *ib;
-                const Postings postings = get_sb_postings(inverted_index, term_postings_map, s, b);
-                if (postings.empty()) {
-                    continue;
+        //
+        // The s + b are independent so the s are shared out among the worker threads.
+        // Each worker records the s + b it finds and they are added to the length m + 1
+        // TermStore afterwards in valid_s_b order so that the TermIds don't depend on
+        // which worker handled which s
+        vector<vector<Extension<Offset>>> worker_extensions(thread_pool->num_workers());
+
+        LevelArena *m1_arena = level_arenas[(m + 1) % 2];
+        m1_arena->reset();
+
+        {
+            ScopedPhase phase("merge", m);
+
+            // If there are too few terms to keep the workers busy then extend the terms one at
+            // a time and share out the documents of each term among the workers instead
+            bool doc_parallel = inverted_index->_options._doc_parallel
+                             && valid_s_b.size() < (size_t)thread_pool->num_workers();
+            ThreadPool *doc_pool = doc_parallel ? thread_pool : 0;
+
+            auto extend_s = [&](size_t i, int worker) {
+                TermId s = valid_s_b[i].first;
+                const vector<byte>& bytes = valid_s_b[i].second;
+                vector<Extension<Offset>>& extensions = worker_extensions[worker];
+
+                for (vector<byte>::const_iterator ib = bytes.begin(); ib != bytes.end(); ++ib) {
+                    byte b = *ib;
+                    PostingsT<Offset> postings = get_sb_postings(inverted_index, postings_list[s], m, 0, b,
+                                                        worker_builders[worker], m1_arena->worker_arena(worker),
+                                                        doc_order, worker_scratch[worker], doc_pool);
+                    if (postings.empty()) {
+                        continue;
+                    }
+#if PRINTER_FILTER
+                    // Hand tuning!!
+                    if (!is_allowed_for_printer(extend_term_byte(terms.get_term(s), b))) {
+                       continue;
+                    }
+#endif
+                    extensions.push_back(Extension<Offset>(i, b, postings));
                 }
-                const Term s_b = extend_term_byte(s, b);
+            };
 
-                // Hand tuning!!
-                if (!is_allowed_for_printer(s_b)) {
-                   continue;
+            if (doc_parallel) {
+                for (size_t i = 0; i < valid_s_b.size(); i++) {
+                    extend_s(i, 0);
                 }
+            } else {
+                thread_pool->parallel_for(valid_s_b.size(), extend_s);
+            }
 
-                term_m1_postings_map[s_b] = postings;
+            for (int w = 0; w < (int)worker_scratch.size(); w++) {
+                doc_order.add_stats(worker_scratch[w]._stats);
             }
+            doc_order.reorder();
+#if VERBOSITY >= 2
+            cout << "doc order: " << doc_order.describe() << endl;
+#endif
+        }
+
+        // Length m + 1 terms and their Postings
+        TermStore *m1_terms = new TermStore(m + 1, &term_store_list);
+        vector<PostingsT<Offset>> m1_postings_list;
+        {
+            ScopedPhase phase("filter", m);
+            add_extensions(valid_s_b, worker_extensions, *m1_terms, m1_postings_list);
         }
 
 #if VERBOSITY >= 1
-        //print_vector("   valid_s_b", get_keys_vector(valid_s_b));
-        cout << valid_terms.size() << " terms * "
+        cout << terms.size() << " terms * "
              << valid_bytes.size() << " bytes = "
-             << valid_terms.size() * valid_bytes.size() << " ("
-             << get_map_vector_size(valid_s_b) << " valid) = "
-             << term_m1_postings_map.size() << " filtered"
+             << terms.size() * valid_bytes.size() << " ("
+             << num_valid_s_b << " valid) = "
+             << m1_terms->size() << " filtered"
              << endl;
+        cout << "postings arena: " << m1_arena->bytes_used() << " bytes used, "
+             << m1_arena->bytes_reserved() << " bytes reserved" << endl;
 #endif
 
         // If there are no matches then we were done in the last pass
-        if (term_m1_postings_map.size() == 0) {
+        if (m1_terms->size() == 0) {
+            delete m1_terms;
             converged = true;
             break;
         }
 
-        term_postings_map = term_m1_postings_map;
-        valid_terms = get_keys_vector(term_postings_map);
+        term_store_list.push_back(m1_terms);
+        postings_list.swap(m1_postings_list);
+
+        // The resumed Postings are only needed for the first level
+        resume_arena.release();
+
+        if (checkpoint_due(inverted_index, last_checkpoint)) {
+            ScopedPhase phase("checkpoint", m);
+            vector<const vector<PostingsT<Offset>> *> postings_levels(m + 2, 0);
+            postings_levels[m + 1] = &postings_list;
+            write_checkpoint(inverted_index, ENGINE_MERGE, max_term_len, m + 1, term_store_list, postings_levels);
+        }
+    }
+
+    vector<Term> valid_terms;
+    {
+        ScopedPhase phase("output");
+        const TermStore& terms = *term_store_list.back();
+        const vector<TermId> ids = terms.sorted_ids();
+        for (vector<TermId>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+            valid_terms.push_back(terms.get_term(*it));
+        }
+    }
+
+    for (vector<TermStore *>::iterator it = term_store_list.begin(); it != term_store_list.end(); ++it) {
+        delete *it;
     }
 
     return RepeatsResults(converged, valid_terms, exact_matches);
 }
 
-#endif // #if !TERM_IS_SEQUENCE
+RepeatsResults
+get_all_repeats_merge(InvertedIndex *inverted_index, size_t max_term_len) {
+    if (inverted_index->_wide_offsets) {
+        return get_all_repeats_merge_t<offset64_t>(inverted_index, max_term_len);
+    }
+    return get_all_repeats_merge_t<offset_t>(inverted_index, max_term_len);
+}
@@ -0,0 +1,380 @@
+#include "inverted_index.h"
+#include "inverted_index_int.h"
+
+/*
+ * Use a generalized suffix array to find the longest substring(s) that is repeated
+ *  a specified number of times in a corpus of documents.
+ *
+ * This is a separate search from find_best_strings.cpp, with its own definition of a
+ *  repeat. See RepeatsEngine and below. find_best_strings.cpp builds the valid terms of
+ *  length m + 1 from those of length m and takes a pass over the offsets per length.
+ *  On inputs with many long repeated substrings (see many_substrings.md) that is many
+ *  passes over many terms.
+ *
+ * Here the documents are concatenated into one text and its suffix array and LCP
+ *  array are built in linear time. The occurrences of each length k substring are
+ *  then a run of the suffix array where the LCPs are >= k (an LCP interval), so
+ *  whether any length k term is valid can be tested with one scan of the LCP array.
+ *  A term that is valid has valid prefixes, so the longest valid terms are found by
+ *  testing O(log(length)) lengths.
+ *
+ * The InvertedIndex has already read the documents and found the allowed bytes, the
+ *  bytes that occur often enough in all documents. The text is rebuilt from the byte
+ *  Postings with all other bytes replaced by separators, as no valid term contains
+ *  them.
+ *
+ * The results are NOT always the same as those of get_all_repeats_merge(). Here the
+ *  occurrences of a term in a document are counted as the largest number of them that
+ *  don't overlap. The merge engine counts them with get_non_overlapping_count(), which
+ *  can count overlapping occurrences, and requires every substring of a term to be valid
+ *  by that count, each with its own bad documents. The two counts are the same for terms
+ *  whose occurrences don't overlap. For periodic terms like "abababab" the merge count
+ *  can be higher, so the merge engine can return longer terms or terms that are not
+ *  returned here. With the counts here a substring of a valid term is always valid, which
+ *  is what the search by length relies on.
+ *
+ * Documentation in https://github.com/peterwilliams97/repeated_sequences
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <iostream>
+#include "mytypes.h"
+#include "utils.h"
+#include "timer.h"
+#include "suffix_array.h"
+#include "profiler.h"
+
+using namespace std;
+
+// Symbols of the suffix array text. Allowed byte b is SYM_BYTE + b
+#define SYM_SENTINEL 0      // End of text
+#define SYM_SEPARATOR 1     // End of each document and bytes that are not allowed
+#define SYM_BYTE 2
+#define SA_ALPHABET_SIZE (SYM_BYTE + ALPHABET_SIZE)
+
+// Number of chunks per worker that the suffix array is split into for each scan
+#define CHUNKS_PER_WORKER 4
+
+/*
+ * Generalized suffix array of all the documents in an InvertedIndex
+ */
+struct CorpusSuffixArray {
+    std::vector<int> _text;             // All documents, each followed by SYM_SEPARATOR
+    std::vector<int> _sa;               // Suffix array of _text
+    std::vector<int> _lcp;              // LCP array of _text
+    std::vector<size_t> _doc_starts;    // Document d is _text[_doc_starts[d], _doc_starts[d + 1] - 1)
+    std::vector<unsigned int> _nums;    // _nums[d] = number of times a term must be repeated in document d
+    int _n_bad_allowed;                 // Number of documents a term may have too few repeats in
+    size_t _min_group_size;             // Fewest occurrences a valid term can have
+
+    int size() const { return (int)_sa.size(); }
+};
+
+/*
+ * Build the text of `csa` from the byte Postings of `inverted_index`
+ *  Returns: false if the text is too big for 32 bit indexes
+ */
+static
+bool
+build_text(const InvertedIndex *inverted_index, CorpusSuffixArray& csa) {
+    ScopedPhase phase("build_text");
+
+    const map<byte, Postings>& byte_postings_map = inverted_index->_byte_postings_map;
+    const map<int, RequiredRepeats>& docs_map = inverted_index->_docs_map;
+    size_t n_docs = docs_map.size();
+
+    // A document ends after its last allowed byte. Anything after that can't be in a term
+    vector<size_t> doc_sizes(n_docs, 0);
+    for (map<byte, Postings>::const_iterator it = byte_postings_map.begin(); it != byte_postings_map.end(); ++it) {
+        const Postings& postings = it->second;
+        for (unsigned int d = 0; d < postings.num_docs() && d < n_docs; d++) {
+            OffsetSpan offsets = postings.doc_offsets(d);
+            if (!offsets.empty()) {
+                doc_sizes[d] = max(doc_sizes[d], (size_t)offsets[offsets.size() - 1] + 1);
+            }
+        }
+    }
+
+    csa._doc_starts.clear();
+    size_t n = 0;
+    for (size_t d = 0; d < n_docs; d++) {
+        csa._doc_starts.push_back(n);
+        n += doc_sizes[d] + 1;
+    }
+    csa._doc_starts.push_back(n);
+    n++;    // Sentinel
+
+    if (n >= (size_t)INT_MAX) {
+        cerr << "Corpus of " << n << " bytes is too big for the suffix array engine" << endl;
+        return false;
+    }
+
+    csa._text.assign(n, SYM_SEPARATOR);
+    csa._text[n - 1] = SYM_SENTINEL;
+
+    // The offsets of different bytes are different positions so the bytes can be
+    //  written in parallel
+    vector<map<byte, Postings>::const_iterator> byte_list;
+    for (map<byte, Postings>::const_iterator it = byte_postings_map.begin(); it != byte_postings_map.end(); ++it) {
+        byte_list.push_back(it);
+    }
+    inverted_index->_thread_pool->parallel_for(byte_list.size(), [&](size_t i, int) {
+        int sym = SYM_BYTE + byte_list[i]->first;
+        const Postings& postings = byte_list[i]->second;
+        for (unsigned int d = 0; d < postings.num_docs() && d < n_docs; d++) {
+            OffsetSpan offsets = postings.doc_offsets(d);
+            int *doc_text = &csa._text[csa._doc_starts[d]];
+            for (OffsetSpan::const_iterator it = offsets.begin(); it != offsets.end(); ++it) {
+                doc_text[*it] = sym;
+            }
+        }
+    }, 1);
+
+    return true;
+}
+
+/*
+ * Return true if the length k term at suffix `lb` is repeated often enough in enough
+ *  documents, where sa[lb .. rb) are all the occurrences of the term
+ *  The occurrences in each document are counted as the largest number that don't overlap,
+ *  taken greedily from the first. This can be less than get_non_overlapping_count() which
+ *  get_sb_postings() uses. See the top of this file
+ *  `positions` is scratch space
+ */
+static
+bool
+is_valid_group(const CorpusSuffixArray& csa, int lb, int rb, int k, vector<int>& positions) {
+
+    positions.assign(csa._sa.begin() + lb, csa._sa.begin() + rb);
+    sort(positions.begin(), positions.end());
+
+    // Documents are contiguous in _text so the sorted positions are grouped by document
+    vector<int>::const_iterator it = positions.begin();
+    int n_bad = 0;
+    for (size_t d = 0; d + 1 < csa._doc_starts.size(); d++) {
+        int doc_end = (int)csa._doc_starts[d + 1];
+        unsigned int count = 0;
+        int next = 0;
+        for (; it != positions.end() && *it < doc_end; ++it) {
+            if (count == 0 || *it >= next) {
+                count++;
+                next = *it + k;
+            }
+        }
+        if (count < csa._nums[d]) {
+            n_bad++;
+            if (n_bad > csa._n_bad_allowed) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Return true if the suffix at `pos` starts with k symbols that can be in a term
+ */
+static
+bool
+has_term_prefix(const CorpusSuffixArray& csa, int pos, int k) {
+    for (int i = pos; i < pos + k; i++) {
+        if (csa._text[i] < SYM_BYTE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Find the valid length k terms
+ *  The suffix array is split into chunks at LCP interval boundaries and the chunks
+ *  are scanned in parallel
+ *  Params:
+ *      csa: The suffix array
+ *      k: Length of terms
+ *      thread_pool: Runs the scan
+ *      groups: If not null, the start in the suffix array of each valid term's LCP
+ *          interval is appended to this in suffix array order. If null, the scan stops
+ *          at the first valid term
+ *  Returns: true if there are any valid length k terms
+ */
+static
+bool
+find_valid_terms(const CorpusSuffixArray& csa, int k, ThreadPool *thread_pool, vector<int> *groups) {
+
+    int n = csa.size();
+    const vector<int>& lcp = csa._lcp;
+
+    // Chunk c is sa[starts[c], starts[c + 1]). Each start is moved up to an LCP interval
+    //  boundary so no interval spans two chunks
+    size_t n_chunks = max((size_t)1, (size_t)thread_pool->num_workers() * CHUNKS_PER_WORKER);
+    vector<int> starts;
+    for (size_t c = 0; c < n_chunks; c++) {
+        int start = (int)((long long)n * c / n_chunks);
+        while (start > 0 && start < n && lcp[start] >= k) {
+            start++;
+        }
+        starts.push_back(start);
+    }
+    starts.push_back(n);
+
+    vector<vector<int>> chunk_groups(n_chunks);
+    vector<vector<int>> worker_positions(thread_pool->num_workers());
+    atomic<bool> found(false);
+
+    thread_pool->parallel_for(n_chunks, [&](size_t c, int worker) {
+        int begin = starts[c];
+        int end = max(begin, starts[c + 1]);
+        vector<int>& positions = worker_positions[worker];
+        int lb = begin;
+        for (int i = begin + 1; i <= end; i++) {
+            if (!groups && found) {
+                return;
+            }
+            if (i < end && lcp[i] >= k) {
+                continue;
+            }
+            // sa[lb .. i) are all the suffixes that start with the same length k term
+            if ((size_t)(i - lb) >= csa._min_group_size
+                    && (i - lb > 1 || has_term_prefix(csa, csa._sa[lb], k))
+                    && is_valid_group(csa, lb, i, k, positions)) {
+                found = true;
+                chunk_groups[c].push_back(lb);
+            }
+            lb = i;
+        }
+    }, 1);
+
+    if (groups) {
+        for (size_t c = 0; c < n_chunks; c++) {
+            groups->insert(groups->end(), chunk_groups[c].begin(), chunk_groups[c].end());
+        }
+    }
+    return found;
+}
+
+/*
+ * Return the length k term at position `pos` of the text
+ */
+static
+Term
+get_term(const CorpusSuffixArray& csa, int pos, int k) {
+    Term term;
+    for (int i = pos; i < pos + k; i++) {
+        term.push_back((byte)(csa._text[i] - SYM_BYTE));
+    }
+    return term;
+}
+
+/*
+ * Return the list of terms that are repeated a sufficient numbers of times in all documents
+ *  The results can differ from those of get_all_repeats_merge() for terms with
+ *  overlapping occurrences. See the top of this file
+ *  !@#$ Exact matches are not tracked
+ */
+RepeatsResults
+get_all_repeats_suffix_array(InvertedIndex *inverted_index, size_t max_term_len) {
+
+    const map<int, RequiredRepeats>& docs_map = inverted_index->_docs_map;
+    ThreadPool *thread_pool = inverted_index->_thread_pool;
+
+    // The longest terms the other engines can return are max_term_len + 1 long
+    int max_len = (int)max_term_len + 1;
+
+    if (docs_map.empty() || inverted_index->_byte_postings_map.empty()) {
+        return RepeatsResults(true, vector<Term>(), vector<Term>());
+    }
+
+    CorpusSuffixArray csa;
+    if (!build_text(inverted_index, csa)) {
+        return RepeatsResults(false, vector<Term>(), vector<Term>());
+    }
+    int n = (int)csa._text.size();
+
+    for (map<int, RequiredRepeats>::const_iterator it = docs_map.begin(); it != docs_map.end(); ++it) {
+        csa._nums.push_back(it->second._num);
+    }
+    csa._n_bad_allowed = inverted_index->_n_bad_allowed;
+
+    // A valid term has at least _nums[d] occurrences in all but _n_bad_allowed documents
+    vector<unsigned int> nums = csa._nums;
+    sort(nums.begin(), nums.end());
+    csa._min_group_size = 1;
+    if (csa._n_bad_allowed < (int)nums.size()) {
+        size_t total = 0;
+        for (size_t d = 0; d < nums.size() - csa._n_bad_allowed; d++) {
+            total += nums[d];
+        }
+        csa._min_group_size = max((size_t)1, total);
+    }
+
+#if VERBOSITY >= 1
+    cout << "get_all_repeats: suffix array of " << n << " symbols"
+         << ",docs=" << docs_map.size()
+         << ",max_term_len=" << max_term_len
+         << ",threads=" << thread_pool->num_workers()
+         << endl;
+#endif
+
+    {
+        ScopedPhase phase("suffix_array");
+        csa._sa.resize(n);
+        build_suffix_array(csa._text.data(), n, SA_ALPHABET_SIZE, csa._sa.data());
+    }
+    {
+        ScopedPhase phase("lcp");
+        build_lcp_array(csa._text.data(), n, csa._sa.data(), SYM_BYTE, csa._lcp);
+    }
+
+#if VERBOSITY >= 1
+    cout << "get_all_repeats: built suffix and LCP arrays, time= " << get_elapsed_time() << endl;
+#endif
+
+    auto is_valid_length = [&](int k) {
+        ScopedPhase phase("scan", k);
+        bool valid = find_valid_terms(csa, k, thread_pool, 0);
+#if VERBOSITY >= 1
+        cout << "get_all_repeats: len=" << k << ", valid=" << valid
+             << ", time= " << get_elapsed_time() << endl;
+#endif
+        return valid;
+    };
+
+    // Longest length with valid terms. A term's prefixes are valid if it is, so
+    //  gallop up the lengths then binary search
+    int best = 0;
+    if (is_valid_length(1)) {
+        int lo = 1;
+        int hi = 2;
+        while (hi <= max_len && is_valid_length(hi)) {
+            lo = hi;
+            hi *= 2;
+        }
+        hi = min(hi, max_len + 1);
+        // lo is valid and hi is not, or is past max_len
+        while (hi - lo > 1) {
+            int mid = lo + (hi - lo) / 2;
+            if (is_valid_length(mid)) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        best = lo;
+    }
+
+    vector<Term> valid_terms;
+    if (best > 0) {
+        ScopedPhase phase("output");
+        // The LCP intervals are in suffix array order which is lexicographic order
+        vector<int> groups;
+        find_valid_terms(csa, best, thread_pool, &groups);
+        for (vector<int>::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+            valid_terms.push_back(get_term(csa, csa._sa[*it], best));
+        }
+    }
+
+    return RepeatsResults(best < max_len, valid_terms, vector<Term>());
+}
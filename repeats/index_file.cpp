@@ -0,0 +1,300 @@
+/*
+ * Saving and mapping InvertedIndexes. See index_file.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include "index_file.h"
+#include "mapped_file.h"
+#include "inverted_index_int.h"
+
+using namespace std;
+
+// Return `pos` rounded up to the next 8 byte boundary
+inline
+uint64_t
+align8(uint64_t pos) {
+    return (pos + 7) & ~(uint64_t)7;
+}
+
+/*
+ * Write `n` zero bytes to `f`
+ */
+static
+void
+write_padding(FILE *f, size_t n) {
+    static const char zeros[8] = {0};
+    fwrite(zeros, 1, n, f);
+}
+
+/*
+ * Return true if there is no file at `path` or it starts like an index file, so that
+ *  write_index_file() doesn't replace a document that was given as the index path
+ */
+static
+bool
+can_replace(const string& path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return true;
+    }
+    uint64_t magic = 0;
+    size_t n = fread(&magic, sizeof(magic), 1, f);
+    fclose(f);
+    return n == 1 && magic == INDEX_FILE_MAGIC;
+}
+
+template <class Offset>
+static
+bool
+write_index_file_t(const InvertedIndex *inverted_index, const vector<RequiredRepeats>& required_repeats_list,
+                   size_t header_size, const string& path) {
+    const map<byte, PostingsT<Offset>>& byte_postings_map = get_byte_postings_map<Offset>(inverted_index);
+    const CorpusStats& stats = inverted_index->_stats;
+    size_t n_docs = required_repeats_list.size();
+
+    IndexFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header._magic = INDEX_FILE_MAGIC;
+    header._version = INDEX_FILE_VERSION;
+    header._offset_size = sizeof(Offset);
+    header._size_t_size = sizeof(size_t);
+    header._header_size = (uint32_t)header_size;
+    header._n_docs = n_docs;
+    header._n_allowed_bytes = byte_postings_map.size();
+    header._n_bytes = stats._n_bytes;
+    header._entropy = stats._entropy;
+    header._n_allowed_offsets = stats._n_allowed_offsets;
+    header._min_repeat_size = stats._min_repeat_size;
+    header._max_doc_size = stats._max_doc_size;
+
+    // The docs table and the names
+    vector<IndexFileDoc> docs(n_docs);
+    size_t names_size = 0;
+    for (size_t i = 0; i < n_docs; i++) {
+        const RequiredRepeats& rr = required_repeats_list[i];
+        docs[i]._num = rr._num;
+        docs[i]._size = rr._size;
+        docs[i]._mtime = MappedFile::get_mtime(rr._doc_name);
+        docs[i]._name_pos = names_size;
+        docs[i]._name_len = rr._doc_name.size();
+        names_size += rr._doc_name.size();
+    }
+
+    // The allowed bytes and where their offsets start
+    vector<IndexFileByte> bytes;
+    uint64_t n_offsets = 0;
+    for (typename map<byte, PostingsT<Offset>>::const_iterator it = byte_postings_map.begin();
+         it != byte_postings_map.end(); ++it) {
+        IndexFileByte ib;
+        ib._byte = it->first;
+        ib._offsets_begin = n_offsets;
+        bytes.push_back(ib);
+        n_offsets += it->second.size();
+    }
+
+    header._docs_pos = align8(sizeof(IndexFileHeader));
+    header._names_pos = header._docs_pos + n_docs * sizeof(IndexFileDoc);
+    header._bytes_pos = align8(header._names_pos + names_size);
+    header._ends_pos = header._bytes_pos + bytes.size() * sizeof(IndexFileByte);
+    header._offsets_pos = header._ends_pos + bytes.size() * n_docs * sizeof(size_t);
+    header._file_size = align8(header._offsets_pos + n_offsets * sizeof(Offset));
+
+    if (!can_replace(path)) {
+        cerr << path << " is not an index file. Not replacing it" << endl;
+        return false;
+    }
+
+    string temp_path = path + ".tmp";
+    FILE *f = fopen(temp_path.c_str(), "wb");
+    if (!f) {
+        cerr << "could not create " << temp_path << endl;
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, f);
+    write_padding(f, header._docs_pos - sizeof(header));
+    if (n_docs > 0) {
+        fwrite(docs.data(), sizeof(IndexFileDoc), n_docs, f);
+    }
+    for (size_t i = 0; i < n_docs; i++) {
+        const string& name = required_repeats_list[i]._doc_name;
+        fwrite(name.data(), 1, name.size(), f);
+    }
+    write_padding(f, header._bytes_pos - (header._names_pos + names_size));
+    if (!bytes.empty()) {
+        fwrite(bytes.data(), sizeof(IndexFileByte), bytes.size(), f);
+    }
+    for (typename map<byte, PostingsT<Offset>>::const_iterator it = byte_postings_map.begin();
+         it != byte_postings_map.end(); ++it) {
+        fwrite(it->second._doc_ends, sizeof(size_t), n_docs, f);
+    }
+    for (typename map<byte, PostingsT<Offset>>::const_iterator it = byte_postings_map.begin();
+         it != byte_postings_map.end(); ++it) {
+        if (it->second.size() > 0) {
+            fwrite(it->second._offsets, sizeof(Offset), it->second.size(), f);
+        }
+    }
+    write_padding(f, header._file_size - (header._offsets_pos + n_offsets * sizeof(Offset)));
+
+    bool ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    if (ok && rename(temp_path.c_str(), path.c_str()) != 0) {
+        // Windows won't rename over an existing file
+        remove(path.c_str());
+        ok = rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+    if (!ok) {
+        cerr << "could not write " << path << endl;
+        remove(temp_path.c_str());
+    }
+    return ok;
+}
+
+bool
+write_index_file(const InvertedIndex *inverted_index, const vector<RequiredRepeats>& required_repeats_list,
+                 size_t header_size, const string& path) {
+    if (inverted_index->_wide_offsets) {
+        return write_index_file_t<offset64_t>(inverted_index, required_repeats_list, header_size, path);
+    } else {
+        return write_index_file_t<offset_t>(inverted_index, required_repeats_list, header_size, path);
+    }
+}
+
+/*
+ * Return why the index file `data` of `size` bytes can't be used for the documents
+ *  `required_repeats_list`, or 0 if it can be
+ */
+static
+const char *
+check_index_file(const byte *data, size_t size, const vector<RequiredRepeats>& required_repeats_list,
+                 size_t header_size) {
+    if (size < sizeof(IndexFileHeader)) {
+        return "truncated";
+    }
+    const IndexFileHeader& header = *(const IndexFileHeader *)data;
+    if (header._magic != INDEX_FILE_MAGIC) {
+        return "not an index file";
+    }
+    if (header._version != INDEX_FILE_VERSION) {
+        return "from a different version";
+    }
+    if ((header._offset_size != sizeof(offset_t) && header._offset_size != sizeof(offset64_t))
+        || header._size_t_size != sizeof(size_t) || header._header_size != header_size) {
+        return "from a different build";
+    }
+    if (header._file_size != size) {
+        return "truncated";
+    }
+
+    const uint64_t n_docs = header._n_docs;
+    const uint64_t n_bytes = header._n_allowed_bytes;
+    if (n_docs != required_repeats_list.size()) {
+        return "for different documents";
+    }
+
+    // The sections must be in order and inside the file
+    if (n_bytes > ALPHABET_SIZE
+        || header._docs_pos < sizeof(IndexFileHeader)
+        || header._names_pos != header._docs_pos + n_docs * sizeof(IndexFileDoc)
+        || header._bytes_pos < header._names_pos
+        || header._ends_pos != header._bytes_pos + n_bytes * sizeof(IndexFileByte)
+        || header._offsets_pos != header._ends_pos + n_bytes * n_docs * sizeof(size_t)
+        || header._offsets_pos > size
+        || header._docs_pos % 8 != 0 || header._bytes_pos % 8 != 0) {
+        return "corrupt";
+    }
+
+    const IndexFileDoc *docs = (const IndexFileDoc *)(data + header._docs_pos);
+    const char *names = (const char *)(data + header._names_pos);
+    for (size_t i = 0; i < n_docs; i++) {
+        const RequiredRepeats& rr = required_repeats_list[i];
+        if (header._names_pos + docs[i]._name_pos + docs[i]._name_len > header._bytes_pos) {
+            return "corrupt";
+        }
+        if (docs[i]._num != rr._num || docs[i]._size != rr._size
+            || rr._doc_name.compare(0, string::npos, names + docs[i]._name_pos, docs[i]._name_len) != 0) {
+            return "for different documents";
+        }
+        if (docs[i]._mtime != MappedFile::get_mtime(rr._doc_name)) {
+            return "older than the documents";
+        }
+    }
+
+    // Each byte's offsets must fit in the offsets section
+    const IndexFileByte *bytes = (const IndexFileByte *)(data + header._bytes_pos);
+    const size_t *ends = (const size_t *)(data + header._ends_pos);
+    uint64_t n_offsets = (size - header._offsets_pos) / header._offset_size;
+    for (size_t k = 0; k < n_bytes; k++) {
+        uint64_t n = n_docs > 0 ? ends[k * n_docs + n_docs - 1] : 0;
+        if (bytes[k]._byte >= ALPHABET_SIZE || bytes[k]._offsets_begin + n > n_offsets) {
+            return "corrupt";
+        }
+    }
+    return 0;
+}
+
+/*
+ * Point the PostingsT<Offset>s in `byte_postings_map` at the byte Postings in the index
+ *  file `data` that has passed check_index_file()
+ */
+template <class Offset>
+static
+void
+map_byte_postings(const byte *data, map<byte, PostingsT<Offset>>& byte_postings_map) {
+    const IndexFileHeader& header = *(const IndexFileHeader *)data;
+    const IndexFileByte *bytes = (const IndexFileByte *)(data + header._bytes_pos);
+    const size_t *ends = (const size_t *)(data + header._ends_pos);
+    const Offset *offsets = (const Offset *)(data + header._offsets_pos);
+    for (size_t k = 0; k < header._n_allowed_bytes; k++) {
+        byte_postings_map[(byte)bytes[k]._byte] = PostingsT<Offset>(offsets + bytes[k]._offsets_begin,
+                                                                    ends + k * header._n_docs,
+                                                                    (unsigned int)header._n_docs);
+    }
+}
+
+bool
+load_index_file(InvertedIndex *inverted_index, const vector<RequiredRepeats>& required_repeats_list,
+                size_t header_size, const string& path) {
+    // get_mtime() rather than get_size() as it doesn't complain about missing files
+    if (MappedFile::get_mtime(path) == 0) {
+        return false;
+    }
+
+    MappedFile& file = inverted_index->_index_file;
+    if (!file.open(path)) {
+        return false;
+    }
+    const char *problem = check_index_file(file.data(), file.size(), required_repeats_list, header_size);
+    if (problem) {
+        cerr << "Index file " << path << " is " << problem << ". Rebuilding it" << endl;
+        file.close();
+        return false;
+    }
+
+    const byte *data = file.data();
+    const IndexFileHeader& header = *(const IndexFileHeader *)data;
+    const IndexFileByte *bytes = (const IndexFileByte *)(data + header._bytes_pos);
+
+    inverted_index->_allowed_bytes.clear();
+    for (size_t k = 0; k < header._n_allowed_bytes; k++) {
+        inverted_index->_allowed_bytes.insert((byte)bytes[k]._byte);
+    }
+
+    CorpusStats& stats = inverted_index->_stats;
+    stats._n_bytes = header._n_bytes;
+    stats._entropy = header._entropy;
+    stats._n_allowed_bytes = header._n_allowed_bytes;
+    stats._n_allowed_offsets = header._n_allowed_offsets;
+    stats._min_repeat_size = header._min_repeat_size;
+    stats._max_doc_size = header._max_doc_size;
+
+    inverted_index->_wide_offsets = header._offset_size == sizeof(offset64_t);
+    if (inverted_index->_wide_offsets) {
+        map_byte_postings(data, inverted_index->_byte_postings_map64);
+    } else {
+        map_byte_postings(data, inverted_index->_byte_postings_map);
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+#ifndef INDEX_FILE_H
+#define INDEX_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+/*
+ * An InvertedIndex saved to a file so that later runs on the same corpus can map it
+ *  instead of reading and scattering all the documents again. See RepeatsOptions::_index_path
+ *
+ * Only what create_inverted_index() computes from the documents is saved: the docs
+ *  table, _allowed_bytes, the CorpusStats and the byte Postings. _n_bad_allowed and the
+ *  other RepeatsOptions are not, so one index file serves runs with any of them.
+ *
+ * The file is laid out so that the byte Postings can point straight into the mapped
+ *  file. All sections start on 8 byte boundaries
+ *      IndexFileHeader
+ *      IndexFileDoc[_n_docs]               the docs table, in _docs_map order
+ *      char[]                              the document names, concatenated
+ *      IndexFileByte[_n_allowed_bytes]     the allowed bytes, smallest first
+ *      size_t[_n_allowed_bytes][_n_docs]   the _doc_ends of each allowed byte's Postings
+ *      Offset[]                            the _offsets of each allowed byte's Postings,
+ *                                          concatenated. Offset is offset_t or offset64_t
+ *
+ * An index file is only used if it was written by a build with the same file format,
+ *  offset types and HEADER_SIZE, and for the same documents with the same sizes and
+ *  modification times. Otherwise the index is built from the documents and the file is
+ *  rewritten. The file is in the byte order of the machine that wrote it, and
+ *  IndexFileHeader::_magic reads differently in the other byte order.
+ *
+ * Expected usage
+ * ---------------
+ *  if (!load_index_file(inverted_index, required_repeats_list, header_size, path)) {
+ *      // build inverted_index from the documents
+ *      write_index_file(inverted_index, required_repeats_list, header_size, path);
+ *  }
+ */
+
+// "RPTINDEX" as a little endian uint64_t
+#define INDEX_FILE_MAGIC 0x5845444e49545052ULL
+
+// Increment this whenever the layout changes
+#define INDEX_FILE_VERSION 1
+
+struct IndexFileHeader {
+    uint64_t _magic;                // INDEX_FILE_MAGIC
+    uint32_t _version;              // INDEX_FILE_VERSION
+    uint32_t _offset_size;          // sizeof(Offset) of the byte Postings: 4 or 8
+    uint32_t _size_t_size;          // sizeof(size_t) of the _doc_ends
+    uint32_t _header_size;          // Bytes skipped at the start of each document. HEADER_SIZE
+    uint64_t _file_size;            // Size of the whole file. Catches truncated files
+    uint64_t _n_docs;
+    uint64_t _n_allowed_bytes;
+
+    // The CorpusStats of the InvertedIndex, apart from _n_allowed_bytes
+    uint64_t _n_bytes;
+    double _entropy;
+    uint64_t _n_allowed_offsets;
+    double _min_repeat_size;
+    uint64_t _max_doc_size;
+
+    // Start of each section, in bytes from the start of the file
+    uint64_t _docs_pos;
+    uint64_t _names_pos;
+    uint64_t _bytes_pos;
+    uint64_t _ends_pos;
+    uint64_t _offsets_pos;
+};
+
+struct IndexFileDoc {
+    uint64_t _num;                  // RequiredRepeats::_num
+    uint64_t _size;                 // RequiredRepeats::_size
+    int64_t _mtime;                 // Modification time when the index was built. See MappedFile::get_mtime()
+    uint64_t _name_pos;             // Start of the document's name in the names section
+    uint64_t _name_len;
+};
+
+struct IndexFileByte {
+    uint64_t _byte;
+    uint64_t _offsets_begin;        // Index in the offsets section of the byte's first offset
+};
+
+struct InvertedIndex;
+
+/*
+ * Point the byte Postings of `inverted_index` into index file `path` and fill in the rest
+ *  of what create_inverted_index() computes from the documents. The file stays mapped
+ *  in inverted_index->_index_file
+ *  Params:
+ *      required_repeats_list: The documents the index is for
+ *      header_size: Bytes skipped at the start of each document
+ *  Returns: false if there is no index file at `path` or it is for different documents
+ *           or a different build. `inverted_index` is unchanged then
+ */
+bool load_index_file(InvertedIndex *inverted_index, const std::vector<RequiredRepeats>& required_repeats_list,
+                     size_t header_size, const std::string& path);
+
+/*
+ * Write the byte Postings and the rest of what create_inverted_index() computed from the
+ *  documents `required_repeats_list` in `inverted_index` to index file `path`. The file
+ *  is written to a temporary file beside it and renamed so that readers never see a
+ *  partial file
+ *  Returns: false if the file can't be written
+ */
+bool write_index_file(const InvertedIndex *inverted_index, const std::vector<RequiredRepeats>& required_repeats_list,
+                      size_t header_size, const std::string& path);
+
+#endif // #ifndef INDEX_FILE_H
@@ -0,0 +1,506 @@
+/*
+ * Sorted offset list intersection kernels for get_sb_offsets()
+ *
+ * All kernels write their results to a buffer with room for the shorter list
+ *  plus one block, so the inner loops store unconditionally and advance the
+ *  output pointer by the match flag instead of branching on matches.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+#include "intersect.h"
+#include "packed_offsets.h"
+#include "cpu_features.h"
+
+#if HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// INTERSECT_AUTO gallops when one list is this many times longer than the other.
+// The block kernel keeps up with galloping to higher ratios than merging does.
+// See bench/intersect_bench.cpp
+#define GALLOP_RATIO_MERGE 32
+#define GALLOP_RATIO_BLOCK 128
+
+// Number of offsets compared at a time by intersect_block()
+#define BLOCK_SIZE 8
+
+// intersect_offsets_count() intersects the shorter list this many offsets at a time. The
+//  matches of each 16 KB chunk are counted while they are still in L1
+#define COUNT_CHUNK_SIZE 4096
+
+static const char *INTERSECT_METHOD_NAMES[NUM_INTERSECT_METHODS] = {
+    "auto",
+    "merge",
+    "gallop",
+    "block"
+};
+
+const char *
+get_intersect_method_name(IntersectMethod method) {
+    return (0 <= method && method < NUM_INTERSECT_METHODS) ? INTERSECT_METHOD_NAMES[method] : "unknown";
+}
+
+/*
+ * Walk through s and b keeping them aligned as follows
+ *  b offset == end of s offset => save s offset as it is an s + b offset
+ *  b offset <= end of s offset => advance b offset
+ *  b offset >= end of s offset => advance s offset
+ *  Returns: pointer past the last offset written to `out`
+ */
+template <class Offset>
+static Offset *
+intersect_merge(const Offset *s, const Offset *s_end, Offset m,
+                const Offset *b, const Offset *b_end, Offset *out) {
+    while (s != s_end && b != b_end) {
+        Offset s_m = *s + m;
+        Offset b_v = *b;
+        *out = *s;
+        out += (s_m == b_v);
+        s += (s_m <= b_v);
+        b += (b_v <= s_m);
+    }
+    return out;
+}
+
+/*
+ * Return the first i in [lo, n) with a[i] >= val, or n if there is none
+ *  Step exponentially from lo to bracket val then binary search the bracket, so
+ *  the cost is logarithmic in the distance from lo rather than in n
+ */
+template <class Offset>
+inline
+size_t
+gallop(const Offset *a, size_t lo, size_t n, Offset val) {
+    if (lo >= n || a[lo] >= val) {
+        return lo;
+    }
+    // Invariant: a[lo] < val
+    size_t step = 1;
+    size_t hi = lo + 1;
+    while (hi < n && a[hi] < val) {
+        lo = hi;
+        step <<= 1;
+        hi = lo + step;
+    }
+    if (hi > n) {
+        hi = n;
+    }
+    return lower_bound(a + lo + 1, a + hi, val) - a;
+}
+
+/*
+ * Intersection for the case where one list is much shorter than the other
+ *  Gallop through the longer list for each offset in the shorter list
+ *  Returns: pointer past the last offset written to `out`
+ */
+template <class Offset>
+static Offset *
+intersect_gallop(const Offset *s, size_t n_s, Offset m, const Offset *b, size_t n_b, Offset *out) {
+    if (n_s <= n_b) {
+        size_t j = 0;
+        for (size_t i = 0; i < n_s && j < n_b; i++) {
+            Offset s_m = s[i] + m;
+            j = gallop(b, j, n_b, s_m);
+            if (j < n_b && b[j] == s_m) {
+                *out++ = s[i];
+                j++;
+            }
+        }
+    } else {
+        // b offsets < m can't be the end of an s + b term
+        size_t j = lower_bound(b, b + n_b, m) - b;
+        size_t i = 0;
+        for (; j < n_b && i < n_s; j++) {
+            Offset b_m = b[j] - m;
+            i = gallop(s, i, n_s, b_m);
+            if (i < n_s && s[i] == b_m) {
+                *out++ = b_m;
+                i++;
+            }
+        }
+    }
+    return out;
+}
+
+#if HAVE_X86_SIMD
+
+/*
+ * Permutations that move the selected elements of a vector of 8 offsets to its
+ *  start. _perms[mask] selects the elements for the set bits of mask
+ */
+struct CompressTable {
+    int32_t _perms[1 << BLOCK_SIZE][BLOCK_SIZE];
+
+    CompressTable() {
+        memset(_perms, 0, sizeof(_perms));
+        for (int mask = 0; mask < (1 << BLOCK_SIZE); mask++) {
+            int n = 0;
+            for (int k = 0; k < BLOCK_SIZE; k++) {
+                if (mask & (1 << k)) {
+                    _perms[mask][n++] = k;
+                }
+            }
+        }
+    }
+};
+
+static const CompressTable _compress_table;
+
+/*
+ * Intersection of lists of similar length
+ *  Compare each block of 8 s + m offsets with all 8 offsets in a block of b, by
+ *  comparing it with the 8 rotations of the b block, and store the s offsets that
+ *  matched. Then advance whichever block ends lower, or both if they end at the
+ *  same offset. The tails are merged
+ *  Returns: pointer past the last offset written to `out`
+ */
+TARGET_AVX2
+static offset_t *
+intersect_block_avx2(const offset_t *s, const offset_t *s_end, offset_t m,
+                     const offset_t *b, const offset_t *b_end, offset_t *out) {
+    const __m256i vm = _mm256_set1_epi32((int)m);
+
+    while (s + BLOCK_SIZE <= s_end && b + BLOCK_SIZE <= b_end) {
+        __m256i vs = _mm256_loadu_si256((const __m256i *)s);
+        __m256i vs_m = _mm256_add_epi32(vs, vm);
+        __m256i vb = _mm256_loadu_si256((const __m256i *)b);
+        // vb_x has the two 128 bit halves of vb swapped
+        __m256i vb_x = _mm256_permute2x128_si256(vb, vb, 1);
+
+        __m256i eq = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi32(vs_m, vb),
+                _mm256_cmpeq_epi32(vs_m, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi32(vs_m, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                _mm256_cmpeq_epi32(vs_m, _mm256_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        eq = _mm256_or_si256(eq,
+            _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi32(vs_m, vb_x),
+                    _mm256_cmpeq_epi32(vs_m, _mm256_shuffle_epi32(vb_x, _MM_SHUFFLE(0, 3, 2, 1)))),
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi32(vs_m, _mm256_shuffle_epi32(vb_x, _MM_SHUFFLE(1, 0, 3, 2))),
+                    _mm256_cmpeq_epi32(vs_m, _mm256_shuffle_epi32(vb_x, _MM_SHUFFLE(2, 1, 0, 3))))));
+
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (mask) {
+            __m256i perm = _mm256_loadu_si256((const __m256i *)_compress_table._perms[mask]);
+            _mm256_storeu_si256((__m256i *)out, _mm256_permutevar8x32_epi32(vs, perm));
+            out += _mm_popcnt_u32(mask);
+        }
+
+        offset_t s_max = s[BLOCK_SIZE - 1] + m;
+        offset_t b_max = b[BLOCK_SIZE - 1];
+        if (s_max <= b_max) {
+            s += BLOCK_SIZE;
+        }
+        if (b_max <= s_max) {
+            b += BLOCK_SIZE;
+        }
+    }
+    return intersect_merge(s, s_end, m, b, b_end, out);
+}
+
+#endif // #if HAVE_X86_SIMD
+
+static offset_t *
+intersect_block(const offset_t *s, const offset_t *s_end, offset_t m,
+                const offset_t *b, const offset_t *b_end, offset_t *out) {
+#if HAVE_X86_SIMD
+    if (get_cpu_isa() >= ISA_AVX2) {
+        return intersect_block_avx2(s, s_end, m, b, b_end, out);
+    }
+#endif
+    return intersect_merge(s, s_end, m, b, b_end, out);
+}
+
+// There is no block kernel for 64 bit offsets. Documents this large are rare and the
+//  merge is memory bound for them
+static offset64_t *
+intersect_block(const offset64_t *s, const offset64_t *s_end, offset64_t m,
+                const offset64_t *b, const offset64_t *b_end, offset64_t *out) {
+    return intersect_merge(s, s_end, m, b, b_end, out);
+}
+
+template <class Offset>
+static void
+intersect_offsets_t(const Offset *s, size_t n_s, Offset m, const Offset *b, size_t n_b,
+                    vector<Offset>& sb_offsets, IntersectMethod method) {
+    if (n_s == 0 || n_b == 0) {
+        return;
+    }
+
+    if (method == INTERSECT_AUTO) {
+        bool have_block = sizeof(Offset) == sizeof(offset_t) && get_cpu_isa() >= ISA_AVX2;
+        size_t gallop_ratio = have_block ? GALLOP_RATIO_BLOCK : GALLOP_RATIO_MERGE;
+        if (n_s >= gallop_ratio * n_b || n_b >= gallop_ratio * n_s) {
+            method = INTERSECT_GALLOP;
+        } else {
+            method = INTERSECT_BLOCK;
+        }
+    }
+
+    // Room for every offset of the shorter list plus a whole block of stores
+    size_t n_old = sb_offsets.size();
+    sb_offsets.resize(n_old + min(n_s, n_b) + BLOCK_SIZE);
+
+    Offset *out = sb_offsets.data() + n_old;
+    Offset *out_end;
+
+    switch (method) {
+    case INTERSECT_GALLOP:
+        out_end = intersect_gallop(s, n_s, m, b, n_b, out);
+        break;
+    case INTERSECT_BLOCK:
+        out_end = intersect_block(s, s + n_s, m, b, b + n_b, out);
+        break;
+    default:
+        out_end = intersect_merge(s, s + n_s, m, b, b + n_b, out);
+    }
+
+    sb_offsets.resize(n_old + (out_end - out));
+}
+
+void
+intersect_offsets(const offset_t *s, size_t n_s, offset_t m, const offset_t *b, size_t n_b,
+                  vector<offset_t>& sb_offsets, IntersectMethod method) {
+    intersect_offsets_t(s, n_s, m, b, n_b, sb_offsets, method);
+}
+
+void
+intersect_offsets(const offset64_t *s, size_t n_s, offset64_t m, const offset64_t *b, size_t n_b,
+                  vector<offset64_t>& sb_offsets, IntersectMethod method) {
+    intersect_offsets_t(s, n_s, m, b, n_b, sb_offsets, method);
+}
+
+/*
+ * Return the first i in [0, n) with a[i] > val, or n if there is none
+ *  Unlike gallop(a, 0, n, val + 1) this can't overflow
+ */
+template <class Offset>
+inline
+size_t
+gallop_past(const Offset *a, size_t n, Offset val) {
+    size_t i = gallop(a, 0, n, val);
+    return (i < n && a[i] == val) ? i + 1 : i;
+}
+
+/*
+ * get_non_overlapping_count() of the offsets appended to a vector, updated as they
+ *  are appended. _i0 and _next are the it0 and it1 of get_non_overlapping_count_t(), so
+ *  this is the same upper bound on the number of non-overlapping terms, not a greedy count
+ */
+template <class Offset>
+struct NonOverlapCounter {
+    size_t _begin;  // Index of the first offset to count
+    size_t _i0;     // Index of the offset the next one must not overlap
+    size_t _next;   // Index of the next offset to count
+    size_t _m;      // Length of the terms
+    size_t _count;
+
+    NonOverlapCounter(size_t begin, size_t m) : _begin(begin), _i0(begin), _next(begin), _m(m), _count(0) {}
+
+    // Count the offsets appended to `offsets` since the last update()
+    void update(const vector<Offset>& offsets) {
+        const Offset *a = offsets.data();
+        size_t end = offsets.size();
+        if (_next == _begin && _next < end) {
+            _count = 1;
+            _next++;
+        }
+        size_t i0 = _i0;
+        size_t count = _count;
+        for (size_t i = _next; i < end; i++) {
+            if (a[i] >= a[i0] + _m) {
+                count++;
+                i0++;
+            }
+        }
+        _i0 = i0;
+        _count = count;
+        _next = end;
+    }
+};
+
+/*
+ * intersect_offsets_count() with the shorter list split into chunks of COUNT_CHUNK_SIZE
+ *  offsets. The matches of each chunk are counted while they are in cache
+ */
+template <class Offset>
+static size_t
+intersect_offsets_count_t(const Offset *s, size_t n_s, Offset m, const Offset *b, size_t n_b,
+                          size_t len, size_t num, vector<Offset>& sb_offsets) {
+    NonOverlapCounter<Offset> counter(sb_offsets.size(), len);
+    if (min(n_s, n_b) <= COUNT_CHUNK_SIZE) {
+        intersect_offsets_t(s, n_s, m, b, n_b, sb_offsets, INTERSECT_AUTO);
+        counter.update(sb_offsets);
+        return counter._count;
+    }
+
+    const Offset *s_end = s + n_s;
+    const Offset *b_end = b + n_b;
+    if (n_s <= n_b) {
+        for (; s != s_end && b != b_end; ) {
+            const Offset *s_chunk_end = s + min((size_t)COUNT_CHUNK_SIZE, (size_t)(s_end - s));
+            b += gallop(b, 0, b_end - b, *s + m);
+            const Offset *b_chunk_end = b + gallop_past(b, b_end - b, s_chunk_end[-1] + m);
+            intersect_offsets_t(s, s_chunk_end - s, m, b, b_chunk_end - b, sb_offsets, INTERSECT_AUTO);
+            s = s_chunk_end;
+            b = b_chunk_end;
+            counter.update(sb_offsets);
+
+            // Each further s + b offset needs one of the remaining s and b offsets
+            if (counter._count + min(s_end - s, b_end - b) < num) {
+                break;
+            }
+        }
+    } else {
+        // b offsets < m can't be the end of an s + b term
+        b = lower_bound(b, b_end, m);
+        for (; s != s_end && b != b_end; ) {
+            const Offset *b_chunk_end = b + min((size_t)COUNT_CHUNK_SIZE, (size_t)(b_end - b));
+            s += gallop(s, 0, s_end - s, *b - m);
+            const Offset *s_chunk_end = s + gallop_past(s, s_end - s, b_chunk_end[-1] - m);
+            intersect_offsets_t(s, s_chunk_end - s, m, b, b_chunk_end - b, sb_offsets, INTERSECT_AUTO);
+            s = s_chunk_end;
+            b = b_chunk_end;
+            counter.update(sb_offsets);
+
+            if (counter._count + min(s_end - s, b_end - b) < num) {
+                break;
+            }
+        }
+    }
+    return counter._count;
+}
+
+size_t
+intersect_offsets_count(const offset_t *s, size_t n_s, offset_t m, const offset_t *b, size_t n_b,
+                        size_t len, size_t num, vector<offset_t>& sb_offsets) {
+    return intersect_offsets_count_t(s, n_s, m, b, n_b, len, num, sb_offsets);
+}
+
+size_t
+intersect_offsets_count(const offset64_t *s, size_t n_s, offset64_t m, const offset64_t *b, size_t n_b,
+                        size_t len, size_t num, vector<offset64_t>& sb_offsets) {
+    return intersect_offsets_count_t(s, n_s, m, b, n_b, len, num, sb_offsets);
+}
+
+template <class Offset>
+static size_t
+intersect_offsets_bound_t(const Offset *s, size_t n_s, Offset m, const Offset *b, size_t n_b) {
+    if (n_s == 0 || n_b == 0) {
+        return 0;
+    }
+    // The b offsets that can end an s + b term
+    size_t b_lo = gallop(b, 0, n_b, s[0] + m);
+    size_t b_hi = b_lo + gallop_past(b + b_lo, n_b - b_lo, s[n_s - 1] + m);
+    if (b_lo == b_hi) {
+        return 0;
+    }
+    // The s offsets that can start one
+    size_t s_lo = gallop(s, 0, n_s, b[b_lo] - m);
+    size_t s_hi = s_lo + gallop_past(s + s_lo, n_s - s_lo, b[b_hi - 1] - m);
+    return min(s_hi - s_lo, b_hi - b_lo);
+}
+
+size_t
+intersect_offsets_bound(const offset_t *s, size_t n_s, offset_t m, const offset_t *b, size_t n_b) {
+    return intersect_offsets_bound_t(s, n_s, m, b, n_b);
+}
+
+size_t
+intersect_offsets_bound(const offset64_t *s, size_t n_s, offset64_t m, const offset64_t *b, size_t n_b) {
+    return intersect_offsets_bound_t(s, n_s, m, b, n_b);
+}
+
+size_t
+intersect_packed_offsets_bound(const offset_t *s_packed, offset_t m, const offset_t *b, size_t n_b) {
+    if (packed_offsets_raw(s_packed)) {
+        return intersect_offsets_bound(s_packed + 1, packed_offsets_count(s_packed), m, b, n_b);
+    }
+    // The last s offset is not known without decoding the last block so only the first
+    //  bounds the b offsets
+    size_t n_s = packed_offsets_count(s_packed);
+    size_t b_lo = gallop(b, 0, n_b, packed_block_first(s_packed, 0) + m);
+    return min(n_s, n_b - b_lo);
+}
+
+size_t
+intersect_packed_offsets(const offset_t *s_packed, offset_t m, const offset_t *b, size_t n_b,
+                         size_t len, size_t num, vector<offset_t>& sb_offsets) {
+    if (packed_offsets_raw(s_packed)) {
+        return intersect_offsets_count(s_packed + 1, packed_offsets_count(s_packed), m, b, n_b,
+                                       len, num, sb_offsets);
+    }
+    NonOverlapCounter<offset_t> counter(sb_offsets.size(), len);
+    size_t n = packed_offsets_count(s_packed);
+    size_t n_blocks = packed_offsets_blocks(s_packed);
+    const offset_t *b_end = b + n_b;
+    offset_t s[PACK_BLOCK_SIZE];
+
+    for (size_t k = 0; k < n_blocks && b != b_end; k++) {
+        // The s + m of block k are >= its first offset + m and < the next block's
+        b += gallop(b, 0, b_end - b, packed_block_first(s_packed, k) + m);
+        if (b == b_end) {
+            break;
+        }
+        if (k + 1 < n_blocks && *b >= packed_block_first(s_packed, k + 1) + m) {
+            continue;
+        }
+        size_t n_s = unpack_block(s_packed, k, s);
+        const offset_t *b_block_end = b + gallop_past(b, b_end - b, s[n_s - 1] + m);
+        intersect_offsets(s, n_s, m, b, b_block_end - b, sb_offsets);
+        b = b_block_end;
+        counter.update(sb_offsets);
+
+        size_t n_left = min(n - min(n, (k + 1) * PACK_BLOCK_SIZE), (size_t)(b_end - b));
+        if (counter._count + n_left < num) {
+            break;
+        }
+    }
+    return counter._count;
+}
+
+// The engines count while merging with intersect_offsets_count() instead of calling this.
+//  it0 moves on by one offset per count, not to it1. See intersect.h
+template <class Offset>
+static size_t
+get_non_overlapping_count_t(const Offset *offsets, size_t n, size_t m) {
+    if (n < 2) {
+        return n;
+    }
+
+    const Offset *it0 = offsets;
+    const Offset *it1 = it0 + 1;
+    const Offset *end = offsets + n;
+    size_t count = 1;
+
+    while (it1 < end) {
+        if (*it1 >= *it0 + m) {
+            count++;
+            it0++;
+            it1++;
+        } else {
+            while (it1 < end && *it1 < *it0 + m) {
+                it1++;
+            }
+        }
+    }
+    return count;
+}
+
+size_t
+get_non_overlapping_count(const offset_t *offsets, size_t n, size_t m) {
+    return get_non_overlapping_count_t(offsets, n, m);
+}
+
+size_t
+get_non_overlapping_count(const offset64_t *offsets, size_t n, size_t m) {
+    return get_non_overlapping_count_t(offsets, n, m);
+}
@@ -0,0 +1,116 @@
+#ifndef INTERSECT_H
+#define INTERSECT_H
+
+#include <vector>
+#include "mytypes.h"
+
+/*
+ * Kernels for the inner loop of the repeat search: find the offsets s in a
+ *  document's s_offsets for which s + m is in its b_offsets
+ *
+ * Both lists are strictly increasing so this is an intersection of two sorted
+ *  sets, one of them shifted by m.
+ */
+
+// The ways of intersecting offset lists
+enum IntersectMethod {
+    INTERSECT_AUTO = 0,     // Pick the fastest method for the list sizes and the CPU
+    INTERSECT_MERGE,        // Walk both lists in step
+    INTERSECT_GALLOP,       // Exponential then binary search of the longer list for each
+                            //  offset in the shorter list
+    INTERSECT_BLOCK,        // Compare blocks of 8 offsets from each list with AVX2. Falls
+                            //  back to INTERSECT_MERGE on CPUs without AVX2
+    NUM_INTERSECT_METHODS
+};
+
+/*
+ * Append the offsets s in `s_offsets` for which s + m is in `b_offsets` to `sb_offsets`
+ *  Params:
+ *      s_offsets, n_s: All n_s offsets of term s in a document
+ *      m: offset of b relative to s
+ *      b_offsets, n_b: All n_b offsets of term b in a document
+ *      sb_offsets: Offsets of all s + b terms in the document are appended to this
+ *      method: How to intersect the lists
+ */
+void intersect_offsets(const offset_t *s_offsets, size_t n_s, offset_t m, const offset_t *b_offsets, size_t n_b,
+                       std::vector<offset_t>& sb_offsets, IntersectMethod method = INTERSECT_AUTO);
+
+// intersect_offsets() for documents with offset64_t offsets. INTERSECT_BLOCK merges
+void intersect_offsets(const offset64_t *s_offsets, size_t n_s, offset64_t m, const offset64_t *b_offsets, size_t n_b,
+                       std::vector<offset64_t>& sb_offsets, IntersectMethod method = INTERSECT_AUTO);
+
+inline
+void
+intersect_offsets(const std::vector<offset_t>& s_offsets, offset_t m, const std::vector<offset_t>& b_offsets,
+                  std::vector<offset_t>& sb_offsets, IntersectMethod method = INTERSECT_AUTO) {
+    intersect_offsets(s_offsets.data(), s_offsets.size(), m, b_offsets.data(), b_offsets.size(),
+                      sb_offsets, method);
+}
+
+/*
+ * intersect_offsets() that also returns get_non_overlapping_count() of the offsets it
+ *  appends, counted in the same pass. s is intersected a chunk at a time and the
+ *  matches of each chunk are counted while they are in cache
+ *  Params:
+ *      s_offsets, n_s, m, b_offsets, n_b, sb_offsets: As for intersect_offsets()
+ *      len: length of the s + b terms. The offsets are counted as get_non_overlapping_count()
+ *           counts terms of this length
+ *      num: If not 0, stop once the count can no longer reach num. The offsets appended
+ *           to sb_offsets are then incomplete
+ *  Returns: the number of non-overlapping s + b terms. Less than num if stopped early
+ */
+size_t intersect_offsets_count(const offset_t *s_offsets, size_t n_s, offset_t m, const offset_t *b_offsets, size_t n_b,
+                               size_t len, size_t num, std::vector<offset_t>& sb_offsets);
+size_t intersect_offsets_count(const offset64_t *s_offsets, size_t n_s, offset64_t m,
+                               const offset64_t *b_offsets, size_t n_b,
+                               size_t len, size_t num, std::vector<offset64_t>& sb_offsets);
+
+/*
+ * intersect_offsets_count() for s offsets packed by pack_offsets()
+ *  Blocks of s that can't match any b offset are skipped without being decoded. The
+ *  others are decoded one at a time and intersected with the b offsets they can match
+ *  Params:
+ *      s_packed: All offsets of term s in a document, packed. See packed_offsets.h
+ *      m, b_offsets, n_b, len, num, sb_offsets: As for intersect_offsets_count()
+ */
+size_t intersect_packed_offsets(const offset_t *s_packed, offset_t m, const offset_t *b_offsets, size_t n_b,
+                                size_t len, size_t num, std::vector<offset_t>& sb_offsets);
+
+/*
+ * Return an upper bound on the number of offsets intersect_offsets() would append, found
+ *  by binary search rather than a merge. An s + b term needs s_first + m <= b <= s_last + m
+ *  and b_first - m <= s <= b_last - m, so only the offsets of each list in the range of
+ *  the other can match
+ *  Params: As for intersect_offsets()
+ */
+size_t intersect_offsets_bound(const offset_t *s_offsets, size_t n_s, offset_t m, const offset_t *b_offsets, size_t n_b);
+size_t intersect_offsets_bound(const offset64_t *s_offsets, size_t n_s, offset64_t m,
+                               const offset64_t *b_offsets, size_t n_b);
+
+// intersect_offsets_bound() for s offsets packed by pack_offsets()
+size_t intersect_packed_offsets_bound(const offset_t *s_packed, offset_t m, const offset_t *b_offsets, size_t n_b);
+
+/*
+ * Return the count of terms of length m at `offsets` that the engines compare with the
+ *  required number of repeats
+ *
+ * This is NOT the largest number of non-overlapping terms. An offset is counted if it is
+ *  at least m past offsets[i0], where i0 starts at 0 and moves on by one offset each time
+ *  an offset is counted, not to the offset that was counted. So i0 can lag behind the
+ *  last counted offset and overlapping offsets can be counted: [0, 2, 3, 5] with m = 3
+ *  counts 0, 3 and 5 (5 >= 2 + 3) where at most 2 terms fit. The count is an upper bound
+ *  on the number of non-overlapping terms, which is what taking them greedily from the
+ *  first offset would give, and is equal to it when the terms don't overlap. It is the
+ *  count of the original implementation and is kept so that the results don't change.
+ *  intersect_offsets_count() and the bounds of get_doc_sb_bound() depend on it
+ *  Params:
+ *      offsets, n: n strictly increasing offsets of a term in a document
+ *      m: length of the term
+ */
+size_t get_non_overlapping_count(const offset_t *offsets, size_t n, size_t m);
+size_t get_non_overlapping_count(const offset64_t *offsets, size_t n, size_t m);
+
+// Return name of `method` e.g. "gallop"
+const char *get_intersect_method_name(IntersectMethod method);
+
+#endif // #ifndef INTERSECT_H
@@ -6,119 +6,386 @@
  */
 
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <climits>
+#include <functional>
 #include <iostream>
 #include "mytypes.h"
 #include "utils.h"
+#include "mapped_file.h"
+#include "byte_kernels.h"
 #include "timer.h"
+#include "profiler.h"
 #include "inverted_index.h"
 #include "inverted_index_int.h"
+#include "index_file.h"
 
 using namespace std;
 
-/*
- *  Params:
- *      offsets_map: {doc index: offsets in doc}
- *  Returns:
- *      vector of #offsets in each doc
- */
-vector<int>
-get_counts_per_doc(const map<int, vector<offset_t>>& offsets_map) {
-    vector<int> counts;
-    for (map<int, vector<offset_t>>::const_iterator it = offsets_map.begin(); it != offsets_map.end(); ++it) {
-        counts.push_back((int)it->second.size());
-    }
-    return counts;
-}
-
 // Number of bytes to ignore at start of all files
 // !@#$% Should be a tunable param
 #define HEADER_SIZE 484
 //#define HEADER_SIZE 0
 
+// Documents are read in chunks of this many bytes when streaming. See RepeatsOptions::_spill_path
+#define INGEST_CHUNK_SIZE (16 << 20)
+
+// Largest document whose offsets fit in offset_t. The engines compute the end s + m of a
+//  term at offset s, which can equal the document size, so that must fit too. Corpora
+//  with larger documents are indexed with offset64_t offsets
+#define MAX_NARROW_DOC_SIZE ((size_t)UINT_MAX)
+
 /*
- * Read file named `path` into a map of {byte: all offsets of byte in a document}
- *  and return the map
- * Only read in offsets of bytes in allowed_bytes that occur >= min_repeats
- *  times
+ * The contents of a document and the number of times each byte occurs in it
+ */
+struct DocBytes {
+    MappedFile _file;               // The whole file, read in place
+    const byte *_data;              // Start of document after header
+    const byte *_end;               // End of document
+    size_t _counts[ALPHABET_SIZE];  // _counts[b] = number of occurrences of byte b in document
+    bool _streamed;                 // The document is read from its file in chunks on each pass
+                                    //  instead of being held in _file
+    size_t _size;                   // Size of document after header when _streamed
+
+    DocBytes() : _data(0), _end(0), _streamed(false), _size(0) {}
+
+    void free_data() {
+        _file.close();
+        _data = _end = 0;
+    }
+};
+
+/*
+ * Read file `path` in chunks of at most INGEST_CHUNK_SIZE bytes and call fn(data, end, offset)
+ *  for each chunk of the document after the header. `offset` is the offset of `data` in the
+ *  document. Only one chunk is in memory at a time
+ *  Returns: false if the file can't be read
  */
 static
-map<byte, vector<offset_t>>
-get_doc_offsets_map(const string& path, set<byte>& allowed_bytes, int min_repeats) {
+bool
+for_each_chunk(const string& path, const function<void(const byte *, const byte *, size_t)>& fn) {
+    if (path == "-") {
+        // The document is read twice
+        cerr << "can't stream stdin" << endl;
+        return false;
+    }
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        cerr << "could not open " << path << endl;
+        return false;
+    }
+
+    vector<byte> buffer(INGEST_CHUNK_SIZE);
+    size_t pos = 0;     // Offset of buffer in file
+    for (;;) {
+        size_t n = fread(buffer.data(), 1, buffer.size(), f);
+        if (n == 0) {
+            break;
+        }
+        size_t begin = pos < (size_t)HEADER_SIZE ? min(n, (size_t)HEADER_SIZE - pos) : 0;
+        if (begin < n) {
+            fn(buffer.data() + begin, buffer.data() + n, pos + begin - HEADER_SIZE);
+        }
+        pos += n;
+    }
 
-    int counts[ALPHABET_SIZE] = {0};
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) {
+        cerr << "could not read " << path << endl;
+    }
+    return ok;
+}
 
-    size_t length = get_file_size(path);
-    byte *in_data = read_file(path);
-    byte *end = in_data + length;
+/*
+ * Count the bytes in file `path` a chunk at a time into `doc`
+ */
+static
+void
+stream_doc_bytes(const string& path, DocBytes& doc) {
+    memset(doc._counts, 0, sizeof(doc._counts));
+    doc._streamed = true;
+    doc._size = 0;
 
-    byte *data = in_data + HEADER_SIZE;
+    bool ok = for_each_chunk(path, [&](const byte *data, const byte *end, size_t) {
+        size_t counts[ALPHABET_SIZE];
+        count_bytes(data, end, counts);
+        for (int b = 0; b < ALPHABET_SIZE; b++) {
+            doc._counts[b] += counts[b];
+        }
+        doc._size += end - data;
+    });
+    if (!ok) {
+        memset(doc._counts, 0, sizeof(doc._counts));
+        doc._size = 0;
+    }
+}
 
-    // Pass through the document once to get counts of all bytes
-    for (byte *p = data; p < end; p++) {
-        counts[*p]++;
+/*
+ * Read file named `path` into `doc` and count the bytes in it
+ */
+static
+void
+read_doc_bytes(const string& path, DocBytes& doc, bool streamed) {
+
+    if (streamed) {
+        stream_doc_bytes(path, doc);
+        return;
+    }
+
+    if (!doc._file.open(path)) {
+        memset(doc._counts, 0, sizeof(doc._counts));
+        return;
     }
+    doc._file.advise_sequential();
+    doc._end = doc._file.end();
+    doc._data = doc._file.size() > HEADER_SIZE ? doc._file.data() + HEADER_SIZE : doc._end;
 
-    // valid_bytes are those with sufficient counts
+    // Pass through the document once to get counts of all bytes
+    count_bytes(doc._data, doc._end, doc._counts);
+}
+
+/*
+ * Return the bytes that occur >= min_repeats times in `doc`
+ */
+static
+set<byte>
+get_valid_bytes(const DocBytes& doc, int min_repeats) {
     set<byte> valid_bytes;
     for (int b = 0; b < ALPHABET_SIZE; b++) {
-        if (counts[b] >= min_repeats) {
+        if (doc._counts[b] >= (size_t)min_repeats) {
             valid_bytes.insert(b);
         }
     }
+    return valid_bytes;
+}
 
-    // We use only the bytes that are valid for all documents so far
-    allowed_bytes = get_intersection(allowed_bytes, valid_bytes);
+/*
+ * Write the offsets of all bytes in allowed_bytes in `doc` to offsets_ptr[byte]
+ *  offsets_ptr[b] must have room for all offsets of b for all allowed bytes b
+ */
+template <class Offset>
+static
+void
+scatter_doc_offsets(const string& path, const DocBytes& doc, const set<byte>& allowed_bytes,
+                    Offset *offsets_ptr[ALPHABET_SIZE]) {
 
-    // We have counts so we can pre-allocate data structures
-    // !@#$ CLEAN UP!!
-    map<byte, vector<offset_t>> offsets_map;
-    vector<offset_t>::iterator offsets_ptr[ALPHABET_SIZE];
     bool byte_lut[ALPHABET_SIZE] = {0};
-
     for (set<byte>::const_iterator it = allowed_bytes.begin(); it != allowed_bytes.end(); ++it) {
-        byte b = *it;
-        offsets_map[b] = vector<offset_t>(counts[b]);
-        offsets_ptr[b] = offsets_map[b].begin();
-        byte_lut[b] = true;
+        byte_lut[*it] = true;
     }
 
     // Scan the document a second time and read in the bytes
-    for (byte *p = data; p < end; p++) {
-        if (byte_lut[*p]) {
-            *(offsets_ptr[*p]++) = offset_t(p - data);
-        }
+    if (doc._streamed) {
+        // The first pass sized offsets_ptr[] for doc._size bytes, so don't scatter any more
+        //  if the file has grown since
+        for_each_chunk(path, [&](const byte *data, const byte *end, size_t offset) {
+            if (offset < doc._size) {
+                const byte *doc_end = (size_t)(end - data) > doc._size - offset ? data + (doc._size - offset) : end;
+                scatter_offsets(data, doc_end, byte_lut, offsets_ptr, (Offset)offset);
+            }
+        });
+    } else {
+        scatter_offsets(doc._data, doc._end, byte_lut, offsets_ptr);
     }
 
-    delete[] in_data;
-
     // Report what was read to stdout
 #if VERBOSITY >= 2
-    cout << "get_doc_offsets_map(" << path << ") " << offsets_map.size() << " {";
-    for (map<string, vector<offset_t>>::iterator it = offsets_map.begin(); it != offsets_map.end(); ++it) {
-        cout << it->first << ":" << it->second.size() << ", ";
-        //check_sorted(it->second);
+    cout << "scatter_doc_offsets(" << path << ") " << allowed_bytes.size() << " {";
+    for (set<byte>::const_iterator it = allowed_bytes.begin(); it != allowed_bytes.end(); ++it) {
+        cout << *it << ":" << doc._counts[*it] << ", ";
     }
     cout << "}" << endl;
 #endif
-    return offsets_map;
+}
+
+/*
+ * Return the entropy in bits per byte of bytes that occur `counts[b]` times
+ */
+static
+double
+get_entropy(const size_t counts[ALPHABET_SIZE]) {
+    size_t total = 0;
+    for (int b = 0; b < ALPHABET_SIZE; b++) {
+        total += counts[b];
+    }
+    double entropy = 0.0;
+    for (int b = 0; b < ALPHABET_SIZE; b++) {
+        if (counts[b] > 0) {
+            double p = (double)counts[b] / (double)total;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
+
+/*
+ * Return the statistics of the documents `docs` that are described by `required_repeats_list`
+ */
+static
+CorpusStats
+get_corpus_stats(const vector<RequiredRepeats>& required_repeats_list, const vector<DocBytes>& docs,
+                 const set<byte>& allowed_bytes) {
+    CorpusStats stats;
+    size_t counts[ALPHABET_SIZE] = {0};
+    for (size_t i = 0; i < docs.size(); i++) {
+        size_t doc_size = 0;
+        for (int b = 0; b < ALPHABET_SIZE; b++) {
+            counts[b] += docs[i]._counts[b];
+            doc_size += docs[i]._counts[b];
+        }
+        stats._n_bytes += doc_size;
+        stats._max_doc_size = max(stats._max_doc_size, doc_size);
+        double repeat_size = required_repeats_list[i].repeat_size();
+        if (i == 0 || repeat_size < stats._min_repeat_size) {
+            stats._min_repeat_size = repeat_size;
+        }
+    }
+    stats._entropy = get_entropy(counts);
+    stats._n_allowed_bytes = allowed_bytes.size();
+    for (set<byte>::const_iterator it = allowed_bytes.begin(); it != allowed_bytes.end(); ++it) {
+        stats._n_allowed_offsets += counts[*it];
+    }
+    return stats;
+}
+
+/*
+ * Build the Postings of the allowed bytes of `inverted_index` with Offset offsets in
+ *  `byte_postings_map` from the documents `docs` that were read by read_doc_bytes()
+ *  The offsets are stored in inverted_index->_arena or, when streaming, its spill file
+ */
+template <class Offset>
+static
+void
+build_byte_postings(InvertedIndex *inverted_index, const vector<RequiredRepeats>& required_repeats_list,
+                    vector<DocBytes>& docs, map<byte, PostingsT<Offset>>& byte_postings_map) {
+    const RepeatsOptions& options = inverted_index->_options;
+    const set<byte>& allowed_bytes = inverted_index->_allowed_bytes;
+    size_t n_allowed_offsets = inverted_index->_stats._n_allowed_offsets;
+    Arena& arena = inverted_index->_arena;
+    size_t n_docs = docs.size();
+
+    // When streaming, the offsets go in a spill file so that the OS can page them out
+    Offset *spill_offsets = 0;
+    if (!options._spill_path.empty() && n_allowed_offsets > 0) {
+        if (inverted_index->_spill.create(options._spill_path, n_allowed_offsets * sizeof(Offset))) {
+            spill_offsets = (Offset *)inverted_index->_spill.data();
+        } else {
+            cerr << "Keeping byte offsets in memory" << endl;
+        }
+    }
+
+    // Lay out the Postings of each allowed byte in the arena or the spill file. We have
+    //  counts so we know where the offsets of byte b in document i go: straight after
+    //  its offsets in document i - 1. The documents can then be scattered in parallel
+    //  straight into their Postings
+    vector<vector<Offset *>> offsets_ptr_list(n_docs, vector<Offset *>(ALPHABET_SIZE, 0));
+    for (set<byte>::const_iterator it = allowed_bytes.begin(); it != allowed_bytes.end(); ++it) {
+        byte b = *it;
+        size_t *doc_ends = arena.alloc_array<size_t>(n_docs);
+        size_t total = 0;
+        for (size_t i = 0; i < n_docs; i++) {
+            total += docs[i]._counts[b];
+            doc_ends[i] = total;
+        }
+        Offset *offsets;
+        if (spill_offsets) {
+            offsets = spill_offsets;
+            spill_offsets += total;
+        } else {
+            offsets = arena.alloc_array<Offset>(total);
+        }
+        for (size_t i = 0; i < n_docs; i++) {
+            offsets_ptr_list[i][b] = offsets + (i > 0 ? doc_ends[i - 1] : 0);
+        }
+        byte_postings_map[b] = PostingsT<Offset>(offsets, doc_ends, (unsigned int)n_docs);
+    }
+
+    // Scatter the offsets of the allowed bytes in all the documents in parallel
+    {
+        ScopedPhase scatter_phase("scatter");
+        inverted_index->_thread_pool->parallel_for(n_docs, [&](size_t i, int) {
+            scatter_doc_offsets(required_repeats_list[i]._doc_name, docs[i], allowed_bytes,
+                                offsets_ptr_list[i].data());
+            docs[i].free_data();
+        }, 1);
+    }
+}
+
+/*
+ * Read the documents described by `required_repeats_list` and build the allowed bytes,
+ *  corpus statistics and byte Postings of `inverted_index` from them
+ */
+static
+void
+build_inverted_index(InvertedIndex *inverted_index, const vector<RequiredRepeats>& required_repeats_list) {
+    const RepeatsOptions& options = inverted_index->_options;
+    size_t n_docs = required_repeats_list.size();
+    vector<DocBytes> docs(n_docs);
+
+    // Read and count the bytes in all the documents in parallel
+    {
+        ScopedPhase read_phase("read");
+        inverted_index->_thread_pool->parallel_for(n_docs, [&](size_t i, int) {
+            read_doc_bytes(required_repeats_list[i]._doc_name, docs[i], !options._spill_path.empty());
+        }, 1);
+    }
+
+    // We use only the bytes that are valid for all documents
+    set<byte>& allowed_bytes = inverted_index->_allowed_bytes;
+    for (size_t i = 0; i < n_docs; i++) {
+        allowed_bytes = get_intersection(allowed_bytes, get_valid_bytes(docs[i], required_repeats_list[i]._num));
+    }
+
+    inverted_index->_stats = get_corpus_stats(required_repeats_list, docs, allowed_bytes);
+
+    // Offsets of documents too large for offset_t need offset64_t
+    inverted_index->_wide_offsets = inverted_index->_stats._max_doc_size > MAX_NARROW_DOC_SIZE;
+    if (inverted_index->_wide_offsets) {
+        build_byte_postings(inverted_index, required_repeats_list, docs, inverted_index->_byte_postings_map64);
+    } else {
+        build_byte_postings(inverted_index, required_repeats_list, docs, inverted_index->_byte_postings_map);
+    }
 }
 
 InvertedIndex::InvertedIndex() :
-    _n_bad_allowed(0) {
+    _n_bad_allowed(0),
+    _wide_offsets(false),
+    _thread_pool(0) {
     // Start `_allowed_terms` as all single bytes
     for (int b = 0; b < ALPHABET_SIZE; b++) {
         _allowed_bytes.insert(b);
     }
 }
 
-InvertedIndex::InvertedIndex(const vector<RequiredRepeats>& required_repeats_list, int n_bad_allowed) :
+InvertedIndex::InvertedIndex(const vector<RequiredRepeats>& required_repeats_list, int n_bad_allowed,
+                             const RepeatsOptions& options) :
      InvertedIndex() {
+    ScopedPhase phase("ingest");
     _n_bad_allowed = n_bad_allowed;
-    for (vector<RequiredRepeats>::const_iterator it = required_repeats_list.begin(); it != required_repeats_list.end(); ++it) {
-        const RequiredRepeats& rr = *it;
-        const map<byte, vector<offset_t>> offsets_map = get_doc_offsets_map(rr._doc_name, _allowed_bytes, rr._num);
-        if (offsets_map.size() > 0) {
-            add_doc(rr, offsets_map);
+    _options = options;
+    _thread_pool = new ThreadPool(options._n_threads);
+
+    size_t n_docs = required_repeats_list.size();
+    bool loaded = false;
+    if (!options._index_path.empty()) {
+        ScopedPhase load_phase("load_index");
+        loaded = load_index_file(this, required_repeats_list, HEADER_SIZE, options._index_path);
+    }
+    if (!loaded) {
+        build_inverted_index(this, required_repeats_list);
+        if (!options._index_path.empty()) {
+            ScopedPhase write_phase("write_index");
+            write_index_file(this, required_repeats_list, HEADER_SIZE, options._index_path);
+        }
+    }
+
+    for (size_t i = 0; i < n_docs; i++) {
+        const RequiredRepeats& rr = required_repeats_list[i];
+        // Documents are only indexed if some bytes are valid for all of them
+        if (!_allowed_bytes.empty()) {
+            _docs_map[(int)i] = rr;
         }
 
 #if VERBOSITY >= 1
@@ -127,25 +394,8 @@ InvertedIndex::InvertedIndex(const vector<RequiredRepeats>& required_repeats_lis
     }
 }
 
-/*
- * Add byte offsets from a document to the inverted index
- *  Trim `_postings_map` keys that are not in `term_offsets`
- */
-void
-InvertedIndex::add_doc(const RequiredRepeats& required_repeats, const map<byte, vector<offset_t>>& byte_offsets) {
-    // Remove keys in _byte_postings_map that are not keys of s_offsets
-    set<byte> common_bytes = get_intersection(_allowed_bytes, get_keys_set(byte_offsets));
-    trim_keys(_byte_postings_map, common_bytes);
-
-    int doc_index = (int)_docs_map.size();
-    _docs_map[doc_index] = required_repeats;
-
-    for (set<byte>::const_iterator it = common_bytes.begin(); it != common_bytes.end(); ++it) {
-        byte b = *it;
-        _byte_postings_map[b].add_offsets(doc_index, byte_offsets.at(b));
-    }
-
-    _allowed_bytes = get_intersection(_allowed_bytes, get_keys_set(_byte_postings_map));
+InvertedIndex::~InvertedIndex() {
+    delete _thread_pool;
 }
 
 #if 0
@@ -186,8 +436,9 @@ check_sorted(const vector<offset_t>& offsets) {
  * Create the InvertedIndex corresponding to `required_repeats`
  */
 InvertedIndex *
-create_inverted_index(const vector<RequiredRepeats>& required_repeats_list, int n_bad_allowed) {
-    return new InvertedIndex(required_repeats_list, n_bad_allowed);
+create_inverted_index(const vector<RequiredRepeats>& required_repeats_list, int n_bad_allowed,
+                      const RepeatsOptions& options) {
+    return new InvertedIndex(required_repeats_list, n_bad_allowed, options);
 }
 
 void
@@ -195,6 +446,72 @@ delete_inverted_index(InvertedIndex *inverted_index) {
     delete inverted_index;
 }
 
+static const char *ENGINE_NAMES[NUM_ENGINES] = {
+    "auto",
+    "merge",
+    "gapped",
+    "suffix"
+};
+
+const char *
+get_engine_name(RepeatsEngine engine) {
+    return (0 <= engine && engine < NUM_ENGINES) ? ENGINE_NAMES[engine] : "unknown";
+}
+
+bool
+get_engine_from_name(const string& name, RepeatsEngine& engine) {
+    for (int i = 0; i < NUM_ENGINES; i++) {
+        if (name == ENGINE_NAMES[i]) {
+#if !TERM_IS_SEQUENCE
+            // The gapped engine's terms have wildcards, which a string Term can't hold
+            if (i == ENGINE_GAPPED) {
+                return false;
+            }
+#endif
+            engine = (RepeatsEngine)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+RepeatsResults
+get_all_repeats(InvertedIndex *inverted_index, size_t max_term_len) {
+    ScopedPhase phase("get_all_repeats");
+    RepeatsEngine engine = inverted_index->_options._engine;
+    if (engine == ENGINE_AUTO) {
+        // The other engines search for different repeats. See RepeatsEngine
+        engine = ENGINE_MERGE;
+    }
+    if (engine == ENGINE_SUFFIX_ARRAY && inverted_index->_wide_offsets) {
+        // The suffix array has 32 bit indexes
+        cerr << "The suffix array engine can't search documents this large. Using the merge engine" << endl;
+        engine = ENGINE_MERGE;
+    }
+
+#if VERBOSITY >= 1
+    const CorpusStats& stats = inverted_index->_stats;
+    cout << "get_all_repeats: engine=" << get_engine_name(engine)
+         << ",bytes=" << stats._n_bytes
+         << ",entropy=" << stats._entropy
+         << ",allowed_bytes=" << stats._n_allowed_bytes
+         << ",allowed_offsets=" << stats._n_allowed_offsets
+         << ",min_repeat_size=" << stats._min_repeat_size
+         << endl;
+#endif
+
+    switch (engine) {
+#if TERM_IS_SEQUENCE
+    case ENGINE_GAPPED:
+        return get_all_repeats_gapped(inverted_index, max_term_len);
+#endif
+    case ENGINE_SUFFIX_ARRAY:
+        return get_all_repeats_suffix_array(inverted_index, max_term_len);
+    default:
+        return get_all_repeats_merge(inverted_index, max_term_len);
+    }
+}
+
 static
 struct VersionInfo {
     VersionInfo() {
@@ -203,6 +520,7 @@ struct VersionInfo {
         cout << "TRACK_EXACT_MATCHES = " << TRACK_EXACT_MATCHES << endl;
         cout << "Sizes of main types" << endl;
         cout << "offset_t size = " << sizeof(offset_t) << " bytes" << endl;
+        cout << "offset64_t size = " << sizeof(offset64_t) << " bytes" << endl;
         cout << "Postings size = " << sizeof(Postings) << " bytes" << endl;
         string s;
         cout << "string size = " << sizeof(s) << " bytes" << endl;
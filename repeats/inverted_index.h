@@ -41,17 +41,92 @@ struct RepeatsResults {
         _converged(converged), _valid(valid), _exact(exact) {}
 };
 
+/*
+ * The algorithms that get_all_repeats() can use
+ *
+ * ENGINE_MERGE and ENGINE_GAPPED search for the same kind of repeat. A length m + 1 term
+ *  is repeated enough in a document if get_non_overlapping_count() of its offsets is at
+ *  least RequiredRepeats::_num, and it is valid if that is so in all but _n_bad_allowed
+ *  documents and its length m prefix and suffix are valid. ENGINE_GAPPED also returns
+ *  terms with wildcards so it needs TERM_IS_SEQUENCE.
+ *
+ * ENGINE_SUFFIX_ARRAY is a separate search with its own definition of a repeat. A term is
+ *  repeated enough in a document if the largest number of its occurrences that don't
+ *  overlap is at least _num, and it is valid if that is so in all but _n_bad_allowed
+ *  documents. The two definitions agree for terms whose occurrences don't overlap. For
+ *  periodic terms get_non_overlapping_count() can count more occurrences, so ENGINE_MERGE
+ *  can return longer terms than ENGINE_SUFFIX_ARRAY. e.g. a length 3 term at offsets 0,
+ *  2, 3 and 5 of a document is counted 3 times by ENGINE_MERGE and 2 times by
+ *  ENGINE_SUFFIX_ARRAY.
+ *
+ * ENGINE_AUTO is ENGINE_MERGE. As no other engine searches for the same repeats, there is
+ *  no faster engine for it to choose.
+ */
+enum RepeatsEngine {
+    ENGINE_AUTO = 0,        // ENGINE_MERGE
+    ENGINE_MERGE,           // Merge length m Postings into length m + 1 Postings. find_best_strings.cpp
+    ENGINE_GAPPED,          // ENGINE_MERGE with wildcards. find_best_sequences.cpp
+    ENGINE_SUFFIX_ARRAY,    // Scan LCP intervals of a suffix array. find_best_suffix_array.cpp
+    NUM_ENGINES
+};
+
+#if TERM_IS_SEQUENCE
+#define DEFAULT_ENGINE ENGINE_GAPPED
+#else
+#define DEFAULT_ENGINE ENGINE_MERGE
+#endif
+
+// Default RepeatsOptions::_checkpoint_interval. Long enough that writing checkpoints
+//  takes a small fraction of a long search
+#define DEFAULT_CHECKPOINT_INTERVAL 300.0
+
+/*
+ * RepeatsOptions control how a search is run. Apart from _engine, they don't change
+ *  its results.
+ */
+struct RepeatsOptions {
+    int _n_threads;             // Number of worker threads. <= 0 => one per hardware thread
+    bool _doc_parallel;         // Merge the documents of each term in parallel when there are
+                                //  too few terms to keep all the threads busy
+    RepeatsEngine _engine;      // Algorithm get_all_repeats() uses
+    std::string _spill_path;    // Non-empty => stream the documents in chunks instead of mapping
+                                //  them and keep the byte offsets in a file created at this path
+                                //  instead of in memory. For documents larger than RAM
+    bool _pack_postings;        // Delta encode and bit pack the offsets of terms longer than
+                                //  1 byte in the merge and gapped engines to save memory.
+                                //  See packed_offsets.h
+    std::string _index_path;    // Non-empty => map the byte Postings from the index file at this
+                                //  path instead of reading the documents, or write the file if
+                                //  it doesn't match the documents. See index_file.h
+    std::string _checkpoint_path;   // Non-empty => the merge and gapped engines save their state
+                                    //  to a file at this path between levels. See checkpoint.h
+    double _checkpoint_interval;    // Least number of seconds between checkpoints
+    bool _resume;                   // Continue the search from the checkpoint at _checkpoint_path
+
+    RepeatsOptions() : _n_threads(1), _doc_parallel(false), _engine(DEFAULT_ENGINE),
+                       _pack_postings(false), _checkpoint_interval(DEFAULT_CHECKPOINT_INTERVAL),
+                       _resume(false) {}
+};
+
+// Return name of `engine` e.g. "merge"
+const char *get_engine_name(RepeatsEngine engine);
+
+// Return the RepeatsEngine called `name`. Returns false if there is no such engine in
+//  this build
+bool get_engine_from_name(const std::string& name, RepeatsEngine& engine);
+
 struct InvertedIndex;
 
 // Create an inverted index from a list of files in filename that have
 // their number of repeats encoded like "repeats=5.txt"
-InvertedIndex *create_inverted_index(const std::vector<RequiredRepeats>& required_repeats_list, int n_bad_allowed);
+InvertedIndex *create_inverted_index(const std::vector<RequiredRepeats>& required_repeats_list, int n_bad_allowed,
+                                     const RepeatsOptions& options = RepeatsOptions());
 
 // Free up all the resources in the InvertedIndex
 void delete_inverted_index(InvertedIndex *inverted_index);
 
 // Return the longest substrings that are repeated the specified
-// number of times
+// number of times, as defined by RepeatsOptions::_engine. See RepeatsEngine
 RepeatsResults get_all_repeats(InvertedIndex *inverted_index, size_t max_substring_len=MAX_SUBSTRING_LEN);
 
 #endif // #ifndef INVERTED_INDEX_H
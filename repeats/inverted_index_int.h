@@ -5,6 +5,9 @@
 #include <vector>
 #include "utils.h"
 #include "postings.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "inverted_index.h"
 
 /*
  * Use an inverted index to find the longest term(s) that is repeated
@@ -23,6 +26,22 @@
  *  for all bytes b to get from terms of length m to terms of
  *  length m + 1
  */
+/*
+ * Statistics of the documents in an InvertedIndex. get_all_repeats() reports them and
+ *  create_inverted_index() uses them to size the byte Postings and choose their offset type
+ */
+struct CorpusStats {
+    size_t _n_bytes;            // Number of bytes in all documents, after the headers
+    double _entropy;            // Entropy of the bytes of all documents in bits per byte
+    size_t _n_allowed_bytes;    // Number of bytes that occur often enough in all documents
+    size_t _n_allowed_offsets;  // Number of occurrences of these bytes in all documents
+    double _min_repeat_size;    // Smallest RequiredRepeats::repeat_size() of any document
+    size_t _max_doc_size;       // Number of bytes in the largest document, after the header
+
+    CorpusStats() : _n_bytes(0), _entropy(0.0), _n_allowed_bytes(0), _n_allowed_offsets(0),
+                    _min_repeat_size(0.0), _max_doc_size(0) {}
+};
+
 struct InvertedIndex {
 
     int _n_bad_allowed; // !@#$ Not exactly right. Mismatch must be same doc each time
@@ -31,6 +50,23 @@ struct InvertedIndex {
     // !@#$ Separate byte Postings map
     std::map<byte, Postings> _byte_postings_map;
 
+    // true if some document is too large for offset_t offsets. The byte Postings are then
+    //  in `_byte_postings_map64` instead of `_byte_postings_map` and the engines search
+    //  with Postings64. See get_byte_postings_map()
+    bool _wide_offsets;
+    std::map<byte, Postings64> _byte_postings_map64;
+
+    // Holds the offsets of the byte Postings
+    Arena _arena;
+
+    // Holds the offsets of the byte Postings instead of `_arena` when _options._spill_path
+    //  is set
+    SpillFile _spill;
+
+    // Holds the offsets of the byte Postings instead of `_arena` when they were loaded from
+    //  the index file at _options._index_path. See index_file.h
+    MappedFile _index_file;
+
     // `_docs_map[i]` = path + min required repeats of document index i.
     //  The Postings in `_postings_map` index into this map
     std::map<int, RequiredRepeats> _docs_map;
@@ -38,14 +74,53 @@ struct InvertedIndex {
     // `_allowed_bytes` is all valid bytes
     std::set<byte> _allowed_bytes;
 
+    CorpusStats _stats;
+
+    RepeatsOptions _options;
+
+    // Runs the per-pass work of get_all_repeats() on _options._n_threads threads
+    ThreadPool *_thread_pool;
+
 private:
     InvertedIndex();
+    InvertedIndex(const InvertedIndex&);
+    InvertedIndex& operator=(const InvertedIndex&);
 
 public:
-    InvertedIndex(const std::vector<RequiredRepeats>& required_repeats_list, int n_bad_allowed);
-    void add_doc(const RequiredRepeats& required_repeats, const std::map<byte, std::vector<offset_t>>& byte_offsets);
+    InvertedIndex(const std::vector<RequiredRepeats>& required_repeats_list, int n_bad_allowed,
+                  const RepeatsOptions& options);
+    ~InvertedIndex();
 
 };
 
+/*
+ * Return the byte Postings of `inverted_index` with Offset offsets, for the engines that
+ *  are templated on the offset type
+ */
+template <class Offset>
+const std::map<byte, PostingsT<Offset>>& get_byte_postings_map(const InvertedIndex *inverted_index);
+
+template <>
+inline
+const std::map<byte, Postings>&
+get_byte_postings_map<offset_t>(const InvertedIndex *inverted_index) {
+    return inverted_index->_byte_postings_map;
+}
+
+template <>
+inline
+const std::map<byte, Postings64>&
+get_byte_postings_map<offset64_t>(const InvertedIndex *inverted_index) {
+    return inverted_index->_byte_postings_map64;
+}
+
+/*
+ * The engines behind get_all_repeats(). See RepeatsEngine
+ */
+RepeatsResults get_all_repeats_merge(InvertedIndex *inverted_index, size_t max_term_len);
+#if TERM_IS_SEQUENCE
+RepeatsResults get_all_repeats_gapped(InvertedIndex *inverted_index, size_t max_term_len);
+#endif
+RepeatsResults get_all_repeats_suffix_array(InvertedIndex *inverted_index, size_t max_term_len);
 
 #endif // #ifndef INVERTED_INDEX_IN_H
@@ -1,21 +1,25 @@
+#include <stdlib.h>
 #include <fstream>
 #include <iostream>
 #include <limits>
 
 #include "utils.h"
 #include "timer.h"
+#include "profiler.h"
+#include "cpu_features.h"
+#include "corpus_gen.h"
 #include "inverted_index.h"
 
 using namespace std;
 
 static
 double
-test_inverted_index(const vector<string>& path_list, int n_bad_allowed) {
+test_inverted_index(const vector<string>& path_list, int n_bad_allowed, const RepeatsOptions& options) {
 
     reset_elapsed_time();
 
     vector<RequiredRepeats> required_repeats_list = get_required_repeats(path_list);
-    InvertedIndex *inverted_index = create_inverted_index(required_repeats_list, n_bad_allowed);
+    InvertedIndex *inverted_index = create_inverted_index(required_repeats_list, n_bad_allowed, options);
 
     RepeatsResults repeats_results = get_all_repeats(inverted_index);
 
@@ -74,30 +78,217 @@ show_stats(const vector<double>& d) {
 }
 
 void
-multi_test(const string& path_list_path, int n, int n_bad_allowed) {
+multi_test(const string& path_list_path, int n, int n_bad_allowed, const RepeatsOptions& options) {
     vector<string> path_list = read_path_list(path_list_path);
     vector<double> durations;
     for (int i = 0; i < n; i++) {
         cout << "========================== test " << i << " of " << n << " ==============================" << endl;
-        durations.push_back(test_inverted_index(path_list, n_bad_allowed));
+        durations.push_back(test_inverted_index(path_list, n_bad_allowed, options));
         show_stats(durations);
     }
 }
 
+static const string USAGE = " [--threads=N] [--doc-parallel] [--isa=scalar|ssse3|avx2|avx512]"
+                             " [--engine=auto|merge|gapped|suffix] [--profile=json_path] [--spill=spill_path]"
+                             " [--pack] [--index=index_path] [--checkpoint=checkpoint_path]"
+                             " [--checkpoint-interval=seconds] [--resume] [--n-bad-allowed=N] path_list_path";
+static const string GEN_USAGE = " gen [--method=pages|0-6|11-15] [--size=MB] [--number=N] [--min-repeats=N]"
+                                 " [--unique=N] [--seed=N] [--plant] [--confound] [--threads=N] [directory]";
+
+// Command line options
+static const string OPT_THREADS = "--threads=";
+static const string OPT_DOC_PARALLEL = "--doc-parallel";
+static const string OPT_ISA = "--isa=";
+static const string OPT_ENGINE = "--engine=";
+static const string OPT_PROFILE = "--profile=";
+static const string OPT_SPILL = "--spill=";
+static const string OPT_PACK = "--pack";
+static const string OPT_INDEX = "--index=";
+static const string OPT_CHECKPOINT = "--checkpoint=";
+static const string OPT_CHECKPOINT_INTERVAL = "--checkpoint-interval=";
+static const string OPT_RESUME = "--resume";
+static const string OPT_N_BAD_ALLOWED = "--n-bad-allowed=";
+
+// Command line options of the gen command. The long options of make_repeats.py
+static const string GEN_COMMAND = "gen";
+static const string OPT_METHOD = "--method=";
+static const string OPT_SIZE = "--size=";
+static const string OPT_NUMBER = "--number=";
+static const string OPT_MIN_REPEATS = "--min-repeats=";
+static const string OPT_UNIQUE = "--unique=";
+static const string OPT_SEED = "--seed=";
+static const string OPT_PLANT = "--plant";
+static const string OPT_CONFOUND = "--confound";
+
+static
+bool
+starts_with(const string& s, const string& prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+/*
+ * Parse the --options at the start of the command line into `options`, `profile_path`,
+ *  where the phase profile is to be written, and `n_bad_allowed`, the number of
+ *  documents that may fail to have the repeats
+ *  Returns: index of the first argument that is not an option, or -1 if
+ *           there is a bad option
+ */
+static
+int
+parse_options(int argc, char *argv[], RepeatsOptions& options, string& profile_path, int& n_bad_allowed) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (!starts_with(arg, "--")) {
+            break;
+        }
+        if (starts_with(arg, OPT_THREADS)) {
+            options._n_threads = string_to_int(arg.substr(OPT_THREADS.size()));
+        } else if (arg == OPT_DOC_PARALLEL) {
+            options._doc_parallel = true;
+        } else if (starts_with(arg, OPT_ISA)) {
+            CpuIsa isa;
+            if (!get_isa_from_name(arg.substr(OPT_ISA.size()), isa)) {
+                cerr << "Unknown instruction set '" << arg << "'" << endl;
+                return -1;
+            }
+            set_max_isa(isa);
+        } else if (starts_with(arg, OPT_ENGINE)) {
+            if (!get_engine_from_name(arg.substr(OPT_ENGINE.size()), options._engine)) {
+                cerr << "Unknown engine '" << arg << "'" << endl;
+                return -1;
+            }
+        } else if (starts_with(arg, OPT_PROFILE)) {
+            profile_path = arg.substr(OPT_PROFILE.size());
+        } else if (starts_with(arg, OPT_SPILL)) {
+            options._spill_path = arg.substr(OPT_SPILL.size());
+        } else if (arg == OPT_PACK) {
+            options._pack_postings = true;
+        } else if (starts_with(arg, OPT_INDEX)) {
+            options._index_path = arg.substr(OPT_INDEX.size());
+        } else if (starts_with(arg, OPT_CHECKPOINT)) {
+            options._checkpoint_path = arg.substr(OPT_CHECKPOINT.size());
+        } else if (starts_with(arg, OPT_CHECKPOINT_INTERVAL)) {
+            options._checkpoint_interval = atof(arg.substr(OPT_CHECKPOINT_INTERVAL.size()).c_str());
+        } else if (arg == OPT_RESUME) {
+            options._resume = true;
+        } else if (starts_with(arg, OPT_N_BAD_ALLOWED)) {
+            n_bad_allowed = string_to_int(arg.substr(OPT_N_BAD_ALLOWED.size()));
+            if (n_bad_allowed < 0) {
+                cerr << "Bad number of documents '" << arg << "'" << endl;
+                return -1;
+            }
+        } else {
+            cerr << "Unknown option '" << arg << "'" << endl;
+            return -1;
+        }
+    }
+    if (options._resume && options._checkpoint_path.empty()) {
+        cerr << OPT_RESUME << " needs " << OPT_CHECKPOINT << "checkpoint_path" << endl;
+        return -1;
+    }
+    return i;
+}
+
+/*
+ * Parse the --options of the gen command, which start at argv[2], into `options`
+ *  Returns: index of the first argument that is not an option, or -1 if
+ *           there is a bad option
+ */
+static
+int
+parse_gen_options(int argc, char *argv[], CorpusOptions& options) {
+    int i;
+    for (i = 2; i < argc; i++) {
+        string arg(argv[i]);
+        if (!starts_with(arg, "--")) {
+            break;
+        }
+        if (starts_with(arg, OPT_METHOD)) {
+            if (!get_corpus_method_from_name(arg.substr(OPT_METHOD.size()), options._method)) {
+                cerr << "Unknown method '" << arg << "'" << endl;
+                return -1;
+            }
+        } else if (starts_with(arg, OPT_SIZE)) {
+            options._doc_size = (size_t)(atof(arg.substr(OPT_SIZE.size()).c_str()) * 1024.0 * 1024.0);
+        } else if (starts_with(arg, OPT_NUMBER)) {
+            options._n_docs = string_to_int(arg.substr(OPT_NUMBER.size()));
+        } else if (starts_with(arg, OPT_MIN_REPEATS)) {
+            options._min_repeats = string_to_int(arg.substr(OPT_MIN_REPEATS.size()));
+        } else if (starts_with(arg, OPT_UNIQUE)) {
+            options._n_unique = string_to_int(arg.substr(OPT_UNIQUE.size()));
+        } else if (starts_with(arg, OPT_SEED)) {
+            options._seed = strtoull(arg.substr(OPT_SEED.size()).c_str(), 0, 10);
+        } else if (arg == OPT_PLANT) {
+            options._plant = true;
+        } else if (arg == OPT_CONFOUND) {
+            options._confound = true;
+        } else if (starts_with(arg, OPT_THREADS)) {
+            options._n_threads = string_to_int(arg.substr(OPT_THREADS.size()));
+        } else {
+            cerr << "Unknown option '" << arg << "'" << endl;
+            return -1;
+        }
+    }
+    return i;
+}
+
+/*
+ * repeats gen: Write a synthetic corpus. See corpus_gen.h
+ */
+static
+int
+gen_main(int argc, char *argv[]) {
+    CorpusOptions options;
+    int i_arg = parse_gen_options(argc, argv, options);
+    if (i_arg < 0 || i_arg < argc - 1) {
+        cerr << "Usage: " << argv[0] << GEN_USAGE << endl;
+        return 1;
+    }
+    string directory = i_arg < argc ? argv[i_arg] : "data.files";
+
+    // make_repeats.py puts this heading at the start of each document. Leave out argv[0]
+    //  so that the corpus doesn't depend on where repeats is installed
+    options._heading = "THIS IS A FILE FOR TESTING FINDING REPEATED STRINGS\nrepeats";
+    for (int i = 1; i < argc; i++) {
+        options._heading += string(" ") + argv[i];
+    }
+    options._heading += "\n";
+
+    string path_list_path;
+    return make_corpus(options, directory, path_list_path) ? 0 : 1;
+}
+
 int
 main(int argc, char *argv[]) {
-    if (argc < 2) {
-        cerr << "Usage: " << argv[0] << " path_list_path" << endl;
+    if (argc > 1 && argv[1] == GEN_COMMAND) {
+        return gen_main(argc, argv);
+    }
+
+    RepeatsOptions options;
+    string profile_path;
+    int n_bad_allowed = 1;
+    int i_arg = parse_options(argc, argv, options, profile_path, n_bad_allowed);
+    if (i_arg < 0 || i_arg >= argc) {
+        cerr << "Usage: " << argv[0] << USAGE << endl;
+        cerr << "       " << argv[0] << GEN_USAGE << endl;
         return 1;
     }
+    cout << "isa = " << get_isa_name(get_cpu_isa()) << endl;
 
-    string path_list_path(argv[1]);
+    string path_list_path(argv[i_arg]);
     vector<string> path_list = read_path_list(path_list_path);
     if (path_list.size() == 0) {
         cerr << "No path_list in " << path_list_path << endl;
         return 1;
     }
 
-    test_inverted_index(path_list, 1);
+    test_inverted_index(path_list, n_bad_allowed, options);
+
+    print_profile(cout);
+    if (!profile_path.empty() && !write_profile_json(profile_path)) {
+        cerr << "Could not write profile to " << profile_path << endl;
+        return 1;
+    }
     return 0;
 }
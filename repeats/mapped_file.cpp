@@ -0,0 +1,331 @@
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// Size of reads for files that can't be mapped
+#define READ_CHUNK_SIZE (1 << 20)
+
+MappedFile::MappedFile() :
+    _data(0),
+    _size(0),
+    _mapped(false)
+#ifdef _WIN32
+    , _file_handle(INVALID_HANDLE_VALUE),
+    _mapping_handle(0)
+#endif
+{}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+SpillFile::~SpillFile() {
+    close();
+}
+
+/*
+ * Read all of `stream` into _buffer
+ */
+bool
+MappedFile::read_stream(istream& stream) {
+    _buffer.clear();
+    while (stream.good()) {
+        size_t size = _buffer.size();
+        _buffer.resize(size + READ_CHUNK_SIZE);
+        stream.read((char *)&_buffer[size], READ_CHUNK_SIZE);
+        _buffer.resize(size + (size_t)stream.gcount());
+    }
+    if (stream.bad()) {
+        _buffer.clear();
+        return false;
+    }
+    _buffer.shrink_to_fit();
+    _data = _buffer.empty() ? 0 : &_buffer[0];
+    _size = _buffer.size();
+    _mapped = false;
+    return true;
+}
+
+#ifdef _WIN32
+
+bool
+MappedFile::open(const string& path) {
+    close();
+
+    if (path == "-") {
+        return read_stream(cin);
+    }
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        cerr << "could not open " << path << endl;
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size)) {
+        if (size.QuadPart == 0) {
+            CloseHandle(file);
+            return true;
+        }
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) {
+            void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (view != NULL) {
+                _file_handle = file;
+                _mapping_handle = mapping;
+                _data = (const byte *)view;
+                _size = (size_t)size.QuadPart;
+                _mapped = true;
+                return true;
+            }
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+
+    ifstream f(path, ios::in | ios::binary);
+    if (!f.is_open() || !read_stream(f)) {
+        cerr << "could not read " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+void
+MappedFile::close() {
+    if (_mapped) {
+        UnmapViewOfFile(_data);
+        CloseHandle(_mapping_handle);
+        CloseHandle(_file_handle);
+        _file_handle = INVALID_HANDLE_VALUE;
+        _mapping_handle = 0;
+    }
+    vector<byte>().swap(_buffer);
+    _data = 0;
+    _size = 0;
+    _mapped = false;
+}
+
+void
+MappedFile::advise_sequential() const {
+    // FILE_FLAG_SEQUENTIAL_SCAN was passed to CreateFileA()
+}
+
+size_t
+MappedFile::get_size(const string& path) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes)) {
+        cerr << "Can't stat '" << path << "'" << endl;
+        return 0;
+    }
+    return (size_t)(((unsigned long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow);
+}
+
+long long
+MappedFile::get_mtime(const string& path) {
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes)) {
+        return 0;
+    }
+    // FILETIMEs are 100 ns intervals since 1601
+    unsigned long long t = ((unsigned long long)attributes.ftLastWriteTime.dwHighDateTime << 32)
+                          | attributes.ftLastWriteTime.dwLowDateTime;
+    return (long long)(t / 10000000ULL) - 11644473600LL;
+}
+
+SpillFile::SpillFile() :
+    _data(0),
+    _size(0),
+    _file_handle(INVALID_HANDLE_VALUE),
+    _mapping_handle(0)
+{}
+
+bool
+SpillFile::create(const string& path, size_t size) {
+    close();
+    if (size == 0) {
+        return true;
+    }
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        cerr << "could not create " << path << endl;
+        return false;
+    }
+
+    ULARGE_INTEGER max_size;
+    max_size.QuadPart = size;
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, max_size.HighPart, max_size.LowPart, NULL);
+    if (mapping != NULL) {
+        void *view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+        if (view != NULL) {
+            _file_handle = file;
+            _mapping_handle = mapping;
+            _data = (byte *)view;
+            _size = size;
+            return true;
+        }
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    cerr << "could not map " << size << " bytes of " << path << endl;
+    return false;
+}
+
+void
+SpillFile::close() {
+    if (_data) {
+        UnmapViewOfFile(_data);
+        CloseHandle(_mapping_handle);
+        // FILE_FLAG_DELETE_ON_CLOSE deletes the file
+        CloseHandle(_file_handle);
+        _file_handle = INVALID_HANDLE_VALUE;
+        _mapping_handle = 0;
+    }
+    _data = 0;
+    _size = 0;
+}
+
+#else
+
+bool
+MappedFile::open(const string& path) {
+    close();
+
+    if (path == "-") {
+        return read_stream(cin);
+    }
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "could not open " << path << ", errno=" << errno << endl;
+        return false;
+    }
+
+    struct stat filestatus;
+    if (fstat(fd, &filestatus) == 0 && S_ISREG(filestatus.st_mode)) {
+        size_t size = (size_t)filestatus.st_size;
+        if (size == 0) {
+            ::close(fd);
+            return true;
+        }
+        void *data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // The mapping keeps its own reference to the file
+            ::close(fd);
+            _data = (const byte *)data;
+            _size = size;
+            _mapped = true;
+            return true;
+        }
+    }
+    ::close(fd);
+
+    // Pipes, character devices etc
+    ifstream f(path, ios::in | ios::binary);
+    if (!f.is_open() || !read_stream(f)) {
+        cerr << "could not read " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+void
+MappedFile::close() {
+    if (_mapped) {
+        munmap((void *)_data, _size);
+    }
+    vector<byte>().swap(_buffer);
+    _data = 0;
+    _size = 0;
+    _mapped = false;
+}
+
+void
+MappedFile::advise_sequential() const {
+    if (_mapped) {
+        madvise((void *)_data, _size, MADV_SEQUENTIAL);
+    }
+}
+
+size_t
+MappedFile::get_size(const string& path) {
+    // stat() rather than open() so that pipes aren't disturbed before they are read
+    struct stat filestatus;
+    if (stat(path.c_str(), &filestatus) != 0) {
+        cerr << "Can't stat '" << path << "', errno=" << errno << endl;
+        return 0;
+    }
+    return S_ISREG(filestatus.st_mode) ? (size_t)filestatus.st_size : 0;
+}
+
+long long
+MappedFile::get_mtime(const string& path) {
+    struct stat filestatus;
+    if (stat(path.c_str(), &filestatus) != 0) {
+        return 0;
+    }
+    return (long long)filestatus.st_mtime;
+}
+
+SpillFile::SpillFile() :
+    _data(0),
+    _size(0)
+{}
+
+bool
+SpillFile::create(const string& path, size_t size) {
+    close();
+    if (size == 0) {
+        return true;
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        cerr << "could not create " << path << ", errno=" << errno << endl;
+        return false;
+    }
+    // The file lives until the mapping is removed
+    unlink(path.c_str());
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        cerr << "could not extend " << path << " to " << size << " bytes, errno=" << errno << endl;
+        ::close(fd);
+        return false;
+    }
+    void *data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        cerr << "could not map " << size << " bytes of " << path << ", errno=" << errno << endl;
+        return false;
+    }
+    _data = (byte *)data;
+    _size = size;
+    return true;
+}
+
+void
+SpillFile::close() {
+    if (_data) {
+        munmap(_data, _size);
+    }
+    _data = 0;
+    _size = 0;
+}
+
+#endif
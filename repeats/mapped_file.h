@@ -0,0 +1,106 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <vector>
+#include "mytypes.h"
+
+/*
+ * Read-only access to the contents of a file
+ *
+ * Regular files are memory mapped so that the bytes are read straight out of
+ *  the page cache without being copied into the process. Pipes, stdin (path "-")
+ *  and anything else that can't be mapped are read into a buffer instead.
+ *
+ * Expected usage
+ * ---------------
+ *  MappedFile file;
+ *  if (file.open(path)) {
+ *      file.advise_sequential();
+ *      for (const byte *p = file.data(); p < file.end(); p++) ...
+ *  }
+ */
+class MappedFile {
+    const byte *_data;          // Contents of file
+    size_t _size;               // Size of file in bytes
+    bool _mapped;               // true => _data is mapped, false => _data is in _buffer
+    std::vector<byte> _buffer;  // Contents of files that can't be mapped
+
+#ifdef _WIN32
+    void *_file_handle;
+    void *_mapping_handle;
+#endif
+
+    bool read_stream(std::istream& stream);
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // Map or read file `path` ("-" => stdin). Returns false on failure
+    bool open(const std::string& path);
+
+    // Release the contents of the file
+    void close();
+
+    // Tell the OS that the file will be read from start to end, so it can read
+    // ahead and drop pages that have been read
+    void advise_sequential() const;
+
+    const byte *data() const { return _data; }
+    const byte *end() const { return _data + _size; }
+    size_t size() const { return _size; }
+    bool is_mapped() const { return _mapped; }
+
+    // Return size of file `path` in bytes, or 0 if it is not a regular file
+    static size_t get_size(const std::string& path);
+
+    // Return last modification time of file `path` in seconds since 1970, or 0 if it
+    //  can't be found
+    static long long get_mtime(const std::string& path);
+};
+
+/*
+ * A writable memory region backed by a temporary file
+ *
+ * The OS writes the pages of the region out to the file when memory is short, so the
+ *  region can be larger than RAM. The file is deleted when the SpillFile is closed.
+ *
+ * Expected usage
+ * ---------------
+ *  SpillFile spill;
+ *  if (spill.create(path, size)) {
+ *      memcpy(spill.data(), ..., size);
+ *  }
+ */
+class SpillFile {
+    byte *_data;                // Start of region
+    size_t _size;               // Size of region in bytes
+
+#ifdef _WIN32
+    void *_file_handle;
+    void *_mapping_handle;
+#endif
+
+    SpillFile(const SpillFile&);
+    SpillFile& operator=(const SpillFile&);
+
+public:
+    SpillFile();
+    ~SpillFile();
+
+    // Create a region of `size` bytes backed by file `path`, which must not be in use.
+    //  Returns false on failure
+    bool create(const std::string& path, size_t size);
+
+    // Release the region and delete its file
+    void close();
+
+    byte *data() const { return _data; }
+    size_t size() const { return _size; }
+};
+
+#endif // #ifndef MAPPED_FILE_H
@@ -26,8 +26,19 @@ typedef unsigned char byte;
 //  size over the raw data
 typedef unsigned int offset_t;
 
-#define INNER_LOOP 4
+// Offsets in documents of 4 GB or more. Only corpora with such documents pay for
+//  them. See InvertedIndex::_wide_offsets
+typedef unsigned long long offset64_t;
+
+// get_sb_offsets() implementation. 4: merge or block binary search by ratio of list
+//  sizes, 5: runtime selected block compare or galloping intersection (intersect.cpp)
+#define INNER_LOOP 5
 #define TRACK_EXACT_MATCHES 0
+
+// 1: Record wall time, CPU time, allocations and peak RSS of the phases of
+//  create_inverted_index() and get_all_repeats(). See profiler.h
+#define PROFILE_PHASES 1
+
 /*
  * A Term can be a string or sequence of bytes  !@#$
  */
@@ -147,6 +158,12 @@ extend_term_gap_byte(const Term& s, int gap, byte b) {
     return s1;
 }
 
+inline
+Term
+extend_term_byte(const Term& s, byte b) {
+    return extend_term_gap_byte(s, 0, b);
+}
+
 
 
 #endif
@@ -0,0 +1,196 @@
+/*
+ * Delta encoded, bit packed offset lists. See packed_offsets.h
+ *
+ * Decoding a block is an unpack of the gaps followed by a prefix sum. The unpack reads
+ *  each gap from a 64 bit window so it has no branches. The prefix sum is a serial
+ *  dependency chain in scalar code so the SSSE3 variant adds 4 offsets at a time.
+ */
+
+#include <algorithm>
+#include <stdint.h>
+#include "packed_offsets.h"
+#include "cpu_features.h"
+
+#if HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Number of words in the header and the skip table of `n` packed offsets
+#define PACK_HEADER_SIZE 1
+#define PACK_SKIP_SIZE 3
+
+/*
+ * Return the number of bits needed for the largest gap - 1 between the `n` offsets at
+ *  `offsets`
+ */
+static
+int
+get_gap_bits(const offset_t *offsets, size_t n) {
+    offset_t max_gap = 0;
+    for (size_t i = 1; i < n; i++) {
+        max_gap = max(max_gap, offsets[i] - offsets[i - 1] - 1);
+    }
+    int bits = 0;
+    while (bits < 32 && ((uint64_t)max_gap >> bits) != 0) {
+        bits++;
+    }
+    return bits;
+}
+
+// Return the number of words taken by `n_gaps` gaps of `bits` bits
+inline
+size_t
+get_gap_words(size_t n_gaps, int bits) {
+    return (n_gaps * bits + 31) / 32;
+}
+
+size_t
+packed_offsets_size(const offset_t *offsets, size_t n) {
+    if (n < PACK_MIN_OFFSETS) {
+        return 1 + n;
+    }
+    size_t n_blocks = (n + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE;
+    size_t size = PACK_HEADER_SIZE + PACK_SKIP_SIZE * n_blocks;
+    for (size_t begin = 0; begin < n; begin += PACK_BLOCK_SIZE) {
+        size_t count = min((size_t)PACK_BLOCK_SIZE, n - begin);
+        size += get_gap_words(count - 1, get_gap_bits(offsets + begin, count));
+    }
+    return size + 1;
+}
+
+offset_t *
+pack_offsets(const offset_t *offsets, size_t n, offset_t *packed) {
+    packed[0] = (offset_t)n;
+    if (n < PACK_MIN_OFFSETS) {
+        copy(offsets, offsets + n, packed + 1);
+        return packed + 1 + n;
+    }
+
+    size_t n_blocks = (n + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE;
+    offset_t *out = packed + PACK_HEADER_SIZE + PACK_SKIP_SIZE * n_blocks;
+
+    for (size_t k = 0; k < n_blocks; k++) {
+        const offset_t *block = offsets + k * PACK_BLOCK_SIZE;
+        size_t count = min((size_t)PACK_BLOCK_SIZE, n - k * PACK_BLOCK_SIZE);
+        int bits = get_gap_bits(block, count);
+
+        offset_t *skip = packed + PACK_HEADER_SIZE + PACK_SKIP_SIZE * k;
+        skip[0] = block[0];
+        skip[1] = (offset_t)(out - packed);
+        skip[2] = (offset_t)bits;
+
+        if (bits == 0) {
+            continue;
+        }
+        uint64_t acc = 0;
+        int n_acc = 0;
+        for (size_t i = 1; i < count; i++) {
+            acc |= (uint64_t)(block[i] - block[i - 1] - 1) << n_acc;
+            n_acc += bits;
+            if (n_acc >= 32) {
+                *out++ = (offset_t)acc;
+                acc >>= 32;
+                n_acc -= 32;
+            }
+        }
+        if (n_acc > 0) {
+            *out++ = (offset_t)acc;
+        }
+    }
+
+    // Padding for the 2 word reads of unpack_block()
+    *out++ = 0;
+    return out;
+}
+
+/*
+ * Replace the `n` values at `a` with their running totals
+ */
+static
+void
+prefix_sum_scalar(offset_t *a, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        a[i] += a[i - 1];
+    }
+}
+
+#if HAVE_X86_SIMD
+
+TARGET_SSSE3
+static
+void
+prefix_sum_ssse3(offset_t *a, size_t n) {
+    __m128i carry = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128((__m128i *)(a + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    for (; i < n; i++) {
+        a[i] += i > 0 ? a[i - 1] : 0;
+    }
+}
+
+#endif // #if HAVE_X86_SIMD
+
+size_t
+unpack_block(const offset_t *packed, size_t block, offset_t *offsets) {
+    size_t n = packed[0];
+    if (packed_offsets_raw(packed)) {
+        copy(packed + 1, packed + 1 + n, offsets);
+        return n;
+    }
+    size_t count = min((size_t)PACK_BLOCK_SIZE, n - block * PACK_BLOCK_SIZE);
+    const offset_t *skip = packed + PACK_HEADER_SIZE + PACK_SKIP_SIZE * block;
+    offset_t first = skip[0];
+    const offset_t *data = packed + skip[1];
+    int bits = (int)skip[2];
+
+    // offsets[] is filled with the first offset then the gaps and summed in place
+    offsets[0] = first;
+    if (bits == 0) {
+        for (size_t i = 1; i < count; i++) {
+            offsets[i] = first + (offset_t)i;
+        }
+        return count;
+    }
+
+    uint64_t mask = ((uint64_t)1 << bits) - 1;
+    for (size_t i = 1; i < count; i++) {
+        size_t bit = (i - 1) * bits;
+        const offset_t *w = data + (bit >> 5);
+        uint64_t window = (uint64_t)w[0] | ((uint64_t)w[1] << 32);
+        offsets[i] = (offset_t)((window >> (bit & 31)) & mask) + 1;
+    }
+
+#if HAVE_X86_SIMD
+    if (get_cpu_isa() >= ISA_SSSE3) {
+        prefix_sum_ssse3(offsets, count);
+        return count;
+    }
+#endif
+    prefix_sum_scalar(offsets, count);
+    return count;
+}
+
+void
+unpack_offsets(const offset_t *packed, vector<offset_t>& offsets) {
+    if (packed_offsets_raw(packed)) {
+        offsets.insert(offsets.end(), packed + 1, packed + 1 + packed[0]);
+        return;
+    }
+    size_t n_old = offsets.size();
+    size_t n_blocks = packed_offsets_blocks(packed);
+    offsets.resize(n_old + n_blocks * PACK_BLOCK_SIZE);
+    offset_t *out = offsets.data() + n_old;
+    for (size_t k = 0; k < n_blocks; k++) {
+        out += unpack_block(packed, k, out);
+    }
+    offsets.resize(out - offsets.data());
+}
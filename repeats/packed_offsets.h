@@ -0,0 +1,92 @@
+#ifndef PACKED_OFFSETS_H
+#define PACKED_OFFSETS_H
+
+#include <stddef.h>
+#include <vector>
+#include "mytypes.h"
+
+/*
+ * Compressed offset lists for the Postings of long terms. See RepeatsOptions::_pack_postings
+ *
+ * The offsets of a term in a document are strictly increasing so they are stored as the
+ *  gaps between them. The gaps are split into blocks of PACK_BLOCK_SIZE offsets and the
+ *  gaps in each block are bit packed with the fewest bits that hold the largest of them.
+ *  The first offset of each block is stored in a skip table so blocks can be skipped or
+ *  decoded without decoding the blocks before them.
+ *
+ * The packed offsets of a document are an array of offset_t words
+ *      [0]                         n: number of offsets
+ *      [1 + 3 * k]                 first offset of block k
+ *      [2 + 3 * k]                 index in the array of the packed gaps of block k
+ *      [3 + 3 * k]                 bits per gap of block k
+ *      ...                         packed gaps - 1 of each block, low bits first
+ *      [packed_offsets_size() - 1] padding so that decoding can read 2 words at a time
+ *
+ * Lists of fewer than PACK_MIN_OFFSETS offsets would grow so they are stored unpacked
+ *      [0]                         n: number of offsets
+ *      [1 .. n]                    the offsets
+ *
+ * The long lists of the first few levels shrink 3 to 4 times. Most of the lists of the
+ *  later levels are short and are left as they are.
+ */
+
+// Number of offsets in each packed block
+#define PACK_BLOCK_SIZE 128
+
+// Lists of fewer offsets than this are not packed
+#define PACK_MIN_OFFSETS 8
+
+// Return the number of words that pack_offsets() writes for the `n` offsets at `offsets`
+size_t packed_offsets_size(const offset_t *offsets, size_t n);
+
+/*
+ * Pack the `n` strictly increasing offsets at `offsets`
+ *  Params:
+ *      offsets, n: The offsets
+ *      packed: Room for packed_offsets_size(offsets, n) words
+ *  Returns: pointer past the last word written
+ */
+offset_t *pack_offsets(const offset_t *offsets, size_t n, offset_t *packed);
+
+// Return the number of offsets in `packed`
+inline
+size_t
+packed_offsets_count(const offset_t *packed) {
+    return packed[0];
+}
+
+// Return true if the offsets in `packed` are stored unpacked at packed + 1
+inline
+bool
+packed_offsets_raw(const offset_t *packed) {
+    return packed[0] < PACK_MIN_OFFSETS;
+}
+
+// Return the number of blocks in `packed`
+inline
+size_t
+packed_offsets_blocks(const offset_t *packed) {
+    return (packed[0] + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE;
+}
+
+// Return the first offset of block `block` of `packed`
+inline
+offset_t
+packed_block_first(const offset_t *packed, size_t block) {
+    return packed[1 + 3 * block];
+}
+
+/*
+ * Decode block `block` of `packed`
+ *  Params:
+ *      packed: Packed offsets
+ *      block: Index of block to decode
+ *      offsets: Room for PACK_BLOCK_SIZE offsets. Set to the offsets in the block
+ *  Returns: number of offsets in the block
+ */
+size_t unpack_block(const offset_t *packed, size_t block, offset_t *offsets);
+
+// Append all the offsets in `packed` to `offsets`
+void unpack_offsets(const offset_t *packed, std::vector<offset_t>& offsets);
+
+#endif // #ifndef PACKED_OFFSETS_H
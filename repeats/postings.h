@@ -1,60 +1,121 @@
 #ifndef POSTINGS_H
 #define POSTINGS_H
 
+#include <assert.h>
 #include <string>
 #include <vector>
 #include "utils.h"
+#include "arena.h"
+#include "packed_offsets.h"
 
-// !@#$ Move this
-std::vector<int> get_counts_per_doc(const std::map<int, std::vector<offset_t>>& offsets_map);
+/*
+ * A read-only view of a run of offsets, typically the offsets of a term in one
+ *  document of a Postings
+ */
+template <class Offset>
+struct OffsetSpanT {
+    typedef const Offset *const_iterator;
+
+    const_iterator _begin;
+    const_iterator _end;
+
+    OffsetSpanT(const_iterator begin, const_iterator end) : _begin(begin), _end(end) {}
+    OffsetSpanT(const std::vector<Offset>& offsets) :
+        _begin(offsets.data()), _end(offsets.data() + offsets.size()) {}
+
+    const_iterator begin() const { return _begin; }
+    const_iterator end() const { return _end; }
+    size_t size() const { return _end - _begin; }
+    bool empty() const { return _begin == _end; }
+    Offset operator[](size_t i) const { return _begin[i]; }
+    const Offset *data() const { return _begin; }
+};
 
 /*
  * A Postings is a list of lists of offsets of a particular term (substring)
  *  in all documents in a corpus.
  *
- *  _offsets_map[i] stores the offsets in document i
+ *  The offsets are stored in compressed sparse row (CSR) form. The offsets in all
+ *  documents are stored in one array, `_offsets`, in document index order, and
+ *  `_doc_ends` says where each document's offsets end. Document indexes are dense
+ *  so reading a Postings is a linear scan.
+ *
+ *  A Postings doesn't own its arrays. They live in the Arena of the level of
+ *  get_all_repeats() that made them, or of the InvertedIndex for the byte
+ *  Postings, and are freed with it. Copying a Postings copies 3 words.
+ *  Postings are built with a PostingsBuilder
+ *
+ *  Postings hold offset_t offsets. Corpora with documents too large for offset_t
+ *  use Postings64, which are the same with offset64_t offsets. See InvertedIndex
+ *
+ *  The offsets of each document of a Postings may be packed by pack_offsets() to
+ *  save memory. See store_postings()
+ *
+ *  doc_offsets(i) is the offsets in document i
  *
  * http://en.wikipedia.org/wiki/Inverted_index
  */
-struct Postings {
-    // Total # occurrences of term in all documents
-    size_t _total_terms;
+template <class Offset>
+struct PostingsT {
+    // Offsets of term in all documents, concatenated in document index order
+    //  The offsets of each document are sorted smallest to largest
+    const Offset *_offsets;
 
-    // Indexes of documents that term occurs in
-    std::vector<int> _doc_indexes;
+    // _offsets[_doc_ends[i - 1] .. _doc_ends[i]) are the offsets of term in document
+    //  with index i. (_doc_ends[-1] is taken as 0)
+    const size_t *_doc_ends;
 
-    // _offsets_map[i] = offsets of term in document with index i
-    //  Each _offsets_map[i] is sorted smallest to largest
-    std::map<int, std::vector<offset_t>> _offsets_map;
+    // Number of documents in _doc_ends
+    unsigned int _n_docs;
+
+    // true if the offsets of each document are packed by pack_offsets(). Then
+    //  _offsets[_doc_ends[i - 1] .. _doc_ends[i]) are the packed offsets of document i
+    bool _packed;
 
     // Optional
     // ends[i] = offset of end of term in document with index i
     //map<int, vector<offset_t>> _ends_map;
 
     // All fields are zero'd on construction
-    // (The containers do this by default)
-    Postings() : _total_terms(0) {}
+    PostingsT() : _offsets(0), _doc_ends(0), _n_docs(0), _packed(false) {}
+
+    PostingsT(const Offset *offsets, const size_t *doc_ends, unsigned int n_docs, bool packed = false) :
+        _offsets(offsets), _doc_ends(doc_ends), _n_docs(n_docs), _packed(packed) {}
+
+    // Return the offsets of term in document with index `doc_index`. Not for packed Postings
+    OffsetSpanT<Offset> doc_offsets(int doc_index) const {
+        assert(!_packed);
+        size_t begin = doc_index > 0 ? _doc_ends[doc_index - 1] : 0;
+        return OffsetSpanT<Offset>(_offsets + begin, _offsets + _doc_ends[doc_index]);
+    }
+
+    // Return the offsets of term in document with index `doc_index` as they are stored,
+    //  which is packed if _packed is set
+    const Offset *doc_data(int doc_index) const {
+        return _offsets + (doc_index > 0 ? _doc_ends[doc_index - 1] : 0);
+    }
 
-    // Add `offsets` which contains all offsets for document with index `doc_index` to this Postings
-    // i.e. _offsets_map[doc_index] <- offsets
-    void add_offsets(int doc_index, const std::vector<offset_t>& offsets) {
-        _doc_indexes.push_back(doc_index);
-        _offsets_map[doc_index] = offsets;
-#if 0
-        vector<offset_t>& offs = _offsets_map[doc_index];
-        cout << " offs: "<< offs.size() << " -- " << offs.capacity() << endl;
-#endif
-        _total_terms += offsets.size();
+    // Return number of offsets of term in document with index `doc_index`
+    size_t doc_size(int doc_index) const {
+        // The first word of packed offsets is their number
+        return _packed ? (size_t)doc_data(doc_index)[0] : doc_offsets(doc_index).size();
     }
 
     // Return number of documents whose offsets are stored in Posting
     unsigned int num_docs() const {
-        return (unsigned int)_offsets_map.size();
+        return _n_docs;
     }
 
-    // Return total number of offsets stored in _offsets_map
+    // Return total number of offsets stored in Posting
     size_t size() const {
-        return get_map_vector_size(_offsets_map);
+        if (_packed) {
+            size_t n = 0;
+            for (unsigned int i = 0; i < _n_docs; i++) {
+                n += doc_size(i);
+            }
+            return n;
+        }
+        return _n_docs > 0 ? _doc_ends[_n_docs - 1] : 0;
     }
 
     // Return true if no documents are encoding in Posting
@@ -63,8 +124,133 @@ struct Postings {
     }
 
     std::vector<int> counts_per_doc() const {
-        return get_counts_per_doc(_offsets_map);
+        std::vector<int> counts;
+        for (unsigned int i = 0; i < num_docs(); i++) {
+            counts.push_back((int)doc_size(i));
+        }
+        return counts;
+    }
+
+    void swap(PostingsT& other) {
+        std::swap(_offsets, other._offsets);
+        std::swap(_doc_ends, other._doc_ends);
+        std::swap(_n_docs, other._n_docs);
+        std::swap(_packed, other._packed);
     }
 };
 
+/*
+ * Scratch space for building a Postings one document at a time
+ *  Each worker keeps one PostingsBuilder and reuses it for every term it extends,
+ *  so the vectors stop growing after the first few terms and only the Postings
+ *  that are kept are copied to an Arena by store()
+ */
+template <class Offset>
+struct PostingsBuilderT {
+    std::vector<Offset> _offsets;
+    std::vector<size_t> _doc_ends;
+
+    // Start the offsets of document with index `doc_index`. Documents must be added
+    //  in increasing index order. Any skipped documents get no offsets
+    //  Returns: `_offsets`. Append the document's offsets to this then call end_doc()
+    std::vector<Offset>& begin_doc(int doc_index) {
+        assert(doc_index >= (int)num_docs());
+        while ((int)num_docs() < doc_index) {
+            _doc_ends.push_back(_offsets.size());
+        }
+        return _offsets;
+    }
+
+    // Finish the document started by begin_doc()
+    //  Returns: The offsets appended since begin_doc()
+    OffsetSpanT<Offset> end_doc() {
+        size_t begin = _doc_ends.empty() ? 0 : _doc_ends.back();
+        _doc_ends.push_back(_offsets.size());
+        return OffsetSpanT<Offset>(_offsets.data() + begin, _offsets.data() + _offsets.size());
+    }
+
+    // Add `offsets` which contains all offsets for document with index `doc_index`
+    void add_offsets(int doc_index, const OffsetSpanT<Offset>& offsets) {
+        std::vector<Offset>& all_offsets = begin_doc(doc_index);
+        all_offsets.insert(all_offsets.end(), offsets.begin(), offsets.end());
+        end_doc();
+    }
+
+    unsigned int num_docs() const {
+        return (unsigned int)_doc_ends.size();
+    }
+
+    // Empty the builder without freeing its memory
+    void clear() {
+        _offsets.clear();
+        _doc_ends.clear();
+    }
+
+    // Return a Postings of a copy in `arena` of what has been built
+    PostingsT<Offset> store(Arena& arena) const {
+        return PostingsT<Offset>(arena.copy_array(_offsets.data(), _offsets.size()),
+                        arena.copy_array(_doc_ends.data(), _doc_ends.size()),
+                        num_docs());
+    }
+};
+
+/*
+ * Move all the Postings in `src` into `dst` and leave `src` empty
+ *  Keys of `src` must not be keys of `dst`
+ */
+template <class K, class Offset>
+void
+merge_postings_maps(std::map<K, PostingsT<Offset>>& dst, std::map<K, PostingsT<Offset>>& src) {
+    for (typename std::map<K, PostingsT<Offset>>::iterator it = src.begin(); it != src.end(); ++it) {
+        dst[it->first].swap(it->second);
+    }
+    src.clear();
+}
+
+typedef OffsetSpanT<offset_t> OffsetSpan;
+typedef PostingsT<offset_t> Postings;
+typedef PostingsBuilderT<offset_t> PostingsBuilder;
+
+typedef OffsetSpanT<offset64_t> OffsetSpan64;
+typedef PostingsT<offset64_t> Postings64;
+typedef PostingsBuilderT<offset64_t> PostingsBuilder64;
+
+/*
+ * Return a Postings of a copy in `arena` of what `builder` has built, with the offsets of
+ *  each document packed by pack_offsets() if `pack` is true
+ */
+inline
+Postings
+store_postings(const PostingsBuilder& builder, Arena& arena, bool pack) {
+    if (!pack) {
+        return builder.store(arena);
+    }
+
+    const std::vector<offset_t>& offsets = builder._offsets;
+    const std::vector<size_t>& ends = builder._doc_ends;
+    unsigned int n_docs = builder.num_docs();
+
+    size_t *doc_ends = arena.alloc_array<size_t>(n_docs);
+    size_t total = 0;
+    for (unsigned int i = 0; i < n_docs; i++) {
+        size_t begin = i > 0 ? ends[i - 1] : 0;
+        total += packed_offsets_size(offsets.data() + begin, ends[i] - begin);
+        doc_ends[i] = total;
+    }
+
+    offset_t *packed = arena.alloc_array<offset_t>(total);
+    for (unsigned int i = 0; i < n_docs; i++) {
+        size_t begin = i > 0 ? ends[i - 1] : 0;
+        pack_offsets(offsets.data() + begin, ends[i] - begin, packed + (i > 0 ? doc_ends[i - 1] : 0));
+    }
+    return Postings(packed, doc_ends, n_docs, true);
+}
+
+// 64 bit offsets are not packed
+inline
+Postings64
+store_postings(const PostingsBuilder64& builder, Arena& arena, bool) {
+    return builder.store(arena);
+}
+
 #endif // #ifndef POSTINGS_H
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "profiler.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+/*
+ * Stats of one (path, m) phase summed over all the times it was run
+ */
+struct PhaseEntry {
+    string _path;                   // Names of the enclosing phases and this phase, separated by /
+    string _name;                   // Name of this phase
+    int _depth;                     // Number of enclosing phases
+    int _m;                         // Term length. < 0 => none
+    size_t _count;                  // Number of times phase was run
+    double _wall;                   // Total wall time in seconds
+    double _cpu;                    // Total process CPU time in seconds
+    unsigned long long _allocs;     // Total heap allocations
+    size_t _peak_rss;               // Largest peak RSS in bytes at the end of the phase
+
+    PhaseEntry(const string& path, const string& name, int depth, int m) :
+        _path(path), _name(name), _depth(depth), _m(m), _count(0), _wall(0.0), _cpu(0.0),
+        _allocs(0), _peak_rss(0) {}
+};
+
+// The profile. Guarded by _profile_mutex
+static mutex _profile_mutex;
+static vector<PhaseEntry> _entries;
+static map<pair<string, int>, size_t> _entry_index;   // _entry_index[(path, m)] = index in _entries
+
+#if PROFILE_PHASES
+
+/*
+ * Number of heap allocations made through operator new. The replacement operators
+ *  below count them
+ */
+static atomic<unsigned long long> _n_allocs(0);
+
+void *
+operator new(size_t size) {
+    _n_allocs.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size > 0 ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void *
+operator new[](size_t size) {
+    return operator new(size);
+}
+
+void
+operator delete(void *p) noexcept {
+    free(p);
+}
+
+void
+operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void
+operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+static
+double
+get_wall_time() {
+    static const chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+/*
+ * Return user + system CPU time of all threads of the process in seconds
+ */
+static
+double
+get_cpu_time() {
+#ifdef _WIN32
+    FILETIME creation, exit_time, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit_time, &kernel, &user)) {
+        return 0.0;
+    }
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (double)(k.QuadPart + u.QuadPart) * 1.0e-7;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1.0e-6;
+#endif
+}
+
+/*
+ * Return the peak resident set size of the process in bytes
+ */
+static
+size_t
+get_peak_rss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// The phases open on this thread, innermost last
+static thread_local vector<string> _phase_stack;
+
+ScopedPhase::ScopedPhase(const char *name, int m) {
+    string path;
+    for (vector<string>::const_iterator it = _phase_stack.begin(); it != _phase_stack.end(); ++it) {
+        path += *it + "/";
+    }
+    path += name;
+
+    {
+        lock_guard<mutex> lock(_profile_mutex);
+        pair<string, int> key(path, m);
+        map<pair<string, int>, size_t>::const_iterator it = _entry_index.find(key);
+        if (it != _entry_index.end()) {
+            _entry = it->second;
+        } else {
+            _entry = _entries.size();
+            _entries.push_back(PhaseEntry(path, name, (int)_phase_stack.size(), m));
+            _entry_index[key] = _entry;
+        }
+    }
+    _phase_stack.push_back(name);
+
+    _allocs0 = _n_allocs.load(memory_order_relaxed);
+    _cpu0 = get_cpu_time();
+    _wall0 = get_wall_time();
+}
+
+ScopedPhase::~ScopedPhase() {
+    double wall = get_wall_time() - _wall0;
+    double cpu = get_cpu_time() - _cpu0;
+    unsigned long long allocs = _n_allocs.load(memory_order_relaxed) - _allocs0;
+    size_t peak_rss = get_peak_rss();
+    _phase_stack.pop_back();
+
+    lock_guard<mutex> lock(_profile_mutex);
+    // reset_profile() may have been called while the phase was open
+    if (_entry >= _entries.size()) {
+        return;
+    }
+    PhaseEntry& entry = _entries[_entry];
+    entry._count++;
+    entry._wall += wall;
+    entry._cpu += cpu;
+    entry._allocs += allocs;
+    if (peak_rss > entry._peak_rss) {
+        entry._peak_rss = peak_rss;
+    }
+}
+
+#endif // #if PROFILE_PHASES
+
+void
+reset_profile() {
+    lock_guard<mutex> lock(_profile_mutex);
+    _entries.clear();
+    _entry_index.clear();
+}
+
+void
+print_profile(ostream& os) {
+    lock_guard<mutex> lock(_profile_mutex);
+    if (_entries.empty()) {
+        return;
+    }
+
+    ios::fmtflags flags = os.flags();
+    streamsize precision = os.precision();
+    char fill = os.fill(' ');
+    os << left << setw(32) << "phase" << right
+       << setw(6) << "m"
+       << setw(8) << "count"
+       << setw(12) << "wall(s)"
+       << setw(12) << "cpu(s)"
+       << setw(12) << "allocs"
+       << setw(14) << "peak_rss(MB)"
+       << endl;
+    for (vector<PhaseEntry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it) {
+        os << left << setw(32) << (string(2 * it->_depth, ' ') + it->_name) << right
+           << setw(6) << (it->_m >= 0 ? to_string(it->_m) : string(""))
+           << setw(8) << it->_count
+           << fixed << setprecision(3)
+           << setw(12) << it->_wall
+           << setw(12) << it->_cpu
+           << setw(12) << it->_allocs
+           << setprecision(1)
+           << setw(14) << (double)it->_peak_rss / (1024.0 * 1024.0)
+           << endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+    os.fill(fill);
+}
+
+bool
+write_profile_json(const string& path) {
+    ofstream os(path.c_str());
+    if (!os) {
+        return false;
+    }
+
+    lock_guard<mutex> lock(_profile_mutex);
+    os << "{" << endl;
+    os << "  \"phases\": [" << endl;
+    for (size_t i = 0; i < _entries.size(); i++) {
+        const PhaseEntry& entry = _entries[i];
+        os << "    {"
+           << "\"path\": \"" << entry._path << "\", "
+           << "\"name\": \"" << entry._name << "\", "
+           << "\"depth\": " << entry._depth << ", ";
+        if (entry._m >= 0) {
+            os << "\"m\": " << entry._m << ", ";
+        }
+        os << "\"count\": " << entry._count << ", "
+           << setprecision(9)
+           << "\"wall_seconds\": " << entry._wall << ", "
+           << "\"cpu_seconds\": " << entry._cpu << ", "
+           << "\"allocations\": " << entry._allocs << ", "
+           << "\"peak_rss_bytes\": " << entry._peak_rss
+           << "}" << (i + 1 < _entries.size() ? "," : "") << endl;
+    }
+    os << "  ]" << endl;
+    os << "}" << endl;
+    return (bool)os;
+}
@@ -0,0 +1,72 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <ostream>
+#include <string>
+#include "mytypes.h"
+
+/*
+ * Per-phase profiling of create_inverted_index() and get_all_repeats()
+ *
+ * A phase is timed by a ScopedPhase on the stack. Phases nest: the path of a phase is
+ *  the names of the phases that are open on its thread when it starts, so "merge" in
+ *  get_all_repeats() is "get_all_repeats/merge". Phases that are run for each term
+ *  length m pass m too. Each (path, m) is one entry of the profile and its stats are
+ *  summed over all the times the phase is run.
+ *
+ * An entry records
+ *  - wall time
+ *  - CPU time of the process, so CPU time / wall time is the average number of busy threads
+ *  - number of heap allocations by all threads
+ *  - peak RSS of the process when the phase ended
+ *
+ * Expected usage
+ * ---------------
+ *  {
+ *      ScopedPhase phase("merge", m);
+ *      ...
+ *  }
+ *  print_profile(cout);
+ *  write_profile_json("profile.json");
+ *
+ * PROFILE_PHASES in mytypes.h turns profiling on. When it is 0 ScopedPhase does nothing
+ *  and the profile is empty.
+ */
+
+#if PROFILE_PHASES
+
+class ScopedPhase {
+    size_t _entry;              // Index of the profile entry of this phase
+    double _wall0;              // Wall time at start of phase
+    double _cpu0;               // CPU time at start of phase
+    unsigned long long _allocs0;// Number of heap allocations at start of phase
+
+    ScopedPhase(const ScopedPhase&);
+    ScopedPhase& operator=(const ScopedPhase&);
+
+public:
+    // Start phase `name`. `m` is the term length the phase is working on, < 0 => none
+    ScopedPhase(const char *name, int m = -1);
+    ~ScopedPhase();
+};
+
+#else
+
+class ScopedPhase {
+public:
+    ScopedPhase(const char *, int = -1) {}
+};
+
+#endif
+
+// Clear the profile
+void reset_profile();
+
+// Write the profile to `os` as a table with one row per entry in the order the entries
+//  were first started
+void print_profile(std::ostream& os);
+
+// Write the profile to file `path` as JSON. Returns false if the file can't be written
+bool write_profile_json(const std::string& path);
+
+#endif // #ifndef PROFILER_H
@@ -0,0 +1,458 @@
+#ifndef SB_POSTINGS_H
+#define SB_POSTINGS_H
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <vector>
+#include "mytypes.h"
+#include "utils.h"
+#include "intersect.h"
+#include "doc_order.h"
+#include "inverted_index_int.h"
+
+/*
+ * The merge of the Postings of a term s with those of a byte b into the Postings of s + b,
+ *  shared by the merge and gapped engines. The gapped engine's terms s<gap>b have `gap`
+ *  wildcards between s and b, so b starts m + gap bytes after s. The merge engine's
+ *  terms are s<0>b
+ *
+ * Expected usage
+ * ---------------
+ *  for each valid length m term s and allowed byte b
+ *      PostingsT<Offset> postings = get_sb_postings(inverted_index, s_postings, m, gap, b, sb_builder,
+ *                                                   arena, doc_order, scratch, doc_pool);
+ *      if (postings.size() > 0)
+ *          // s<gap>b is a valid length m + 1 term
+ */
+
+/*
+ * Return ordered vector of offsets of terms s + b in document where
+ *      `s_offsets` is ordered vector of offsets of Term s in document
+ *      `b_offsets` is ordered vector of offsets of strings b in document
+ *      `m` is length of s
+ *
+ * THIS IS THE INNER LOOP
+ *
+ *  Params:
+ *      s_offsets: All offsets of term s in a document
+ *      m: offset of m - offset of b to check. i.e. m = |s| + gap for s<gap>b
+ *      b_offsets: All offsets of Term b in a document
+ *      sb_offsets: Offsets of all s<gap>b Terms in the document are appended to this
+ *
+ * Basic idea is to keep 2 pointers and move the one behind and record matches of
+ *  *is + m == *ib
+ * Only tested for INNER_LOOP==4 and INNER_LOOP==5
+ */
+template <class Offset>
+inline
+void
+get_sb_offsets(const OffsetSpanT<Offset>& s_offsets, Offset m, const OffsetSpanT<Offset>& b_offsets,
+               std::vector<Offset>& sb_offsets) {
+
+#if INNER_LOOP == 5
+    // Block compare or gallop depending on list sizes and CPU. See intersect.cpp
+    intersect_offsets(s_offsets.data(), s_offsets.size(), m, b_offsets.data(), b_offsets.size(), sb_offsets);
+
+#else
+    typename OffsetSpanT<Offset>::const_iterator is = s_offsets.begin();
+    typename OffsetSpanT<Offset>::const_iterator ib = b_offsets.begin();
+
+#if INNER_LOOP == 1
+    typename std::vector<Offset>::const_iterator b_end = bytes.end();
+    typename std::vector<Offset>::const_iterator s_end = strings.end();
+
+    while (ib < b_end && is < s_end) {
+        Offset is_m = *is + m;
+        if (*ib == is_m) {
+            sb_offsets.push_back(*is);
+            ++is;
+        } else if (*ib < is_m) {
+            while (ib < b_end && *ib < is_m) {
+                ++ib;
+            }
+        } else {
+            Offset ib_m =  *ib - m;
+            while (is < s_end && *is < ib_m) {
+                ++is;
+            }
+        }
+    }
+
+#elif INNER_LOOP == 2
+
+    while (ib < bytes.end() && is < strings.end()) {
+        if (*ib == *is + m) {
+            sb_offsets.push_back(*is);
+            ++is;
+        } else if (*ib < *is + m) {
+            ib = get_gteq(ib, bytes.end(), *is + m);
+        } else {
+            is = get_gteq(is, strings.end(), *ib - m);
+        }
+    }
+
+#elif INNER_LOOP == 3
+
+    // Performance about same for 256, 512 when num chars is low
+    // !@#$ Need to optimize this
+    // The next power 2 calculation slows 2 MB test 35 sec => 42 sec!
+    //size_t step_size_b = next_power2((double)(bytes.back() - bytes.front())/(double)bytes.size());
+    //size_t step_size_s = next_power2((double)(strings.back() - strings.front())/(double)strings.size());
+
+    size_t step_size_b = 512;
+    size_t step_size_s = 512;
+
+    while (ib < bytes.end() && is < strings.end()) {
+
+        if (*ib == *is + m) {
+            sb_offsets.push_back(*is);
+            ++is;
+        } else if (*ib < *is + m) {
+            ib = get_gteq2(ib, bytes.end(), *is + m, step_size_b);
+        } else {
+            is = get_gteq2(is, strings.end(), *ib - m, step_size_s);
+        }
+    }
+
+#elif INNER_LOOP == 4
+    typename OffsetSpanT<Offset>::const_iterator s_end = s_offsets.end();
+    typename OffsetSpanT<Offset>::const_iterator b_end = b_offsets.end();
+
+    double ratio = (double)b_offsets.size() / (double)s_offsets.size();
+
+    if (ratio < 8.0) {
+        /*
+         * Walk through s_offsets and b_offsets keeping them aligned as follows
+         *  b offset == end of s offset => save s offset as it is an s + b offset
+         *  b offset < end of s offset  => advance b offset
+         *  b offset > end of s offset  => advance s offset
+         */
+        while (ib != b_end && is != s_end) {
+            Offset s_m = *is + m;  // offset of end of s
+            if (*ib == s_m) {
+                sb_offsets.push_back(*is);
+                ++ib;
+                ++is;
+            } else if (*ib < s_m) {
+                while (ib != b_end && *ib < s_m) {
+                    ++ib;
+                }
+            } else {
+                Offset b_m = *ib - m;
+                while (is != s_end && *is < b_m) {
+                    ++is;
+                }
+            }
+        }
+    } else {
+        /*
+         * Walk through s_offsets and b_offsets keeping them aligned as follows
+         *  b offset == end of s offset => save s offset as it is an s + b offset
+         *  b offset < end of s offset  => advance b offset binary searching regions of step_size_b
+         *  b offset > end of s offset  => advance s offset
+         */
+        size_t step_size_b = next_power2(ratio);
+        while (ib != b_end && is != s_end) {
+            Offset s_m = *is + m;
+            if (*ib == s_m) {
+                sb_offsets.push_back(*is);
+                ++ib;
+                ++is;
+            } else if (*ib < s_m) {
+                 ib = get_gteq2(ib, b_end, s_m, step_size_b);
+            } else {
+                Offset b_m =  *ib - m;
+                while (is != s_end && *is < b_m) {
+                    ++is;
+                }
+            }
+        }
+    }
+#endif
+#endif // #if INNER_LOOP == 5
+}
+
+/*
+ * get_sb_offsets() for the s offsets in document `doc_index` of `s_postings`
+ *  Returns: get_non_overlapping_count() of the s + b offsets for terms of length `len`,
+ *           counted during the merge. If `num` is not 0 the merge stops once this can't
+ *           reach `num`. See intersect_offsets_count()
+ */
+template <class Offset>
+inline
+size_t
+get_doc_sb_offsets(const PostingsT<Offset>& s_postings, int doc_index, Offset m, const OffsetSpanT<Offset>& b_offsets,
+                   size_t len, size_t num, std::vector<Offset>& sb_offsets) {
+    OffsetSpanT<Offset> s_offsets = s_postings.doc_offsets(doc_index);
+#if INNER_LOOP == 5
+    return intersect_offsets_count(s_offsets.data(), s_offsets.size(), m, b_offsets.data(), b_offsets.size(),
+                                   len, num, sb_offsets);
+#else
+    size_t n_old = sb_offsets.size();
+    get_sb_offsets(s_offsets, m, b_offsets, sb_offsets);
+    return get_non_overlapping_count(sb_offsets.data() + n_old, sb_offsets.size() - n_old, len);
+#endif
+}
+
+// offset_t Postings may be packed. See RepeatsOptions::_pack_postings
+inline
+size_t
+get_doc_sb_offsets(const Postings& s_postings, int doc_index, offset_t m, const OffsetSpan& b_offsets,
+                   size_t len, size_t num, std::vector<offset_t>& sb_offsets) {
+    if (s_postings._packed) {
+        return intersect_packed_offsets(s_postings.doc_data(doc_index), m, b_offsets.data(), b_offsets.size(),
+                                        len, num, sb_offsets);
+    }
+    return get_doc_sb_offsets<offset_t>(s_postings, doc_index, m, b_offsets, len, num, sb_offsets);
+}
+
+/*
+ * Return an upper bound on the count get_doc_sb_offsets() returns for document `doc_index`,
+ *  found without merging. See intersect_offsets_bound()
+ */
+template <class Offset>
+inline
+size_t
+get_doc_sb_bound(const PostingsT<Offset>& s_postings, int doc_index, Offset m, const OffsetSpanT<Offset>& b_offsets) {
+    OffsetSpanT<Offset> s_offsets = s_postings.doc_offsets(doc_index);
+    return intersect_offsets_bound(s_offsets.data(), s_offsets.size(), m, b_offsets.data(), b_offsets.size());
+}
+
+inline
+size_t
+get_doc_sb_bound(const Postings& s_postings, int doc_index, offset_t m, const OffsetSpan& b_offsets) {
+    if (s_postings._packed) {
+        return intersect_packed_offsets_bound(s_postings.doc_data(doc_index), m, b_offsets.data(), b_offsets.size());
+    }
+    return get_doc_sb_bound<offset_t>(s_postings, doc_index, m, b_offsets);
+}
+
+/*
+ * Find the documents in which s + b can't be repeated enough times because s or b isn't.
+ *  This takes a comparison per document. get_doc_sb_bound() is tighter but takes binary
+ *  searches so it is only used for documents whose failure would end the search
+ *  Params:
+ *      failed: Set to whether each document in _docs_map, in order, must fail
+ *  Returns: number of documents that must fail
+ */
+template <class Offset>
+inline
+int
+get_failed_docs(const InvertedIndex *inverted_index, const PostingsT<Offset>& s_postings,
+                const PostingsT<Offset>& b_postings, std::vector<bool>& failed) {
+    const std::map<int, RequiredRepeats>& docs_map = inverted_index->_docs_map;
+    failed.resize(docs_map.size());
+    int n_failed = 0;
+    int i = 0;
+    for (std::map<int, RequiredRepeats>::const_iterator it = docs_map.begin(); it != docs_map.end(); ++it, ++i) {
+        int doc_index = it->first;
+        failed[i] = std::min(s_postings.doc_size(doc_index), b_postings.doc_size(doc_index)) < it->second._num;
+        n_failed += failed[i];
+    }
+    return n_failed;
+}
+
+#if 0
+inline std::vector<offset_t>
+get_non_overlapping_strings(const std::vector<offset_t>& offsets, size_t m) {
+    if (offsets.size() < 2) {
+        return offsets;
+    }
+    std::vector<offset_t> non_overlapping;
+    std::vector<offset_t>::const_iterator it0 = offsets.begin();
+    std::vector<offset_t>::const_iterator it1 = it0 + 1;
+    std::vector<offset_t>::const_iterator end = offsets.end();
+
+    non_overlapping.push_back(*it0);
+    while (it1 < end) {
+        if (*it1 >= *it0 + m) {
+            non_overlapping.push_back(*it1);
+            it0++;
+            it1++;
+        } else {
+            while (it1 < end && *it1 < *it0 + m) {
+                it1++;
+            }
+        }
+    }
+    return non_overlapping;
+}
+#endif
+
+// get_sb_postings() merges the documents of terms with at least this many offsets in parallel
+#define DOC_PARALLEL_MIN_OFFSETS 100000
+
+/*
+ * The document loop of get_sb_postings() with each document merged as a separate
+ *  task on `doc_pool`
+ * Once more than _n_bad_allowed documents have failed, the tasks for documents
+ *  that have not been started return immediately
+ *  `shift` is the offset of b from the start of s and `m` the length of s
+ *  Returns: true if s + b matched, in which case its offsets are in `sb_builder`
+ */
+template <class Offset>
+inline
+bool
+get_sb_postings_doc_parallel(const InvertedIndex *inverted_index,
+                             const PostingsT<Offset>& s_postings, const PostingsT<Offset>& b_postings,
+                             offset_t m, Offset shift, PostingsBuilderT<Offset>& sb_builder, ThreadPool *doc_pool) {
+
+    const std::map<int, RequiredRepeats>& docs_map = inverted_index->_docs_map;
+    std::vector<std::map<int, RequiredRepeats>::const_iterator> docs;
+    for (std::map<int, RequiredRepeats>::const_iterator it = docs_map.begin(); it != docs_map.end(); ++it) {
+        docs.push_back(it);
+    }
+
+    std::vector<std::vector<Offset>> sb_offsets_list(docs.size());
+    std::atomic<int> n_bad(0);
+    std::atomic<bool> cancelled(false);
+
+    doc_pool->parallel_for(docs.size(), [&](size_t i, int) {
+        if (cancelled) {
+            return;
+        }
+        int doc_index = docs[i]->first;
+        unsigned int num = docs[i]->second._num;
+        std::vector<Offset> sb_offsets;
+        // Same test as get_sb_postings()
+        size_t stop_num = n_bad >= inverted_index->_n_bad_allowed ? num : 0;
+        size_t count = get_doc_sb_offsets(s_postings, doc_index, shift, b_postings.doc_offsets(doc_index),
+                                          m + 1, stop_num, sb_offsets);
+        if (count < num) {
+            if (++n_bad > inverted_index->_n_bad_allowed) {
+                cancelled = true;
+            }
+        }
+        sb_offsets_list[i].swap(sb_offsets);
+    }, 1);
+
+    if (cancelled) {
+        return false;
+    }
+
+    for (size_t i = 0; i < docs.size(); i++) {
+        sb_builder.add_offsets(docs[i]->first, sb_offsets_list[i]);
+    }
+    return true;
+}
+
+/*
+ * s<gap>b := Term s followed by gap wildcards followe by byte b
+ *  e.g. AB.C term=AB:gap=1,byte=C  or A.B..C:term=A.B:gap=2,byte=C
+ *  The merge engine's s + b is s<0>b
+ *
+ * Return Postings for term s<gap>b if s<gap>b is repeated a sufficient number of times in each document
+ *  otherwise an empty Postings
+ *  Caller must guarantee that s and b are valid (repeated a sufficient number of times in each document)
+ *
+ *  Params:
+ *      inverted_index: The InvertedIndex
+ *      s_postings: Postings of s
+ *      m: Length of s
+ *      gap: Number of chars between end of s and b. 0 for the merge engine
+ *      b: A vaild length 1 term
+ *      sb_builder: Scratch space for building the Postings
+ *      arena: The Postings are stored here
+ *      doc_order: The order in which to check the documents
+ *      scratch: Scratch space for checking the documents in that order
+ *      doc_pool: If not null, merge the documents in parallel on this pool when s has many offsets
+ *  Returns:
+ *      Offsets of all s<gap>b Terms in the document
+ */
+template <class Offset>
+inline
+PostingsT<Offset>
+get_sb_postings(const InvertedIndex *inverted_index,
+                const PostingsT<Offset>& s_postings, offset_t m, offset_t gap, byte b,
+                PostingsBuilderT<Offset>& sb_builder, Arena& arena, const DocOrder& doc_order,
+                DocScratch<Offset>& scratch, ThreadPool *doc_pool) {
+
+    const PostingsT<Offset>& b_postings = get_byte_postings_map<Offset>(inverted_index).at(b);
+
+    // b starts this far after s
+    const Offset shift = (Offset)(m + gap);
+
+    // Most s<gap>b fail in more documents than allowed. Reject them without merging when
+    //  the bounds on their counts show it
+    std::vector<bool>& failed = scratch._failed;
+    int n_failed = get_failed_docs(inverted_index, s_postings, b_postings, failed);
+    if (n_failed > inverted_index->_n_bad_allowed) {
+        return PostingsT<Offset>();
+    }
+
+    // The offsets of s<gap>b in each document are appended to sb_builder in place
+    sb_builder.clear();
+
+    if (doc_pool && s_postings.size() >= DOC_PARALLEL_MIN_OFFSETS && inverted_index->_docs_map.size() > 1) {
+        if (!get_sb_postings_doc_parallel(inverted_index, s_postings, b_postings, m, shift, sb_builder, doc_pool)) {
+            return PostingsT<Offset>();
+        }
+        return store_postings(sb_builder, arena, inverted_index->_options._pack_postings);
+    }
+
+    // The documents are checked in doc_order, most likely to fail first
+    const std::vector<std::map<int, RequiredRepeats>::const_iterator>& docs = doc_order.docs();
+    int n_bad = 0;
+    for (std::vector<size_t>::const_iterator it = doc_order.order().begin(); it != doc_order.order().end(); ++it) {
+        size_t i = *it;
+        int doc_index = docs[i]->first;
+        unsigned int num = docs[i]->second._num;
+
+        // n_failed counts the documents after this one that must fail. If a failure of
+        //  this document would end the search for s<gap>b then the merge can stop as soon
+        //  as it must fail, or not start if the bound shows it must
+        n_failed -= failed[i];
+        bool last_chance = n_bad + n_failed >= inverted_index->_n_bad_allowed;
+        if (last_chance && (failed[i]
+                || get_doc_sb_bound(s_postings, doc_index, shift, b_postings.doc_offsets(doc_index)) < num)) {
+            scratch._stats.record(i, true);
+            return PostingsT<Offset>();
+        }
+        size_t stop_num = last_chance ? num : 0;
+        std::vector<Offset>& sb_offsets = scratch._offsets[i];
+        sb_offsets.clear();
+        size_t count = get_doc_sb_offsets(s_postings, doc_index, shift, b_postings.doc_offsets(doc_index),
+                                          m + 1, stop_num, sb_offsets);
+        scratch._stats.record(i, count < num);
+
+        /*
+         * Only count non-overlapping offsets when checking validity.
+         *
+         * We can do this because any non-overlapping length m + 1 substring must
+         *  start with a non-overlapping length m substring.
+         *
+         * We CANNOT remove non-overlapping substrings of length m because
+         *  valid substrings of length m + 1 may start with length m
+         *  substrings may be overlapped byt other valid length m
+         *  substrings
+         *  e.g. looking for longest substring that appears twice in "aabcabcaa"
+         *           Non-overlapping     Overlapping
+         *      m=1: a:5, b:2, c:2       a:5, b:2, c:2
+         *      m=2: aa:2, bc:2, ca:2    aa:2, ab:2, bc:2, ca:2
+         *      m=3: none                abc:2
+         */
+        //sb_offsets = get_non_overlapping_strings(sb_offsets, m+1);
+
+        if (count < num) {
+            n_bad++;
+            if (n_bad > inverted_index->_n_bad_allowed) {
+                // Empty map signals no match
+                return PostingsT<Offset>();
+            }
+        }
+    }
+
+    // The offsets are stored in _docs_map order
+    for (size_t i = 0; i < docs.size(); i++) {
+        sb_builder.add_offsets(docs[i]->first, scratch._offsets[i]);
+    }
+
+#if VERBOSITY >= 3
+    std::cout << " matched s<" << gap << ">" << (int)b << " for " << sb_builder.num_docs() << " docs" << std::endl;
+#endif
+    return store_postings(sb_builder, arena, inverted_index->_options._pack_postings);
+}
+
+#endif // #ifndef SB_POSTINGS_H
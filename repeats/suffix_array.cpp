@@ -0,0 +1,194 @@
+/*
+ * SA-IS suffix array construction and Kasai LCP construction
+ *
+ * SA-IS is from Nong, Zhang and Chan, "Two Efficient Algorithms for Linear Time
+ *  Suffix Array Construction", IEEE Transactions on Computers, 2011.
+ *
+ * Suffix i is S-type if it is smaller than suffix i + 1 and L-type if it is larger.
+ *  An LMS (leftmost S-type) position is an S-type position preceded by an L-type
+ *  position. SA-IS sorts the LMS substrings by induced sorting, names them, sorts
+ *  the suffixes of the string of names recursively if the names are not unique and
+ *  then induces the order of all suffixes from the order of the LMS suffixes.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include "suffix_array.h"
+
+using namespace std;
+
+#define EMPTY (-1)
+
+/*
+ * Set bkt[c] to the start (end = false) or end (end = true) of the bucket of symbol c
+ *  in the suffix array
+ */
+static
+void
+get_buckets(const int *s, int n, int k, vector<int>& bkt, bool end) {
+    fill(bkt.begin(), bkt.end(), 0);
+    for (int i = 0; i < n; i++) {
+        bkt[s[i]]++;
+    }
+    int sum = 0;
+    for (int c = 0; c < k; c++) {
+        sum += bkt[c];
+        bkt[c] = end ? sum : sum - bkt[c];
+    }
+}
+
+static
+void
+induce_l(const int *s, int *sa, int n, int k, const vector<bool>& is_s, vector<int>& bkt) {
+    get_buckets(s, n, k, bkt, false);
+    for (int i = 0; i < n; i++) {
+        int j = sa[i] - 1;
+        if (sa[i] > 0 && !is_s[j]) {
+            sa[bkt[s[j]]++] = j;
+        }
+    }
+}
+
+static
+void
+induce_s(const int *s, int *sa, int n, int k, const vector<bool>& is_s, vector<int>& bkt) {
+    get_buckets(s, n, k, bkt, true);
+    for (int i = n - 1; i >= 0; i--) {
+        int j = sa[i] - 1;
+        if (sa[i] > 0 && is_s[j]) {
+            sa[--bkt[s[j]]] = j;
+        }
+    }
+}
+
+static
+void
+sais(const int *s, int *sa, int n, int k) {
+    if (n == 1) {
+        sa[0] = 0;
+        return;
+    }
+
+    // Classify the suffixes as S-type or L-type. The sentinel is S-type
+    vector<bool> is_s(n);
+    is_s[n - 1] = true;
+    is_s[n - 2] = false;
+    for (int i = n - 3; i >= 0; i--) {
+        is_s[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && is_s[i + 1]);
+    }
+    auto is_lms = [&is_s](int i) { return i > 0 && is_s[i] && !is_s[i - 1]; };
+
+    // Sort the LMS substrings
+    vector<int> bkt(k);
+    get_buckets(s, n, k, bkt, true);
+    fill(sa, sa + n, EMPTY);
+    for (int i = 1; i < n; i++) {
+        if (is_lms(i)) {
+            sa[--bkt[s[i]]] = i;
+        }
+    }
+    induce_l(s, sa, n, k, is_s, bkt);
+    induce_s(s, sa, n, k, is_s, bkt);
+
+    // Move the sorted LMS substrings to the start of sa
+    int n1 = 0;
+    for (int i = 0; i < n; i++) {
+        if (is_lms(sa[i])) {
+            sa[n1++] = sa[i];
+        }
+    }
+
+    // Name the LMS substrings. Equal substrings get the same name. There is at most
+    //  one LMS position in every 2 so sa[n1 + pos / 2] is free for the name of pos
+    fill(sa + n1, sa + n, EMPTY);
+    int name = 0;
+    int prev = EMPTY;
+    for (int i = 0; i < n1; i++) {
+        int pos = sa[i];
+        bool diff = false;
+        for (int d = 0; d < n; d++) {
+            if (prev == EMPTY || s[pos + d] != s[prev + d] || is_s[pos + d] != is_s[prev + d]) {
+                diff = true;
+                break;
+            }
+            if (d > 0 && (is_lms(pos + d) || is_lms(prev + d))) {
+                break;
+            }
+        }
+        if (diff) {
+            name++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for (int i = n - 1, j = n - 1; i >= n1; i--) {
+        if (sa[i] >= 0) {
+            sa[j--] = sa[i];
+        }
+    }
+
+    // Sort the LMS suffixes. s1 is the string of names of the LMS substrings in text
+    //  order. Recurse if the names are not unique
+    int *s1 = sa + n - n1;
+    if (name < n1) {
+        sais(s1, sa, n1, name);
+    } else {
+        for (int i = 0; i < n1; i++) {
+            sa[s1[i]] = i;
+        }
+    }
+
+    // Induce the order of all suffixes from the order of the LMS suffixes
+    get_buckets(s, n, k, bkt, true);
+    for (int i = 1, j = 0; i < n; i++) {
+        if (is_lms(i)) {
+            s1[j++] = i;
+        }
+    }
+    for (int i = 0; i < n1; i++) {
+        sa[i] = s1[sa[i]];
+    }
+    fill(sa + n1, sa + n, EMPTY);
+    for (int i = n1 - 1; i >= 0; i--) {
+        int j = sa[i];
+        sa[i] = EMPTY;
+        sa[--bkt[s[j]]] = j;
+    }
+    induce_l(s, sa, n, k, is_s, bkt);
+    induce_s(s, sa, n, k, is_s, bkt);
+}
+
+void
+build_suffix_array(const int *text, int n, int alphabet_size, int *sa) {
+    assert(n > 0 && text[n - 1] == 0);
+    sais(text, sa, n, alphabet_size);
+}
+
+void
+build_lcp_array(const int *text, int n, const int *sa, int min_match, vector<int>& lcp) {
+    vector<int> rank(n);
+    for (int i = 0; i < n; i++) {
+        rank[sa[i]] = i;
+    }
+
+    // The common prefix of suffixes i + 1 and sa[rank[i] - 1] + 1 is the common prefix
+    //  of suffixes i and sa[rank[i] - 1] less its first symbol, so h drops by at most 1
+    //  from one suffix to the next. This still holds when common prefixes stop at
+    //  symbols < min_match
+    lcp.assign(n + 1, 0);
+    int h = 0;
+    for (int i = 0; i < n; i++) {
+        if (rank[i] == 0) {
+            h = 0;
+            continue;
+        }
+        int j = sa[rank[i] - 1];
+        while (i + h < n && j + h < n && text[i + h] == text[j + h] && text[i + h] >= min_match) {
+            h++;
+        }
+        lcp[rank[i]] = h;
+        if (h > 0) {
+            h--;
+        }
+    }
+}
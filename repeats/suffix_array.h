@@ -0,0 +1,36 @@
+#ifndef SUFFIX_ARRAY_H
+#define SUFFIX_ARRAY_H
+
+#include <vector>
+
+/*
+ * Suffix and LCP arrays for the suffix array engine. See find_best_suffix_array.cpp
+ *
+ * Texts are arrays of int symbols in [0, alphabet_size). Indexes are 32 bit ints so
+ *  texts must have fewer than 2^31 symbols.
+ */
+
+/*
+ * Build the suffix array of `text` with SA-IS in O(n) time
+ *  Params:
+ *      text: n symbols. text[n - 1] must be 0 and 0 must not occur anywhere else
+ *      n: Number of symbols in text
+ *      alphabet_size: All symbols are < alphabet_size
+ *      sa: Room for n ints. sa[i] is set to the start of the i'th smallest suffix
+ */
+void build_suffix_array(const int *text, int n, int alphabet_size, int *sa);
+
+/*
+ * Build the LCP array of `text` with Kasai's algorithm in O(n) time
+ *  Symbols < `min_match` never match, not even themselves, so common prefixes stop
+ *  at them. This lets separators occur more than once in `text`
+ *  Params:
+ *      text, n: As for build_suffix_array()
+ *      sa: Suffix array of text
+ *      min_match: Lowest symbol that can be part of a common prefix
+ *      lcp: Set to n + 1 entries. lcp[i] is the length of the longest common prefix
+ *          of the suffixes at sa[i - 1] and sa[i]. lcp[0] = lcp[n] = 0
+ */
+void build_lcp_array(const int *text, int n, const int *sa, int min_match, std::vector<int>& lcp);
+
+#endif // #ifndef SUFFIX_ARRAY_H
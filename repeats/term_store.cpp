@@ -0,0 +1,230 @@
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include "term_store.h"
+
+using namespace std;
+
+// Initial number of slots in the hash table. Always a power of 2
+#define MIN_TABLE_SIZE 16
+
+TermStore::TermStore(size_t len, const vector<TermStore *> *levels) :
+    _len(len),
+    _mask_size((len + 7) / 8),
+    _levels(levels),
+    _table(MIN_TABLE_SIZE, NO_TERM) {
+}
+
+/*
+ * Hash of term s<gap>b where `parent` is the id of s
+ */
+size_t
+TermStore::hash_node(TermId parent, size_t gap, byte b) {
+    unsigned long long h = ((unsigned long long)parent << 16) | (gap << 8) | b;
+    // 64 bit finalizer from MurmurHash3
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+/*
+ * Return the slot of _table that holds the id of term s<gap>b, or the empty slot where
+ *  it would go
+ */
+size_t
+TermStore::find_slot(TermId parent, size_t gap, byte b) const {
+    size_t mask = _table.size() - 1;
+    size_t slot = hash_node(parent, gap, b) & mask;
+    while (_table[slot] != NO_TERM) {
+        const TermNode& node = _nodes[_table[slot]];
+        if (node._parent == parent && node._gap == gap && node._b == b) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*
+ * Double the size of the hash table
+ */
+void
+TermStore::grow_table() {
+    vector<TermId> table(_table.size() * 2, NO_TERM);
+    _table.swap(table);
+    TermId n = size();
+    for (TermId id = 0; id < n; id++) {
+        const TermNode& node = _nodes[id];
+        _table[find_slot(node._parent, node._gap, node._b)] = id;
+    }
+}
+
+TermId
+TermStore::find(TermId parent, size_t gap, byte b) const {
+    return _table[find_slot(parent, gap, b)];
+}
+
+TermId
+TermStore::add_byte(byte b) {
+    assert(_len == 1);
+    bool added;
+    return add_extension(NO_TERM, 0, b, added);
+}
+
+TermId
+TermStore::add_extension(TermId s, size_t gap, byte b, bool& added) {
+    assert(gap < 256 && gap + 1 <= _len);
+    size_t slot = find_slot(s, gap, b);
+    if (_table[slot] != NO_TERM) {
+        added = false;
+        return _table[slot];
+    }
+
+    TermNode node;
+    node._parent = s;
+    node._gap = (byte)gap;
+    node._b = b;
+    node._n_wild = (unsigned short)(gap + (s == NO_TERM ? 0 : level(_len - gap - 1).num_wild(s)));
+
+    // id[1:] = s[1:]<gap>b
+    TermId suffix = NO_TERM;
+    TermId parent_suffix;
+    if (s != NO_TERM && level(_len - gap - 1).find_suffix(s, parent_suffix)) {
+        suffix = level(_len - 1).find(parent_suffix, gap, b);
+    }
+
+    TermId id = size();
+    _nodes.push_back(node);
+    _suffixes.push_back(suffix);
+    _table[slot] = id;
+    added = true;
+
+    // Keep the table at most half full
+    if (2 * (size_t)size() > _table.size()) {
+        grow_table();
+    }
+    return id;
+}
+
+void
+TermStore::restore(const vector<TermNode>& nodes, const vector<TermId>& suffixes) {
+    assert(nodes.size() == suffixes.size());
+    _nodes = nodes;
+    _suffixes = suffixes;
+
+    // The smallest table that add_extension() would have grown to for this many terms
+    size_t table_size = MIN_TABLE_SIZE;
+    while (2 * _nodes.size() > table_size) {
+        table_size *= 2;
+    }
+    _table.assign(table_size, NO_TERM);
+    for (TermId id = 0; id < size(); id++) {
+        const TermNode& node = _nodes[id];
+        _table[find_slot(node._parent, node._gap, node._b)] = id;
+    }
+}
+
+void
+TermStore::get_extension_bytes(vector<ByteSet>& extension_bytes) const {
+    assert(_len > 1);
+    extension_bytes.assign(level(_len - 1).size(), ByteSet());
+    for (vector<TermNode>::const_iterator it = _nodes.begin(); it != _nodes.end(); ++it) {
+        if (it->_gap == 0) {
+            extension_bytes[it->_parent].set(it->_b);
+        }
+    }
+}
+
+void
+TermStore::get_record(TermId id, byte *rec) const {
+    byte *mask = rec + _len;
+    memset(mask, 0, _mask_size);
+
+    // Walk back from the last symbol to the 1 byte root term
+    const TermStore *store = this;
+    size_t n = _len;
+    while (n > 0) {
+        const TermNode& node = store->_nodes[id];
+        rec[--n] = node._b;
+        for (size_t i = 0; i < node._gap; i++) {
+            rec[--n] = 0;
+            mask[n / 8] |= 1 << (n % 8);
+        }
+        if (n > 0) {
+            store = &level(n);
+            id = node._parent;
+        }
+    }
+}
+
+static
+bool
+is_zero(const byte *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (p[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+TermStore::compare_record(const byte *a, const byte *b) const {
+    const byte *a_mask = a + _len;
+    const byte *b_mask = b + _len;
+
+    // Terms without wildcards compare as bytes
+    if (is_zero(a_mask, _mask_size) && is_zero(b_mask, _mask_size)) {
+        return memcmp(a, b, _len);
+    }
+
+    for (size_t i = 0; i < _len; i++) {
+        bool a_wild = (a_mask[i / 8] & (1 << (i % 8))) != 0;
+        bool b_wild = (b_mask[i / 8] & (1 << (i % 8))) != 0;
+        if (a_wild != b_wild) {
+            return a_wild ? -1 : 1;
+        }
+        if (!a_wild && a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * The terms are materialized into one buffer for the sort and the buffer is freed
+ *  afterwards
+ */
+vector<TermId>
+TermStore::sorted_ids() const {
+    size_t record_size = this->record_size();
+    vector<byte> records(size() * record_size);
+    vector<TermId> ids(size());
+    for (TermId id = 0; id < size(); id++) {
+        get_record(id, &records[id * record_size]);
+        ids[id] = id;
+    }
+    sort(ids.begin(), ids.end(), [&](TermId a, TermId b) {
+        return compare_record(&records[a * record_size], &records[b * record_size]) < 0;
+    });
+    return ids;
+}
+
+Term
+TermStore::get_term(TermId id) const {
+    vector<byte> rec(record_size());
+    get_record(id, rec.data());
+#if TERM_IS_SEQUENCE
+    Term term(_len);
+    for (size_t i = 0; i < _len; i++) {
+        bool is_wild = (rec[_len + i / 8] & (1 << (i % 8))) != 0;
+        term[i] = is_wild ? -1 : B2I(rec[i]);
+    }
+    return term;
+#else
+    return Term((const char *)rec.data(), _len);
+#endif
+}
@@ -0,0 +1,136 @@
+#ifndef TERM_STORE_H
+#define TERM_STORE_H
+
+#include <bitset>
+#include <vector>
+#include "mytypes.h"
+
+/*
+ * Compact storage for all the terms of one length
+ *
+ * A Term is a std::vector<int> (or a std::string), which costs a heap block and,
+ *  for sequences, 4 bytes per symbol. get_all_repeats() has up to millions of
+ *  terms per level so it keeps them in TermStores instead and converts them to
+ *  Terms only for output.
+ *
+ * Every term get_all_repeats() makes is s<gap>b: a shorter term s followed by gap
+ *  wildcards and the byte b. A TermStore stores each term as a TermNode that
+ *  holds the id of s in the store of its length plus gap and b, so a term takes 8
+ *  bytes whatever its length. The TermStores of all lengths are kept together in
+ *  a vector where levels[i] is the store of length i terms. The 1 byte terms are
+ *  the roots.
+ *
+ * Terms are interned: each distinct term is stored once and is referred to by its
+ *  32 bit TermId, which is its index in the store. A term's symbols are only
+ *  materialized, as a record, for sorting and output. A record is the term's len()
+ *  symbol bytes, with 0 for wildcards, followed by a bit mask with bit i set if
+ *  symbol i is a wildcard.
+ *
+ * Each term also has a suffix link: the id of term[1:] in the store of length len() - 1
+ *  terms. It is found when the term is added, so it is only complete if all the
+ *  shorter terms were added first, as they are in the strings engine.
+ *
+ * TermStores order terms the same way as Terms: lexicographically with wildcards
+ *  before all bytes.
+ */
+typedef unsigned int TermId;
+
+// Returned by TermStore::find() for terms that are not in the store. Also the parent
+//  of 1 byte terms
+#define NO_TERM ((TermId)-1)
+
+// A set of bytes. Bit b is set if byte b is in the set
+typedef std::bitset<ALPHABET_SIZE> ByteSet;
+
+struct TermNode {
+    TermId _parent;             // Id of s in the store of length len() - _gap - 1 terms
+    byte _gap;                  // Number of wildcards between s and _b
+    byte _b;                    // Last symbol
+    unsigned short _n_wild;     // Number of wildcards in the term
+};
+
+class TermStore {
+    size_t _len;                                // Number of symbols in each term
+    size_t _mask_size;                          // Bytes in the wildcard mask of a record
+    const std::vector<TermStore *> *_levels;    // (*_levels)[i] is the store of length i terms
+    std::vector<TermNode> _nodes;               // _nodes[id] is term id
+    std::vector<TermId> _suffixes;              // _suffixes[id] is the suffix link of term id
+    std::vector<TermId> _table;                 // Open addressing hash table of TermIds. NO_TERM => empty slot
+
+    static size_t hash_node(TermId parent, size_t gap, byte b);
+    size_t find_slot(TermId parent, size_t gap, byte b) const;
+    void grow_table();
+    const TermStore& level(size_t len) const { return *(*_levels)[len]; }
+
+    TermStore(const TermStore&);
+    TermStore& operator=(const TermStore&);
+
+public:
+    TermStore(size_t len, const std::vector<TermStore *> *levels);
+
+    // Number of symbols in each term
+    size_t len() const { return _len; }
+
+    // Number of terms in store
+    TermId size() const { return (TermId)_nodes.size(); }
+
+    // Number of bytes in a record of a term of this length
+    size_t record_size() const { return _len + _mask_size; }
+
+    // Bytes used by the store
+    size_t memory_size() const {
+        return _nodes.capacity() * sizeof(TermNode) + (_suffixes.capacity() + _table.capacity()) * sizeof(TermId);
+    }
+
+    const TermNode& node(TermId id) const { return _nodes[id]; }
+
+    // Return number of wildcards in term `id`
+    int num_wild(TermId id) const { return _nodes[id]._n_wild; }
+
+    // Return id of term s<gap>b where s is term `parent` of the store of length
+    //  len() - gap - 1 terms, or NO_TERM if it is not in the store
+    TermId find(TermId parent, size_t gap, byte b) const;
+
+    // Add the 1 byte term `b`
+    TermId add_byte(byte b);
+
+    // Return id of term s<gap>b where s is term `s` of the store of length len() - gap - 1
+    //  terms, adding it to the store if it is not there. `added` is set to true if the
+    //  term was added
+    TermId add_extension(TermId s, size_t gap, byte b, bool& added);
+
+    // Find term id[1:] in the store of length len() - 1 terms from its suffix link.
+    //  Returns false if it is not there. The suffix of a 1 byte term is the empty term, NO_TERM
+    bool find_suffix(TermId id, TermId& suffix_id) const {
+        suffix_id = _suffixes[id];
+        return _len == 1 || suffix_id != NO_TERM;
+    }
+
+    // Set extension_bytes[u] to the bytes b such that u + b is in this store for each
+    //  term u of the store of length len() - 1 terms. len() must be > 1
+    void get_extension_bytes(std::vector<ByteSet>& extension_bytes) const;
+
+    // Write the record of term `id` to `rec`, which must have room for record_size() bytes
+    void get_record(TermId id, byte *rec) const;
+
+    // Lexicographic comparison of records: < 0 if a < b, 0 if a == b, > 0 if a > b
+    int compare_record(const byte *a, const byte *b) const;
+
+    // Return ids of all terms in the store in lexicographic order of terms
+    std::vector<TermId> sorted_ids() const;
+
+    // Return term `id` as a Term
+    Term get_term(TermId id) const;
+
+    // The terms and suffix links of the store, indexed by TermId. For saving the store.
+    //  See checkpoint.h
+    const std::vector<TermNode>& nodes() const { return _nodes; }
+    const std::vector<TermId>& suffixes() const { return _suffixes; }
+
+    // Replace the terms of the store with `nodes` and their suffix links `suffixes`, as
+    //  returned by nodes() and suffixes() of a store of the same length. The terms keep
+    //  their TermIds
+    void restore(const std::vector<TermNode>& nodes, const std::vector<TermId>& suffixes);
+};
+
+#endif // #ifndef TERM_STORE_H
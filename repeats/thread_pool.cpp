@@ -0,0 +1,195 @@
+/*
+ * A work-stealing thread pool for running the independent parts of each pass
+ *  of the repeated term search in parallel.
+ */
+
+#include <algorithm>
+#include "thread_pool.h"
+
+using namespace std;
+
+// parallel_for() aims to give each worker this many chunks so that stealing can
+// even out the load
+#define CHUNKS_PER_WORKER 8
+
+int
+get_num_threads(int n_threads) {
+    if (n_threads > 0) {
+        return n_threads;
+    }
+    int n_hardware = (int)thread::hardware_concurrency();
+    return n_hardware > 0 ? n_hardware : 1;
+}
+
+ThreadPool::ThreadPool(int n_threads) :
+    _body(0),
+    _generation(0),
+    _chunks_left(0),
+    _n_active(0),
+    _stopping(false) {
+
+    int n_workers = get_num_threads(n_threads);
+    for (int i = 0; i < n_workers; i++) {
+        _queues.push_back(new WorkQueue());
+    }
+    // Worker 0 is the thread that calls parallel_for()
+    for (int i = 1; i < n_workers; i++) {
+        _threads.push_back(thread(&ThreadPool::worker_main, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _work_cv.notify_all();
+    for (vector<thread>::iterator it = _threads.begin(); it != _threads.end(); ++it) {
+        it->join();
+    }
+    for (vector<WorkQueue *>::iterator it = _queues.begin(); it != _queues.end(); ++it) {
+        delete *it;
+    }
+}
+
+/*
+ * Wait for parallel_for() calls and help run them until the pool is destroyed
+ */
+void
+ThreadPool::worker_main(int worker) {
+    unsigned long generation = 0;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(_mutex);
+            while (!_stopping && _generation == generation) {
+                _work_cv.wait(lock);
+            }
+            if (_stopping) {
+                return;
+            }
+            generation = _generation;
+            _n_active++;
+        }
+
+        run_chunks(worker);
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            _n_active--;
+            if (_n_active == 0 && _chunks_left == 0) {
+                _done_cv.notify_all();
+            }
+        }
+    }
+}
+
+/*
+ * Get the next chunk for `worker` to run: the front of its own queue if there is
+ *  one, otherwise the back of the first non-empty queue of another worker
+ *  Returns: false if there are no chunks left anywhere
+ */
+bool
+ThreadPool::take_chunk(int worker, Chunk& chunk) {
+    int n_workers = num_workers();
+    {
+        WorkQueue *queue = _queues[worker];
+        lock_guard<mutex> lock(queue->_mutex);
+        if (!queue->_chunks.empty()) {
+            chunk = queue->_chunks.front();
+            queue->_chunks.pop_front();
+            return true;
+        }
+    }
+    for (int i = 1; i < n_workers; i++) {
+        WorkQueue *victim = _queues[(worker + i) % n_workers];
+        lock_guard<mutex> lock(victim->_mutex);
+        if (!victim->_chunks.empty()) {
+            chunk = victim->_chunks.back();
+            victim->_chunks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Run chunks of the current loop on `worker` until there are none left to take
+ */
+void
+ThreadPool::run_chunks(int worker) {
+    Chunk chunk(0, 0);
+    while (take_chunk(worker, chunk)) {
+        try {
+            for (size_t i = chunk._begin; i < chunk._end; i++) {
+                (*_body)(i, worker);
+            }
+        } catch (...) {
+            lock_guard<mutex> lock(_mutex);
+            if (!_error) {
+                _error = current_exception();
+            }
+        }
+
+        lock_guard<mutex> lock(_mutex);
+        _chunks_left--;
+        if (_chunks_left == 0) {
+            _done_cv.notify_all();
+        }
+    }
+}
+
+void
+ThreadPool::parallel_for(size_t n, const LoopBody& fn, size_t chunk_size) {
+    if (n == 0) {
+        return;
+    }
+
+    int n_workers = num_workers();
+    if (n_workers == 1) {
+        for (size_t i = 0; i < n; i++) {
+            fn(i, 0);
+        }
+        return;
+    }
+
+    if (chunk_size == 0) {
+        chunk_size = max((size_t)1, n / (n_workers * CHUNKS_PER_WORKER));
+    }
+    size_t n_chunks = (n + chunk_size - 1) / chunk_size;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _body = &fn;
+        _chunks_left = n_chunks;
+    }
+
+    // Deal the chunks round-robin so that neighbouring indexes, which tend to
+    // cost about the same, are spread over all the workers
+    for (size_t c = 0; c < n_chunks; c++) {
+        WorkQueue *queue = _queues[c % n_workers];
+        lock_guard<mutex> lock(queue->_mutex);
+        queue->_chunks.push_back(Chunk(c * chunk_size, min(n, (c + 1) * chunk_size)));
+    }
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _generation++;
+    }
+    _work_cv.notify_all();
+
+    run_chunks(0);
+
+    exception_ptr error;
+    {
+        unique_lock<mutex> lock(_mutex);
+        while (_chunks_left > 0 || _n_active > 0) {
+            _done_cv.wait(lock);
+        }
+        _body = 0;
+        error = _error;
+        _error = exception_ptr();
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed size pool of worker threads that runs loops over index ranges.
+ *
+ * parallel_for(n, fn) splits [0, n) into chunks and deals them out round-robin
+ *  to a queue per worker. Each worker takes chunks from the front of its own
+ *  queue and, when that is empty, steals chunks from the back of the other
+ *  workers' queues. This keeps all workers busy when a few chunks are much
+ *  more expensive than the rest, which is normal for term extension.
+ *
+ * fn(i, worker) is called exactly once for each i in [0, n). `worker` is the
+ *  index of the calling worker in [0, num_workers()) so callers can accumulate
+ *  results per worker without locking and combine them afterwards.
+ *
+ * The thread that calls parallel_for() works as worker 0, so a pool of 1 thread
+ *  runs everything inline and starts no threads.
+ */
+class ThreadPool {
+    typedef std::function<void(size_t, int)> LoopBody;
+
+    // A half open range of loop indexes [_begin, _end)
+    struct Chunk {
+        size_t _begin;
+        size_t _end;
+        Chunk(size_t begin, size_t end) : _begin(begin), _end(end) {}
+    };
+
+    // Chunks waiting to be run by one worker. Other workers steal from the back
+    struct WorkQueue {
+        std::mutex _mutex;
+        std::deque<Chunk> _chunks;
+    };
+
+    std::vector<std::thread> _threads;
+    std::vector<WorkQueue *> _queues;
+
+    // State of the current parallel_for(). Guarded by _mutex
+    std::mutex _mutex;
+    std::condition_variable _work_cv;   // Signals workers that a loop has started or pool is stopping
+    std::condition_variable _done_cv;   // Signals caller that all chunks have been run
+    const LoopBody *_body;
+    unsigned long _generation;          // Incremented for each parallel_for()
+    size_t _chunks_left;                // Chunks not yet completed in current loop
+    int _n_active;                      // Workers currently inside run_chunks()
+    bool _stopping;
+    std::exception_ptr _error;          // First exception thrown by loop body
+
+    void worker_main(int worker);
+    bool take_chunk(int worker, Chunk& chunk);
+    void run_chunks(int worker);
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+public:
+    // n_threads <= 0 => one worker per hardware thread
+    explicit ThreadPool(int n_threads);
+    ~ThreadPool();
+
+    int num_workers() const { return (int)_queues.size(); }
+
+    // Call fn(i, worker) for all i in [0, n) and return when all calls have finished
+    // chunk_size = 0 => choose a chunk size that gives each worker several chunks
+    void parallel_for(size_t n, const LoopBody& fn, size_t chunk_size = 0);
+};
+
+// Return number of worker threads to use for `n_threads` <= 0 => hardware threads
+int get_num_threads(int n_threads);
+
+#endif // #ifndef THREAD_POOL_H
@@ -1,30 +1,22 @@
-#include <windows.h>
+#include <chrono>
 #include "timer.h"
 
 class MyTimer {
-    double _freq;
-    double _time0;
+    typedef std::chrono::steady_clock Clock;
 
-    double get_absolute_time() const {
-        LARGE_INTEGER time;
-        QueryPerformanceCounter(&time);
-        return time.QuadPart * _freq;
-    }
+    Clock::time_point _time0;
 
 public:
-     MyTimer() {
-        LARGE_INTEGER freq;
-        QueryPerformanceFrequency(&freq);
-        _freq = 1.0 / freq.QuadPart;
+    MyTimer() {
         reset();
     }
 
     void reset() {
-        _time0 = get_absolute_time();
+        _time0 = Clock::now();
     }
 
     double get_time() const {
-        return get_absolute_time() - _time0;
+        return std::chrono::duration<double>(Clock::now() - _time0).count();
     }
 };
 
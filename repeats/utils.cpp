@@ -2,10 +2,10 @@
 #include <iostream>
 #include <iomanip>
 #include <assert.h>
-#include <sys/stat.h>
 #include <regex>
 #include "mytypes.h"
 #include "utils.h"
+#include "mapped_file.h"
 
 using namespace std;
 
@@ -15,44 +15,13 @@ string_to_int(const string& s) {
     return from_string(s, x);
 }
 
+/*
+ * Return size of file `path` in bytes. This is 0 for pipes and other files
+ *  whose size can't be known without reading them
+ */
 size_t
 get_file_size(const string& path) {
-    struct stat filestatus;
-    int ret = stat(path.c_str(), &filestatus);
-    if (ret != 0) {
-        cerr << "Can't stat '" << path << ", errno=" << errno << endl;
-    }
-    assert(ret == 0);
-    return filestatus.st_size;
-}
-
-byte *
-read_file(const string& path) {
-    size_t size = get_file_size(path);
-    byte *data = new byte[size];
-    if (data == NULL) {
-        cerr << "could not allocate " << size << " bytes" << endl;
-        return 0;
-    }
-
-    ifstream f;
-    f.open(path, ios::in | ios::binary);
-    if (!f.is_open()) {
-        cerr << "could not open " << path << endl;
-        delete[] data;
-        return 0;
-    }
-
-    f.read((char *)data, size);
-
-    if (f.gcount() < (streamsize)size) {
-        cerr << "could not read " << path << endl;
-        delete[] data;
-        data = NULL;
-    }
-
-    f.close();
-    return data;
+    return MappedFile::get_size(path);
 }
 
 void
@@ -67,7 +36,7 @@ show_bytes(const Term& term) {
 
 void
 print_term_vector(const string& name, const vector<Term>& lst_in, size_t n) {
-    vector<Term>& lst = vector<Term>(lst_in.begin(), lst_in.end());
+    vector<Term> lst(lst_in.begin(), lst_in.end());
     sort(lst.begin(), lst.end());
 
     cout << name << ": " << lst.size() << " [";
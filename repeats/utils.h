@@ -11,6 +11,8 @@
 #include <functional>
 #include <cmath>
 #include <cctype>
+#include <iostream>
+#include <limits>
 
 #include "mytypes.h"
 
@@ -28,7 +30,7 @@ Ceil(double x) {
  */
 template <class T>
 void
-_D(const std::string& s, typename T x) {
+_D(const std::string& s, T x) {
     //std::cout << "dbg:" << s << "='" << x << "'" << std::endl;
 }
 
@@ -42,9 +44,9 @@ _D(const std::string &s) {
  * Convert a string to type T
  */
 template <class T>
-typename T
-from_string(const std::string& s, typename T& x) {
-    stringstream str(s);
+T
+from_string(const std::string& s, T& x) {
+    std::stringstream str(s);
     str >> x;
     return x;
 }
@@ -56,7 +58,7 @@ template <class K, class V>
 std::list<K>
 get_keys_list(const std::map<K, V>& mp) {
     std::list<K> keys;
-    for (std::map<K, V>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
+    for (typename std::map<K, V>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
         keys.push_back(it->first);
     }
     return keys;
@@ -70,14 +72,14 @@ std::vector<K>
 get_keys_vector(const std::map<K, V> &mp) {
     std::vector<K> keys;
     keys.reserve(mp.size());
-    for (std::map<K, V>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
+    for (typename std::map<K, V>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
         keys.push_back(it->first);
     }
 #if 0
     int count = 0;
     K val;
     K total = K();
-    for (std::vector<K>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+    for (typename std::vector<K>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
         count++;
         val = *it;
         total += val;
@@ -92,7 +94,7 @@ std::vector<std::vector<K>>
 get_keys_vector_list(const std::vector<std::map<K, V>> &map_list) {
     std::vector<std::vector<K>> keys_list;
     keys_list.reserve(map_list.size());
-    for (std::vector<std::map<K, V>>::const_iterator it = map_list.begin(); it != map_list.end(); ++it) {
+    for (typename std::vector<std::map<K, V>>::const_iterator it = map_list.begin(); it != map_list.end(); ++it) {
         keys_list.push_back(get_keys_vector(*it));
     }
     return keys_list;
@@ -102,7 +104,7 @@ template <class V>
 int
 get_vector_list_size(const std::vector<std::vector<V>> &vector_list) {
     int size = 0;
-    for (std::vector<std::vector<V>>::const_iterator it = vector_list.begin(); it != vector_list.end(); ++it) {
+    for (typename std::vector<std::vector<V>>::const_iterator it = vector_list.begin(); it != vector_list.end(); ++it) {
         size += (int)it->size();
     }
     return size;
@@ -125,7 +127,7 @@ template <class K, class V>
 std::map<K, V>
 copy_map(const std::map<K, V>& mp) {
     std::map<K, V> result;
-    for (std::map<K, V>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
+    for (typename std::map<K, V>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
         K key = it->first;
         V val = it->second;
         result[key] = val;
@@ -137,7 +139,7 @@ template <class V>
 std::map<Term, V>
 copy_map_byte_term(const std::map<byte, V>& mp) {
     std::map<Term, V> result;
-    for (std::map<byte, V>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
+    for (typename std::map<byte, V>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
         byte key = it->first;
         V val = it->second;
         result[byte_to_term(key)] = val;
@@ -151,11 +153,11 @@ copy_map_byte_term(const std::map<byte, V>& mp) {
 template <class T>
 void
 print_list(const std::string& name, const std::list<T>& lst) {
-    cout << name << ": " << lst.size() << " [";
-    for (std::list<T>::const_iterator it = lst.begin(); it != lst.end(); ++it) {
-        cout << "\"" << *it << "\", ";
+    std::cout << name << ": " << lst.size() << " [";
+    for (typename std::list<T>::const_iterator it = lst.begin(); it != lst.end(); ++it) {
+        std::cout << "\"" << *it << "\", ";
     }
-    cout << "]" << std:: endl;
+    std::cout << "]" << std:: endl;
 }
 
 /*
@@ -164,12 +166,12 @@ print_list(const std::string& name, const std::list<T>& lst) {
 template <class T>
 void
 print_vector(const std::string& name, const std::vector<T>& lst, size_t n=std::numeric_limits<size_t>::max()) {
-    cout << name << ": " << lst.size() << " [";
-    std::vector<T>::const_iterator end = lst.begin() + min(n, lst.size());
-    for (std::vector<T>::const_iterator it = lst.begin(); it != end; ++it) {
-        cout << "\"" << *it << "\", ";
+    std::cout << name << ": " << lst.size() << " [";
+    typename std::vector<T>::const_iterator end = lst.begin() + std::min(n, lst.size());
+    for (typename std::vector<T>::const_iterator it = lst.begin(); it != end; ++it) {
+        std::cout << "\"" << *it << "\", ";
     }
-    cout << "] " << lst.size() << std:: endl;
+    std::cout << "] " << lst.size() << std:: endl;
 }
 
 void
@@ -181,18 +183,18 @@ print_term_vector(const std::string& name, const std::vector<Term>& lst, size_t
 template <class T>
 void
 print_set(const std::string& name, const std::set<T>& lst) {
-    cout << name << ": " << lst.size() << " [";
-    for (std::set<T>::const_iterator it = lst.begin(); it != lst.end(); ++it) {
-        cout << *it << ", ";
+    std::cout << name << ": " << lst.size() << " [";
+    for (typename std::set<T>::const_iterator it = lst.begin(); it != lst.end(); ++it) {
+        std::cout << *it << ", ";
     }
-    cout << "]" << std:: endl;
+    std::cout << "]" << std:: endl;
 }
 
 template <class K, class V>
 size_t
 get_map_vector_size(const std::map<K, std::vector<V>>& mp) {
     size_t size = 0;
-    for (std::map<K, std::vector<V>>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
+    for (typename std::map<K, std::vector<V>>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
         size += it->second.size();
     }
     return size;
@@ -202,7 +204,7 @@ template <class K1, class K2, class V>
 size_t
 get_map_map_vector_size(const std::map<K1, std::map<K2, std::vector<V>>>& mp) {
     size_t size = 0;
-    for (std::map<K1, std::map<K2, std::vector<V>>>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
+    for (typename std::map<K1, std::map<K2, std::vector<V>>>::const_iterator it = mp.begin(); it != mp.end(); ++it) {
         size += get_map_vector_size(it->second);
     }
     return size;
@@ -211,12 +213,11 @@ get_map_map_vector_size(const std::map<K1, std::map<K2, std::vector<V>>>& mp) {
 /*
  * Return smallest x: *begin <= x < *end &&  x >= val
  *  or end if val > *end
+ *  Iter is a random access iterator over a sorted range of T
  */
-template <class T>
-typename std::vector<T>::const_iterator
-get_gteq(typename std::vector<T>::const_iterator begin,
-         typename std::vector<T>::const_iterator end,
-         const T val) {
+template <class Iter, class T>
+Iter
+get_gteq(Iter begin, Iter end, const T val) {
 
     // val <= smallest element in array so return smallest element
     if (val <= *begin) {
@@ -228,19 +229,18 @@ get_gteq(typename std::vector<T>::const_iterator begin,
         return end;
     }
 
-    std::vector<T>::const_iterator ge = std::upper_bound(begin, end, val) - 1;
+    Iter ge = std::upper_bound(begin, end, val) - 1;
     return (val == *ge) ? ge : ge + 1;
 }
 
 /*
  * Return smallest x: *begin2 <= x < *end2 &&  x >= val
  *  or end2 if val > *end2
+ *  Iter is a random access iterator over a sorted range of T
  */
-template <class T>
-typename std::vector<T>::const_iterator
-get_gteq2(typename std::vector<T>::const_iterator begin2,
-          typename std::vector<T>::const_iterator end2,
-          const T val, size_t step_size) {
+template <class Iter, class T>
+Iter
+get_gteq2(Iter begin2, Iter end2, const T val, size_t step_size) {
 
     // val <= smallest element in array so return smallest element
     if (val <= *begin2) {
@@ -253,22 +253,22 @@ get_gteq2(typename std::vector<T>::const_iterator begin2,
     }
 
     // As far as we can go in full steps of step_size
-    std::vector<T>::const_iterator end1 = begin2 + ((end2 - begin2) / step_size) * step_size;
+    Iter end1 = begin2 + ((end2 - begin2) / step_size) * step_size;
 
     // Step through range in steps of step_size
-    for (std::vector<T>::const_iterator begin = begin2; begin < end1; begin += step_size) {
-        std::vector<T>::const_iterator end = begin + step_size;
+    for (Iter begin = begin2; begin < end1; begin += step_size) {
+        Iter end = begin + step_size;
         if (val <= *(end - 1)) {
             // We are in range [begin, end)
             // upper_bound = lowest value > val => upper_bound - 1 is lowest value >= val
-            std::vector<T>::const_iterator ge = std::upper_bound(begin, end, val) - 1;
+            Iter ge = std::upper_bound(begin, end, val) - 1;
             return (val == *ge) ? ge : ge + 1;
         }
     }
 
     // Handle left-over
     if (end1 < end2) {
-        std::vector<T>::const_iterator ge = std::upper_bound(end1, end2, val) - 1;
+        Iter ge = std::upper_bound(end1, end2, val) - 1;
         return (val == *ge) ? ge : ge + 1;
     }
 
@@ -282,11 +282,11 @@ get_gteq2(typename std::vector<T>::const_iterator begin2,
  *  v1.size() * log(v2.size())
  */
 template <class T>
-typename const std::set<T>
-get_intersection(typename const std::set<T>& v1,
-                 typename const std::set<T>& v2) {
+const std::set<T>
+get_intersection(const std::set<T>& v1,
+                 const std::set<T>& v2) {
     std::set<T> v;
-    for (std::set<T>::const_iterator it = v1.begin(); it != v1.end(); ++it) {
+    for (typename std::set<T>::const_iterator it = v1.begin(); it != v1.end(); ++it) {
         if (v2.find(*it) != v2.end()) {
             v.insert(*it);
         }
@@ -301,7 +301,7 @@ template <class K, class V>
 void
 trim_keys(std::map<K, V>& mp, const std::set<K>& keys) {
     std::vector<K> map_keys = get_keys_vector(mp);
-    for (std::vector<K>::iterator it = map_keys.begin(); it < map_keys.end(); ++it) {
+    for (typename std::vector<K>::iterator it = map_keys.begin(); it < map_keys.end(); ++it) {
         if (keys.find(*it) == keys.end()) {
             mp.erase(*it);
         }
@@ -326,7 +326,7 @@ next_power2(double x) {
 inline
 std::string&
 ltrim(std::string& s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), std::not1(std::ptr_fun<int, int>(std::isspace))));
+    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int c) { return !std::isspace(c); }));
     return s;
 }
 
@@ -334,7 +334,7 @@ ltrim(std::string& s) {
 inline
 std::string&
 rtrim(std::string& s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(), std::not1(std::ptr_fun<int, int>(std::isspace))).base(), s.end());
+    s.erase(std::find_if(s.rbegin(), s.rend(), [](int c) { return !std::isspace(c); }).base(), s.end());
     return s;
 }
 
@@ -348,7 +348,6 @@ trim(std::string& s) {
 // Functions in utils.cpp
 int string_to_int(const std::string& s);
 size_t get_file_size(const std::string& path);
-byte *read_file(const std::string& path);
 void show_bytes(const Term& term);
 
 std::vector<std::string> read_path_list(const std::string& path_list_path);